@@ -1,5 +1,379 @@
 #include "helpers.h" // CS50の画像処理用ヘッダーファイル (RGBTRIPLE型等の定義)
+#include <limits.h>  // INT_MAX（intの最大値）を使用するため
 #include <math.h>  // round()関数を使用するために必要
+#include <pthread.h>  // pthread_create等（複数のスレッドで並列に処理する）を使用するため
+#include <stdatomic.h>  // atomic_int（スレッド間で共有するカウンター）を使用するため
+#include <stdint.h>  // 固定幅整数型（uint32_t, uint64_t）を使用するため
+#include <stdio.h>  // FILE, fread, fwrite関数（BMPファイルの読み書き）を使用するため
+#include <stdlib.h>  // calloc, aligned_alloc, free関数（積分画像・面分け画像のメモリ確保）を使用するため
+#include <string.h>  // memcpy, strcmp関数を使用するため
+#include <unistd.h>  // sysconf関数（CPUの数を調べる）を使用するため
+
+// x86のCPUではSSSE3のベクトル命令（SIMD）を使ったカーネルを用意する
+// immintrin.h: _mm_shuffle_epi8等のベクトル命令を関数の形で呼び出すためのヘッダー
+// それ以外のCPUではスカラー（1ピクセルずつの）カーネルだけを使う
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Largest rectangle whose sum fits in 32 bits
+// 合計が必ず32ビット（2^32 - 1以下）に収まる長方形の最大ピクセル数
+// 255 × 16843009 = 4294967295 = 2^32 - 1
+#define SAT_EXACT_PIXELS 16843009
+
+// Alignment of planar image rows in bytes
+// 面分け画像の各行の先頭アドレスをこのバイト数の倍数に揃える
+// 64バイト = 一般的なキャッシュラインのサイズ（ベクトル命令のロードが行の境目をまたがない）
+#define PLANE_ALIGNMENT 64
+
+// Pixels per chunk in filter_row
+// filter_rowで1回に面へ分けるピクセル数（3面で768バイト。L1キャッシュに十分収まる）
+#define ROW_CHUNK 256
+
+// Pixels swapped at a time in flip_vertical
+// flip_verticalで1回に入れ替えるピクセル数（作業用の配列は3KB）
+#define FLIP_CHUNK 1024
+
+// Side of the square blocks in rotate_image
+// rotate_imageで1回に回転する正方形のブロックの1辺のピクセル数
+// 32 × 32ピクセル = 3KB。読み込み元と書き込み先のブロックが両方ともL1キャッシュに収まる
+#define TRANSPOSE_BLOCK 32
+
+// Target size of one tile in bytes
+// run_pipelineで1つのタイル（行の帯）にする目安のバイト数
+// 256KB = 一般的なL2キャッシュに収まる大きさ（全部のフィルターを、帯がキャッシュに残ったままかけられる）
+#define TILE_BYTES (256 * 1024)
+
+// Largest number of worker threads
+// run_pipelineで使うスレッド数の上限
+#define MAX_THREADS 256
+
+// Size of the square-root table of edges
+// edgesで使う平方根の表の大きさ
+// round(√s) は s ≥ 65280（= 255.5² の切り捨て）のとき255以上になるので、0〜65280の表があれば足りる
+#define EDGE_ROOT_SIZE 65281
+
+// Scratch rows needed by edges_band
+// edges_bandの作業用のメモリの大きさ（RGBTRIPLEの行の数で数える。1行 = 3 × widthバイト）
+// 横の差と横にならした値（int16_t）を3行分ずつ = 36 × widthバイト、2乗和（uint16_t）を1行分 = 6 × widthバイト、合計14行
+#define EDGE_SCRATCH_ROWS 14
+
+// Scratch rows for the column sums of blur_band
+// blur_bandの列ごとの縦の合計（int × 3色 = 12 × widthバイト）の大きさ（RGBTRIPLEの行の数で数えて4行）
+// 幅が広い画像ではスタックに置くとあふれる（幅100万ピクセルで12MB）ので、リングと一緒にヒープに確保する
+#define BLUR_COLUMN_ROWS 4
+
+// Limits of convolution kernels
+// convolveで使えるカーネルの大きさと重みの制限
+// CONV_MAX_SIZE: カーネルの一辺の長さの最大（奇数）
+// CONV_WEIGHT_LIMIT: 整数の重みの絶対値の合計の最大（255 × 16384 × 2 + divisor が2^24未満になり、計算があふれない）
+//                    小数の重みも絶対値の合計をこれ以下にする（合計が無限大やNaNにならない）
+// CONV_DIVISOR_LIMIT: 整数の重みで求めた合計を割る数の最大
+// CONV_BIAS_LIMIT: 最後に足す値の絶対値の最大
+#define CONV_MAX_SIZE 15
+#define CONV_WEIGHT_LIMIT 16384
+#define CONV_DIVISOR_LIMIT 65536
+#define CONV_BIAS_LIMIT 65536
+
+// Largest sigma accepted by gaussian_blur
+// gaussian_blurで使える標準偏差の最大（ボックスの半径がintであふれないようにする）
+#define GAUSSIAN_SIGMA_LIMIT 100000.0
+
+// Fixed-point scale of color mix tables
+// 色を混ぜる部分積の表の倍率（係数 × 値 × COLOR_SCALE を整数にして持つ）
+// 3000はセピアの係数（1000分の1単位）とグレースケールの1/3のどちらも整数にできるので、sepia, grayscaleと同じ結果になる
+#define COLOR_SCALE 3000
+
+// ===== 構造体定義 =====
+// summed_area: 積分画像（summed-area table）
+// sums[(i × (width + 1) + j) × 3 + c]: 画像の0行目からi-1行目、0列目からj-1列目までの長方形の、色成分cの合計
+// c = 0: 赤, 1: 緑, 2: 青。(height + 1) × (width + 1)個の要素があり、0行目と0列目は0
+// 合計は色成分ごとに32ビットで、2^32で割った余りを記録する（余りでも長方形の合計は正しく求まる）
+typedef struct
+{
+    int height;       // 元の画像の高さ
+    int width;        // 元の画像の幅
+    uint32_t *sums;   // 合計の表（build_summed_areaで確保し、free_summed_areaで解放する）
+} summed_area;
+
+// planar_image: 面分け画像（赤・緑・青をそれぞれ別の配列に分けた画像）
+// RGBTRIPLEの配列は1ピクセル3バイトで色が交互に並ぶため、ベクトル命令で同じ色をまとめて読めない
+// 面分けにすると、各面は同じ色のバイトが連続するので、16バイト（16ピクセル）ずつまとめて処理できる
+// i行j列目の赤 = red[i × stride + j]（緑・青も同じ）
+typedef struct
+{
+    int height;         // 画像の高さ
+    int width;          // 画像の幅
+    size_t stride;      // 各面の1行のバイト数（widthをPLANE_ALIGNMENTの倍数に切り上げたもの）
+    uint8_t *red;       // 赤の面（height × strideバイト。3つの面の先頭でもある）
+    uint8_t *green;     // 緑の面
+    uint8_t *blue;      // 青の面
+} planar_image;
+
+// plane_kernel: 赤・緑・青の面のcount個のピクセルを、その場で書き換える関数
+// ピクセルごとに独立した色の変換（grayscale, sepia）に使う
+typedef void (*plane_kernel)(uint8_t *red, uint8_t *green, uint8_t *blue, int count);
+
+// conv_kernel: convolveに渡すK × Kのカーネル（重みの表）
+// 整数の重みならweights、小数の重みならfweightsを使う（使わないほうはNULL）
+typedef struct
+{
+    int size;               // 一辺の長さK（1〜CONV_MAX_SIZEの奇数）
+    const int *weights;     // 整数の重み（K × K個、上の行から順に）。小数の重みを使うならNULL
+    const float *fweights;  // 小数の重み（weightsがNULLのときに使う）
+    int divisor;            // 整数の重みで求めた合計を割る数（1〜CONV_DIVISOR_LIMIT）。小数の重みでは使わない
+    int bias;               // 最後に足す値（エンボスの128など）
+} conv_kernel;
+
+// conv_plan: カーネルを調べて、畳み込みに使いやすくした形（plan_convolutionが作る）
+typedef struct
+{
+    int size;                                           // 一辺の長さK
+    int is_float;                                       // 小数の重みなら1
+    int symmetric;                                      // 上下にも左右にも対称なら1
+    int separable;                                      // 縦の重み × 横の重みに分けられれば1
+    int32_t weights[CONV_MAX_SIZE * CONV_MAX_SIZE];     // 整数の重み
+    int32_t column[CONV_MAX_SIZE];                      // 分けたときの縦の重み（整数）
+    int32_t row[CONV_MAX_SIZE];                         // 分けたときの横の重み（整数）
+    float fweights[CONV_MAX_SIZE * CONV_MAX_SIZE];      // 小数の重み
+    float fcolumn[CONV_MAX_SIZE];                       // 分けたときの縦の重み（小数）
+    float frow[CONV_MAX_SIZE];                          // 分けたときの横の重み（小数）
+    int divisor;                                        // 合計を割る数（小数の重みなら1）
+    int bias;                                           // 最後に足す値
+    float inverse;                                      // 1 / (2 × divisor)（割り算の見当に使う）
+} conv_plan;
+
+// color_transform: 表を引くだけでかけられる色の変換（color_identityから作り、color_curve, color_mixなどを重ねる）
+// かけ方: 色を混ぜるなら 出力の色c = curve[c][丸め(mix[c][0][赤] + mix[c][1][緑] + mix[c][2][青])]、混ぜないなら curve[c][入力の色c]
+typedef struct
+{
+    int mixes;                  // 色を混ぜるなら1（mix, weights, inputを使う）
+    int32_t mix[3][3][256];     // mix[c][k][v]: 出力の色cへの、値vの入力の色kの寄与（COLOR_SCALE倍。0: 赤, 1: 緑, 2: 青）
+    uint8_t curve[3][256];      // 最後に色ごとに引く表
+    double weights[3][3];       // 混ぜる係数（ちょうど○.5になったときに、doubleで計算し直すのに使う）
+    uint8_t input[3][256];      // 混ぜる前の色ごとの表（mixに入れたもの。計算し直すときに使う）
+} color_transform;
+
+// filter_kind: run_filter, run_pipelineでかけるフィルターの種類
+typedef enum
+{
+    FILTER_GRAYSCALE,   // グレースケール
+    FILTER_SEPIA,       // セピア
+    FILTER_REFLECT,     // 左右反転
+    FILTER_BLUR,        // 半径radiusのボックスブラー
+    FILTER_EDGES,       // 輪郭の検出（Sobelフィルター）
+    FILTER_CONVOLVE,    // カーネルkernelでの畳み込み
+    FILTER_COLOR,       // 色の変換transform（表を引く）
+    FILTER_KINDS        // 種類の数（新しいフィルターはこの前に追加する）
+} filter_kind;
+
+// image_filter: run_filter, run_pipelineに渡すフィルターとそのパラメーター
+typedef struct
+{
+    filter_kind kind;           // フィルターの種類
+    int radius;                 // ぼかしの半径（FILTER_BLURのときだけ使う。0なら何も変わらない）
+    const conv_kernel *kernel;  // 畳み込みのカーネル（FILTER_CONVOLVEのときだけ使う）
+    const color_transform *transform;  // 色の変換（FILTER_COLORのときだけ使う）
+} image_filter;
+
+// tile_job: run_pipelineの作業スレッドが共有する情報
+// 画像をband_rows行ずつの帯に分け、各スレッドが次の帯を1つずつ取って、全部のフィルターをかける
+typedef struct
+{
+    int height;                 // 画像の高さ
+    int width;                  // 画像の幅
+    RGBTRIPLE *image;           // 画像の先頭（height × width個のピクセル）
+    const image_filter *stages; // かけるフィルター（stages[0]から順に）
+    int count;                  // フィルターの数
+    int reach;                  // のりしろの幅（全部のぼかしの半径の合計。画像の高さ以下）
+    int band_rows;              // 1つの帯の行数
+    int band_count;             // 帯の数
+    RGBTRIPLE *halo;            // 帯の境目ごとの上下reach行の写し（ぼかしがあるときだけ。境目bは(b-1) × 2 × reach行目から）
+    atomic_int next_band;       // 次に処理する帯の番号（全スレッドで共有）
+    atomic_int failed;          // どれかのスレッドでメモリを確保できなかったら1
+} tile_job;
+
+// ===== 関数プロトタイプ宣言 =====
+// helpers.hで宣言されている4つのフィルター（grayscale, sepia, reflect, blur）以外の関数
+int box_blur(int height, int width, RGBTRIPLE image[height][width], int radius);   // 任意の半径でぼかす
+int gaussian_blur(int height, int width, RGBTRIPLE image[height][width], double sigma, int threads);  // ガウシアンぼかし
+int gaussian_stages(double sigma, image_filter stages[3]);                           // ガウシアンに近い3回のボックスブラー
+void blur_band(int height, int width, RGBTRIPLE rows[][width], int first, int top, int bottom, int radius, void *scratch);  // 行の帯をぼかす
+void edges(int height, int width, RGBTRIPLE image[height][width]);                  // 輪郭を検出する
+void edges_band(int height, int width, RGBTRIPLE rows[][width], int first, int top, int bottom, void *scratch);  // 行の帯の輪郭を検出する
+void row_gradients(const uint8_t *row, int n, int16_t *diff, int16_t *smooth);       // 1行の横の差と横にならした値
+void fill_edge_roots(void);                                                          // 平方根の表を作る
+int convolve(int height, int width, RGBTRIPLE image[height][width], const conv_kernel *kernel);  // カーネルで畳み込む
+int conv_kernel_valid(const conv_kernel *kernel);                                    // カーネルが使えるか
+size_t conv_scratch_bytes(int width, int size);                                      // conv_bandの作業用のメモリの大きさ
+void plan_convolution(const conv_kernel *kernel, conv_plan *plan);                   // カーネルを調べる
+int split_int_kernel(conv_plan *plan);                                               // 整数の重みを縦×横に分ける
+int split_float_kernel(conv_plan *plan);                                             // 小数の重みを縦×横に分ける
+int greatest_common_divisor(int a, int b);                                           // 最大公約数
+void conv_band(int height, int width, RGBTRIPLE rows[][width], int first, int top, int bottom, const conv_kernel *kernel, void *scratch);  // 行の帯を畳み込む
+void pad_row(uint8_t *padded, const RGBTRIPLE *row, int width, int radius);          // 端を伸ばして1行を写す
+void color_identity(color_transform *t);                                             // 何も変えない色の変換
+void color_curve(color_transform *t, const uint8_t curves[3][256]);                  // 色ごとの表を重ねる
+int color_gamma(color_transform *t, double gamma);                                   // ガンマ補正を重ねる
+int color_levels(color_transform *t, int black, int white, double gamma);            // レベル補正を重ねる
+int color_mix(color_transform *t, const double weights[3][3]);                       // 色を混ぜる変換を重ねる
+int color_grayscale(color_transform *t);                                             // グレースケールを重ねる
+int color_sepia(color_transform *t);                                                 // セピアを重ねる
+uint8_t mix_channel(const color_transform *t, int c, int red, int green, int blue);  // 混ぜた出力の1色を求める
+void apply_color(int height, int width, RGBTRIPLE image[height][width], const color_transform *t);  // 色の変換をかける
+void color_row(RGBTRIPLE *row, int width, const color_transform *t);                 // 1行に色の変換をかける
+void conv_store_int(uint8_t *out, const int32_t *acc, int n, const conv_plan *plan);  // 整数の合計を丸めて書く
+void conv_store_float(uint8_t *out, const float *acc, int n, const conv_plan *plan);  // 小数の合計を丸めて書く
+void conv_row_int3(const conv_plan *plan, const uint8_t *const *src, int32_t *acc, int32_t *tmp, int n);  // 1行の畳み込み（整数、3 × 3）
+void conv_row_int5(const conv_plan *plan, const uint8_t *const *src, int32_t *acc, int32_t *tmp, int n);  // 1行の畳み込み（整数、5 × 5）
+void conv_row_int7(const conv_plan *plan, const uint8_t *const *src, int32_t *acc, int32_t *tmp, int n);  // 1行の畳み込み（整数、7 × 7）
+void conv_row_int_any(const conv_plan *plan, const uint8_t *const *src, int32_t *acc, int32_t *tmp, int n);  // 1行の畳み込み（整数、任意の大きさ）
+void conv_row_float3(const conv_plan *plan, const uint8_t *const *src, float *acc, float *tmp, int n);  // 1行の畳み込み（小数、3 × 3）
+void conv_row_float5(const conv_plan *plan, const uint8_t *const *src, float *acc, float *tmp, int n);  // 1行の畳み込み（小数、5 × 5）
+void conv_row_float7(const conv_plan *plan, const uint8_t *const *src, float *acc, float *tmp, int n);  // 1行の畳み込み（小数、7 × 7）
+void conv_row_float_any(const conv_plan *plan, const uint8_t *const *src, float *acc, float *tmp, int n);  // 1行の畳み込み（小数、任意の大きさ）
+int build_summed_area(int height, int width, RGBTRIPLE image[height][width], summed_area *table);  // 積分画像を作る
+void free_summed_area(summed_area *table);                                          // 積分画像を解放する
+void region_sum(const summed_area *table, int top, int left, int bottom, int right, uint64_t sum[3]);  // 長方形の合計
+RGBTRIPLE region_mean(const summed_area *table, int top, int left, int bottom, int right);  // 長方形の平均の色
+void box_blur_table(int height, int width, RGBTRIPLE image[height][width], const summed_area *table, int radius);  // 積分画像でぼかす
+int variable_blur(int height, int width, RGBTRIPLE image[height][width], int radius[height][width]);  // ピクセルごとの半径でぼかす
+int planar_alloc(planar_image *p, int height, int width);                             // 面分け画像を確保する
+void planar_free(planar_image *p);                                                   // 面分け画像を解放する
+int planar_load(int height, int width, RGBTRIPLE image[height][width], planar_image *p);  // 面分け画像に変換する
+void planar_store(const planar_image *p, int height, int width, RGBTRIPLE image[height][width]);  // 元の並びに戻す
+void split_row_scalar(uint8_t *red, uint8_t *green, uint8_t *blue, const RGBTRIPLE *src, int width);  // 1行を面に分ける
+void merge_row_scalar(RGBTRIPLE *dst, const uint8_t *red, const uint8_t *green, const uint8_t *blue, int width);  // 面を1行にまとめる
+void reverse_row_scalar(uint8_t *row, int width);                                    // 面の1行を逆順にする
+void reflect_row_scalar(RGBTRIPLE *row, int width);                                  // 1行を左右反転する
+#ifdef HAVE_X86_SIMD
+TARGET_SSSE3 void split_row_ssse3(uint8_t *red, uint8_t *green, uint8_t *blue, const RGBTRIPLE *src, int width);  // 分けるSSSE3版
+TARGET_SSSE3 void merge_row_ssse3(RGBTRIPLE *dst, const uint8_t *red, const uint8_t *green, const uint8_t *blue, int width);  // まとめるSSSE3版
+TARGET_SSSE3 void reverse_row_ssse3(uint8_t *row, int width);                        // 逆順にするSSSE3版
+TARGET_SSSE3 void reflect_row_ssse3(RGBTRIPLE *row, int width);                      // 左右反転するSSSE3版
+#endif
+void filter_row(RGBTRIPLE *row, int width, plane_kernel kernel);                    // 1行にカーネルをかける
+void gray_planes_scalar(uint8_t *red, uint8_t *green, uint8_t *blue, int count);     // 面をグレースケールにする
+void sepia_planes_scalar(uint8_t *red, uint8_t *green, uint8_t *blue, int count);    // 面をセピア調にする
+#ifdef HAVE_X86_SIMD
+void gray_planes_sse2(uint8_t *red, uint8_t *green, uint8_t *blue, int count);       // グレースケールのSSE2版
+void sepia_planes_sse2(uint8_t *red, uint8_t *green, uint8_t *blue, int count);      // セピアのSSE2版
+TARGET_AVX2 void gray_planes_avx2(uint8_t *red, uint8_t *green, uint8_t *blue, int count);   // グレースケールのAVX2版
+TARGET_AVX2 void sepia_planes_avx2(uint8_t *red, uint8_t *green, uint8_t *blue, int count);  // セピアのAVX2版
+#endif
+int select_image_kernel(const char *name);                                           // 使うカーネルを選ぶ
+int set_image_kernel(const char *name);                                              // カーネルの関数ポインタを設定する
+void select_auto_kernel(void);                                                       // CPUに合ったカーネルを選ぶ（初回だけ）
+void flip_vertical(int height, int width, RGBTRIPLE image[height][width]);           // 上下反転する
+void rotate_image(int height, int width, RGBTRIPLE image[height][width], RGBTRIPLE rotated[width][height], int clockwise);  // 90度回転する
+void planar_grayscale(planar_image *p);                                              // 面分け画像をグレースケールにする
+void planar_sepia(planar_image *p);                                                  // 面分け画像をセピア調にする
+void planar_reflect(planar_image *p);                                                // 面分け画像を左右反転する
+void blur_plane(uint8_t *plane, const uint8_t *source, int height, int width, size_t stride, int radius, uint32_t *col);  // 1つの面をぼかす
+int planar_blur(planar_image *p, int radius);                                        // 面分け画像をぼかす
+int run_filter(int height, int width, RGBTRIPLE image[height][width], image_filter filter, int threads);  // 複数スレッドでフィルターをかける
+int filter_reach(image_filter filter);                                               // のりしろの幅
+void filter_band(image_filter filter, int rows, int width, RGBTRIPLE band[rows][width]);  // 行の帯にフィルターをかける
+int pipeline_reach(const image_filter *stages, int count, int height);              // フィルターの並びののりしろの幅
+int pipeline_ring_rows(const image_filter *stages, int count, int tile_rows, int width);  // ぼかし用のリングの行数
+void filter_tile(int height, int width, RGBTRIPLE tile[][width], int first, int last, const image_filter *stages, int count, RGBTRIPLE ring[][width]);  // タイルに全部のフィルターをかける
+int run_pipeline(int height, int width, RGBTRIPLE image[height][width], const image_filter *stages, int count, int threads);  // 複数のフィルターをタイルごとにかける
+void *tile_worker(void *arg);                                                        // run_pipelineの作業スレッド
+int stream_bmp(FILE *input, FILE *output, const image_filter *stages, int count);   // BMPファイルを行の帯ごとに処理する
+int read_bmp_row(FILE *input, RGBTRIPLE *row, int width, int padding);               // BMPの1行を読む
+int write_bmp_row(FILE *output, const RGBTRIPLE *row, int width, int padding);       // BMPの1行を書く
+
+// ===== グローバル変数の定義 =====
+// 行ごとの変換に使うカーネル（関数ポインタ）
+// 最初はスカラー版。どれかのフィルターを最初に使うときに、select_auto_kernel()がCPUに合わせて
+// SSSE3/SSE2/AVX2版に差し替える（image_kernel_onceで1回だけ）。select_image_kernel()で選び直せる
+void (*split_row)(uint8_t *red, uint8_t *green, uint8_t *blue, const RGBTRIPLE *src, int width) = split_row_scalar;
+void (*merge_row)(RGBTRIPLE *dst, const uint8_t *red, const uint8_t *green, const uint8_t *blue, int width) = merge_row_scalar;
+void (*reverse_row)(uint8_t *row, int width) = reverse_row_scalar;
+void (*reflect_row)(RGBTRIPLE *row, int width) = reflect_row_scalar;
+plane_kernel gray_planes = gray_planes_scalar;
+plane_kernel sepia_planes = sepia_planes_scalar;
+pthread_once_t image_kernel_once = PTHREAD_ONCE_INIT;
+
+// セピアの係数
+// SEPIA_WEIGHTS[c][k]: 出力の色c（0: 赤, 1: 緑, 2: 青）を求めるときに、入力の色kに掛ける係数
+// SEPIA_COEFS: 同じ係数を1000倍した整数（整数の計算で誤差が出ない）
+const double SEPIA_WEIGHTS[3][3] = {{.393, .769, .189}, {.349, .686, .168}, {.272, .534, .131}};
+const int SEPIA_COEFS[3][3] = {{393, 769, 189}, {349, 686, 168}, {272, 534, 131}};
+
+// edgesで使う平方根の表
+// edge_roots[s] = round(√s)（0 ≤ s ≤ 65280）。edge_roots_onceを使って、最初に使うときに1回だけ作る
+// pthread_once: 複数のスレッドが同時に呼んでも、関数を1回だけ実行する
+uint8_t edge_roots[EDGE_ROOT_SIZE];
+pthread_once_t edge_roots_once = PTHREAD_ONCE_INIT;
+
+// よく使うカーネル
+// SHARPEN: 中央を強め、上下左右を引いて輪郭をくっきりさせる
+// EMBOSS: 左上と右下の差を取り、128を足して浮き彫りのように見せる
+// GAUSSIAN5: 二項係数（1 4 6 4 1）の外積を256で割った5 × 5のガウシアンぼかし（対称で分離可能）
+const int SHARPEN_WEIGHTS[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
+const int EMBOSS_WEIGHTS[9] = {-1, -1, 0, -1, 0, 1, 0, 1, 1};
+const int GAUSSIAN5_WEIGHTS[25] = {
+    1, 4, 6, 4, 1,
+    4, 16, 24, 16, 4,
+    6, 24, 36, 24, 6,
+    4, 16, 24, 16, 4,
+    1, 4, 6, 4, 1,
+};
+const conv_kernel SHARPEN_KERNEL = {3, SHARPEN_WEIGHTS, NULL, 1, 0};
+const conv_kernel EMBOSS_KERNEL = {3, EMBOSS_WEIGHTS, NULL, 1, 128};
+const conv_kernel GAUSSIAN5_KERNEL = {5, GAUSSIAN5_WEIGHTS, NULL, 256, 0};
+
+#ifdef HAVE_X86_SIMD
+// split_row_ssse3で使う_mm_shuffle_epi8の表
+// SPLIT_MASKS[c][q][k]: 色c（0: 青, 1: 緑, 2: 赤）の面のk番目のバイトを、
+// q番目のレジスター（48バイトのうち16q〜16q+15バイト目）の何バイト目から取るか（-1なら取らない）
+const int8_t SPLIT_MASKS[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}},
+};
+
+// merge_row_ssse3で使う_mm_shuffle_epi8の表
+// MERGE_MASKS[q][c][m]: 出力のq番目のレジスターのm番目のバイトを、色cの面の何バイト目から取るか（-1なら取らない）
+const int8_t MERGE_MASKS[3][3][16] = {
+    {{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+     {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+     {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1}},
+    {{-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+     {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+     {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1}},
+    {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+     {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+     {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}},
+};
+
+// reflect_row_ssse3で使う_mm_shuffle_epi8の表
+// REFLECT_MASKS[q][r][m]: 16ピクセルの並びを逆にしたとき、出力のq番目のレジスターのm番目のバイトを、
+// r番目の入力レジスターの何バイト目から取るか（-1なら取らない）
+// 出力のd番目のバイト = ピクセルd / 3の色d % 3 = 入力のピクセル15 - d / 3の同じ色 = 入力の3 × (15 - d / 3) + d % 3番目のバイト
+const int8_t REFLECT_MASKS[3][3][16] = {
+    {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14},
+     {13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, -1}},
+    {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, -1},
+     {15, -1, 11, 12, 13, 8, 9, 10, 5, 6, 7, 2, 3, 4, -1, 0},
+     {-1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}},
+    {{-1, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2},
+     {1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}},
+
+};
+#endif
 
 // Convert image to grayscale
 // 画像をグレーススケールに変換する関数
@@ -7,237 +381,2568 @@
 // RGBの各成分値を平均化することで実現する
 void grayscale(int height, int width, RGBTRIPLE image[height][width])
 {
-    // 関数の引数について
-    // height: 画像の高さ (ピクセル数)
-    // width: 画像の幅　(ピクセル数)
-    // image: 2次元配列として表現された画像データ
-    //      RGBTRIPLE型: 1つのピクセルの赤(R)、緑(G)、青(B)の値を持つ構造体
-    //      image[i][j]: i行j列目のピクセルデータ
+    // 関数の引数について:
+    // height: 画像の高さ（ピクセル数）
+    // width: 画像の幅（ピクセル数）
+    // image: 2次元配列として表現された画像データ
+    //        RGBTRIPLE型: 1つのピクセルの赤(R)、緑(G)、青(B)の値を持つ構造体
+    //        image[i][j]: i行j列目のピクセルデータ
+
+    // Loop over all rows (すべての行をループする)
+    // 1行ずつfilter_rowに渡し、行の中のピクセルはgray_planesカーネルでまとめて処理する
+    // gray_planes: R、G、Bの平均 round((R + G + B) / 3.0) を整数だけで求める関数
+    //              SSE2/AVX2版は16/32ピクセルずつ計算する（計算の詳細はgray_planes_scalarを参照）
+    // gray_planesを読む前に、CPUに合ったカーネルを選んでおく（2回目からは何もしない）
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < height; i++)
+    {
+        filter_row(image[i], width, gray_planes);
+    }
+
+    // return文は省略可能（void関数の場合）
+    // 明示的に書くことで関数の終了を明確にしている
+    return;
+}
+
+// Convert image to sepia
+// 画像をセピア調に変換する関数
+// セピア調: 古い写真のように茶褐色がかかった色調
+// 温かみのある色合いでノスタルジックな雰囲気を演出する
+void sepia(int height, int width, RGBTRIPLE image[height][width])
+{
+    // Loop over all rows
+    // grayscale関数と同じく、1行ずつfilter_rowに渡す
+    // sepia_planes: 各色成分に特定の係数を掛けて合計し、四捨五入して255で制限する関数
+    //   赤 = 0.393×R + 0.769×G + 0.189×B（セピアでは赤成分が強調される）
+    //   緑 = 0.349×R + 0.686×G + 0.168×B（茶色っぽい中間色）
+    //   青 = 0.272×R + 0.534×G + 0.131×B（暖かい色調にするため最も抑制される）
+    // 係数を1000倍した整数で計算し、SSE2/AVX2版は16/32ピクセルずつ処理する（詳細はsepia_planes_scalarを参照）
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < height; i++)
+    {
+        filter_row(image[i], width, sepia_planes);
+    }
+    return;
+}
+
+// Reflect image horizontally
+// 画像を水平方向に反転する関数
+// 鏡に映したような効果を作る (左右反転)
+void reflect(int height, int width, RGBTRIPLE image[height][width])
+{
+    // Loop over each row
+    // 各行をループする
+    // 行ごとに左右のピクセルを交換していく（交換の仕組みはreflect_row_scalarを参照）
+    // reflect_row: SSSE3版は行の両端から16ピクセルずつまとめて交換する
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < height; i++)
+    {
+        reflect_row(image[i], width);
+    }
+    return;
+}
+
+// Blur image using box blur
+// 画像にぼかしをかける関数
+// ボックスブラー: 各ピクセルを周囲3×3のピクセルとの平均値に置き換える
+// 半径1のbox_blurと同じ（計算の仕組みはbox_blurを参照）
+// 作業用のメモリを確保できなければ、画像はそのまま
+void blur(int height, int width, RGBTRIPLE image[height][width])
+{
+    box_blur(height, width, image, 1);
+    return;
+}
+
+// Blur image with a box of any radius
+// 半径radiusのボックスブラーをかける関数
+// 各ピクセルを、中心から上下左右radiusピクセル以内（(2×radius+1)×(2×radius+1)の範囲）の平均値に置き換える
+// 画像の端では、範囲内に実在するピクセルだけで平均を取る（blurと同じ）
+//
+// 範囲内のピクセルを毎回すべて足すと、1ピクセルあたり(2×radius+1)²回の足し算が必要になる
+// そこで「縦方向の合計」と「横方向の合計」を分けて（分離可能）、窓をずらしながら合計を更新する
+// 窓を1つずらすとき、入ってくる1つを足し、出ていく1つを引くだけなので、
+// 半径がいくつでも1ピクセルあたりの計算量は一定（足し算と引き算が数回）
+//
+// 画像の全体を写さず、書き換え済みの行のうち、まだ窓から出ていない radius + 1 行だけをリングに写す
+// 作業用のメモリは (BLUR_COLUMN_ROWS + radius + 1) × width ピクセルで、画像の高さに関係しない
+// 列ごとの合計もリングと一緒にヒープに置くので、幅や高さが大きな画像でもスタックがあふれない
+// 戻り値: 成功なら0、作業用のメモリを確保できなければ1（画像は変わらない）
+int box_blur(int height, int width, RGBTRIPLE image[height][width], int radius)
+{
+    if (radius < 1 || height < 1 || width < 1)
+    {
+        return 0;  // 半径0以下なら何も変わらない
+    }
+
+    // Allocate the column sums and the ring of source rows
+    // 列ごとの縦の合計（BLUR_COLUMN_ROWS行）と、元の行を写しておくリング（radius + 1行）
+    // 画像が低くてリングを使わないときは、列の合計の分だけ確保する
+    int ring_rows = radius + 1 < height ? radius + 1 : 0;
+    void *scratch = malloc((size_t) (BLUR_COLUMN_ROWS + ring_rows) * width * sizeof(RGBTRIPLE));
+    if (scratch == NULL)
+    {
+        return 1;
+    }
+
+    // 画像全体を1つの帯としてぼかす
+    blur_band(height, width, image, 0, 0, height, radius, scratch);
+    free(scratch);
+    return 0;
+}
+
+// Gaussian blur approximated by three box blurs
+// 標準偏差sigmaのガウシアンぼかしをかける関数
+// 本物のガウシアンの畳み込みは1ピクセルあたり(6 × sigma)²回ほどの掛け算がいる（sigma = 20なら約14000回）
+// ボックスブラーを3回続けてかけると、中心極限定理により、結果はガウシアンぼかしとほぼ同じになる
+// ボックスブラーは窓をずらしながら合計を更新するので、sigmaがいくつでも1ピクセルあたりの計算量は一定
+// 3回のぼかしはrun_pipelineで1つのタイルずつ続けてかける（threads個のスレッド。0ならCPUの数）
+// 画像の端では、範囲内に実在するピクセルだけで平均を取る（box_blurと同じ）
+// 戻り値: 成功なら0、sigmaが不正かメモリを確保できなければ1
+int gaussian_blur(int height, int width, RGBTRIPLE image[height][width], double sigma, int threads)
+{
+    image_filter stages[3];
+    if (gaussian_stages(sigma, stages))
+    {
+        return 1;
+    }
+    return run_pipeline(height, width, image, stages, 3, threads);
+}
+
+// Box blur stages approximating a Gaussian
+// 標準偏差sigmaのガウシアンに近くなる、3回のボックスブラーの半径を求めてstagesに入れる関数
+// 幅wのボックスの分散は (w² - 1) / 12 なので、3回分の分散の合計がsigma²になるように幅を選ぶ
+// 1. 理想の幅 √(12 × sigma² / 3 + 1) 以下で一番大きい奇数をwl、その次の奇数をwu = wl + 2とする
+// 2. 分散の合計がsigma²に一番近くなるように、m回をwl、残りを(3 - m)回をwuにする
+// ほかのフィルターと一緒にrun_pipelineに渡せる（stagesはFILTER_BLURが3つ）
+// 戻り値: 成功なら0、sigmaが負・無限大・NaN・GAUSSIAN_SIGMA_LIMITより大きければ1
+int gaussian_stages(double sigma, image_filter stages[3])
+{
+    if (!(sigma >= 0 && sigma <= GAUSSIAN_SIGMA_LIMIT))
+    {
+        return 1;
+    }
+    double variance = 12 * sigma * sigma;
+    int lower = (int) floor(sqrt(variance / 3 + 1));
+    if (lower % 2 == 0)
+    {
+        lower--;
+    }
+    int upper = lower + 2;
+    int m = (int) lround((variance - 3.0 * lower * lower - 12.0 * lower - 9) / (-4.0 * lower - 4));
+    m = m < 0 ? 0 : m > 3 ? 3 : m;
+    for (int s = 0; s < 3; s++)
+    {
+        int size = s < m ? lower : upper;
+        stages[s].kind = FILTER_BLUR;
+        stages[s].radius = (size - 1) / 2;
+        stages[s].kernel = NULL;
+        stages[s].transform = NULL;
+    }
+    return 0;
+}
+
+// Blur one band of rows
+// top行目からbottom - 1行目までだけをぼかす関数（計算の仕組みはbox_blurを参照）
+// height: 画像全体の高さ（上端・下端の判定に使う）
+// rows[k - first]: 画像のk行目。top - radius行目からbottom + radius - 1行目まで（画像の範囲内）を読み、
+//                  top行目からbottom - 1行目までを、ぼかした結果でその場で書き換える
+// scratch: 作業用のメモリ。先頭のBLUR_COLUMN_ROWS行に列ごとの合計、その後ろのradius + 1行をリングに使う
+//          （radius + 1 >= bottom - top ならリングは使わないので、列の合計の分だけでよい）
+//
+// 縦の窓をずらすとき、出ていく行（i - radius - 1行目）は帯の中ならもう書き換えてある
+// そこで、各行を書き換える前に元のピクセルをリングのi % (radius + 1)番目に写しておく
+// 出ていく行はちょうどradius + 1行前に写した行なので、リングの同じ場所にあり、読んだ直後にi行目で上書きしてよい
+void blur_band(int height, int width, RGBTRIPLE rows[][width], int first, int top, int bottom, int radius, void *scratch)
+{
+    // 列ごとの縦方向の合計（scratchの先頭。幅が広い画像ではスタックに入りきらない）
+    // colRed[j]: j列目の、現在の行の上下radius行以内（画像の範囲内）にある赤成分の合計
+    // 1列の合計は最大255×height なので、intで足りる
+    int *colRed = scratch;
+    int *colGreen = colRed + width;
+    int *colBlue = colGreen + width;
+    RGBTRIPLE (*ring)[width] = (void *) (colBlue + width);  // 列の合計の後ろがリング
+
+    // 最初の行（i = top）の窓: top - radius行目からtop + radius行目まで（画像の範囲内）
+    for (int j = 0; j < width; j++)
+    {
+        colRed[j] = 0;
+        colGreen[j] = 0;
+        colBlue[j] = 0;
+        for (int k = top - radius < 0 ? 0 : top - radius; k <= top + radius && k < height; k++)
+        {
+            colRed[j] += rows[k - first][j].rgbtRed;
+            colGreen[j] += rows[k - first][j].rgbtGreen;
+            colBlue[j] += rows[k - first][j].rgbtBlue;
+        }
+    }
+
+    int slots = radius + 1;  // リングの行数
+    for (int i = top; i < bottom; i++)
+    {
+        // Slide the vertical window down by one row
+        // 縦の窓を1行下にずらす: 下端に入ってくる行（i + radius）を足し、上端から出ていく行（i - radius - 1）を引く
+        // 入ってくる行はまだ書き換えていない。出ていく行は帯の中ならリングから、帯より上ならrowsから読む
+        if (i > top)
+        {
+            int enter = i + radius;
+            int leave = i - radius - 1;
+            RGBTRIPLE *entering = enter < height ? rows[enter - first] : NULL;
+            RGBTRIPLE *leaving = leave < 0 ? NULL : leave >= top ? ring[leave % slots] : rows[leave - first];
+            for (int j = 0; j < width; j++)
+            {
+                if (entering != NULL)
+                {
+                    colRed[j] += entering[j].rgbtRed;
+                    colGreen[j] += entering[j].rgbtGreen;
+                    colBlue[j] += entering[j].rgbtBlue;
+                }
+                if (leaving != NULL)
+                {
+                    colRed[j] -= leaving[j].rgbtRed;
+                    colGreen[j] -= leaving[j].rgbtGreen;
+                    colBlue[j] -= leaving[j].rgbtBlue;
+                }
+            }
+        }
+
+        // 書き換える前に、この行の元のピクセルをリングに写す（radius + 1行後に窓から出ていくときに使う）
+        // その行が帯の中に収まらないなら写す必要はない
+        if (i + slots < bottom)
+        {
+            memcpy(ring[i % slots], rows[i - first], (size_t) width * sizeof(RGBTRIPLE));
+        }
+
+        // 窓に含まれる行数（画像の上端・下端では少なくなる）
+        int upper = i - radius < 0 ? 0 : i - radius;
+        int lower = i + radius >= height ? height - 1 : i + radius;
+        int span = lower - upper + 1;
+
+        // 横方向の合計: 列の合計（colRed等）を、左右radius列ぶん足したもの
+        // 窓全体の合計は最大255×height×width なので、大きな画像でもあふれないようlong longにする
+        long long sumRed = 0, sumGreen = 0, sumBlue = 0;
+        for (int l = 0; l <= radius && l < width; l++)
+        {
+            sumRed += colRed[l];
+            sumGreen += colGreen[l];
+            sumBlue += colBlue[l];
+        }
+
+        for (int j = 0; j < width; j++)
+        {
+            // Slide the horizontal window right by one column
+            // 横の窓を1列右にずらす（縦の窓と同じく、入る列を足し、出る列を引く）
+            if (j > 0)
+            {
+                if (j + radius < width)
+                {
+                    sumRed += colRed[j + radius];
+                    sumGreen += colGreen[j + radius];
+                    sumBlue += colBlue[j + radius];
+                }
+                if (j - radius - 1 >= 0)
+                {
+                    sumRed -= colRed[j - radius - 1];
+                    sumGreen -= colGreen[j - radius - 1];
+                    sumBlue -= colBlue[j - radius - 1];
+                }
+            }
+
+            int left = j - radius < 0 ? 0 : j - radius;
+            int right = j + radius >= width ? width - 1 : j + radius;
+            long long count = (long long) span * (right - left + 1);  // 窓の中の有効なピクセル数
+
+            // 平均を四捨五入する: round(sum / count) と同じ値を整数だけで求める
+            // sum / count + 0.5 を切り捨てる = (2×sum + count) / (2×count) を切り捨てる
+            // 浮動小数点の割り算がいらず、誤差も出ない（半径1ならblurの以前の結果とすべて一致する）
+            rows[i - first][j].rgbtRed = (2 * sumRed + count) / (2 * count);
+            rows[i - first][j].rgbtGreen = (2 * sumGreen + count) / (2 * count);
+            rows[i - first][j].rgbtBlue = (2 * sumBlue + count) / (2 * count);
+        }
+    }
+    return;
+}
+
+// Detect edges
+// 画像の輪郭（エッジ）を検出する関数（Sobelフィルター）
+// 各ピクセルの周囲3×3に2つの重みを掛けて、横方向の変化Gxと縦方向の変化Gyを色成分ごとに求める
+//   Gx: -1  0  1      Gy: -1 -2 -1
+//       -2  0  2           0  0  0
+//       -1  0  1           1  2  1
+// 結果は round(√(Gx² + Gy²)) を255で制限した値。画像の外のピクセルは黒（0）とみなす
+// 作業用のメモリを確保できなければ、画像はそのまま
+void edges(int height, int width, RGBTRIPLE image[height][width])
+{
+    if (height < 1 || width < 1)
+    {
+        return;
+    }
+    void *scratch = malloc((size_t) EDGE_SCRATCH_ROWS * width * sizeof(RGBTRIPLE));
+    if (scratch == NULL)
+    {
+        return;
+    }
+    edges_band(height, width, image, 0, 0, height, scratch);
+    free(scratch);
+}
+
+// Detect edges in one band of rows
+// top行目からbottom - 1行目までだけの輪郭を求め、その場で書き換える関数
+// rows[k - first]: 画像のk行目（top - 1行目からbottom行目まで、画像の範囲内が必要）
+// scratch: EDGE_SCRATCH_ROWS行分（RGBTRIPLEの行で数えて）の作業用のメモリ
+//
+// Sobelの重みは「縦に1 2 1でならす × 横の差」（Gx）と「縦の差 × 横に1 2 1でならす」（Gy）に分けられる
+// そこで各行について、横の差（diff）と横にならした値（smooth）を先に求め、3行分をリングに置いておく
+//   Gx(i行目) = diff(i - 1) + 2 × diff(i) + diff(i + 1)
+//   Gy(i行目) = smooth(i + 1) - smooth(i - 1)
+// diffとsmoothは元のピクセルから求めた時点で保存されるので、i行目を書き換えても後の行の計算に影響しない
+// どの計算もRGBTRIPLEのバイトの並びのまま行う（横の隣のピクセルの同じ色は3バイト離れている）
+// 1行の中のループは条件分岐がないので、コンパイラがベクトル命令にできる（-O3）
+void edges_band(int height, int width, RGBTRIPLE rows[][width], int first, int top, int bottom, void *scratch)
+{
+    // 2乗和から平方根を求める表を、最初に呼ばれたときに1回だけ作る（複数のスレッドから呼ばれても1回）
+    pthread_once(&edge_roots_once, fill_edge_roots);
+
+    int n = 3 * width;  // 1行のバイト数
+    int16_t *diff[3];
+    int16_t *smooth[3];
+    for (int k = 0; k < 3; k++)
+    {
+        diff[k] = (int16_t *) scratch + (size_t) k * n;
+        smooth[k] = (int16_t *) scratch + (size_t) (3 + k) * n;
+    }
+    uint16_t *squares = (uint16_t *) ((int16_t *) scratch + (size_t) 6 * n);
+
+    // k行目の値はリングの(k + 3) % 3番目に置く。画像の外の行はすべて0
+    for (int k = top - 1; k <= top; k++)
+    {
+        const uint8_t *row = k >= 0 && k < height ? (const uint8_t *) rows[k - first] : NULL;
+        row_gradients(row, n, diff[(k + 3) % 3], smooth[(k + 3) % 3]);
+    }
+
+    for (int i = top; i < bottom; i++)
+    {
+        // 1行下（i + 1行目）はまだ書き換えていないので、元のピクセルから求められる
+        const uint8_t *below = i + 1 < height ? (const uint8_t *) rows[i + 1 - first] : NULL;
+        row_gradients(below, n, diff[(i + 1) % 3], smooth[(i + 1) % 3]);
+
+        const int16_t *diffUp = diff[(i + 2) % 3];
+        const int16_t *diffMid = diff[i % 3];
+        const int16_t *diffDown = diff[(i + 1) % 3];
+        const int16_t *smoothUp = smooth[(i + 2) % 3];
+        const int16_t *smoothDown = smooth[(i + 1) % 3];
+
+        // Gx² + Gy²を求める。255.5² 以上ならどれも255になるので、表の最後の番号で打ち切る
+        for (int b = 0; b < n; b++)
+        {
+            int gx = diffUp[b] + 2 * diffMid[b] + diffDown[b];
+            int gy = smoothDown[b] - smoothUp[b];
+            int sum = gx * gx + gy * gy;
+            squares[b] = sum < EDGE_ROOT_SIZE - 1 ? sum : EDGE_ROOT_SIZE - 1;
+        }
+
+        // 平方根は1バイトずつ表を引く（sqrtを呼ばない）
+        uint8_t *out = (uint8_t *) rows[i - first];
+        for (int b = 0; b < n; b++)
+        {
+            out[b] = edge_roots[squares[b]];
+        }
+    }
+}
+
+// Horizontal difference and smoothing of one row
+// 1行のバイトの並びから、各色成分の横の差（右 - 左）と、横に1 2 1でならした値（左 + 2 × 中央 + 右）を求める関数
+// row: 行のバイトの並び（NULLなら画像の外の行で、すべて0）。n: 行のバイト数
+// 左右の端のピクセルでは、画像の外のピクセルを0とみなす
+void row_gradients(const uint8_t *row, int n, int16_t *diff, int16_t *smooth)
+{
+    if (row == NULL)
+    {
+        memset(diff, 0, (size_t) n * sizeof(int16_t));
+        memset(smooth, 0, (size_t) n * sizeof(int16_t));
+        return;
+    }
+
+    // 端の3バイト（左端・右端のピクセル）だけ画像の外を確かめ、残りは条件分岐なしで計算する
+    for (int b = 0; b < n; b++)
+    {
+        if (b == 3 && n - 3 > 3)
+        {
+            for (; b < n - 3; b++)
+            {
+                diff[b] = row[b + 3] - row[b - 3];
+                smooth[b] = row[b - 3] + 2 * row[b] + row[b + 3];
+            }
+        }
+        int left = b >= 3 ? row[b - 3] : 0;
+        int right = b + 3 < n ? row[b + 3] : 0;
+        diff[b] = right - left;
+        smooth[b] = left + 2 * row[b] + right;
+    }
+}
+
+// Fill the square-root table
+// edge_rootsを作る関数（edges_bandから1回だけ呼ばれる）
+// round(√s) = k となるのは (k - 0.5)² ≤ s < (k + 0.5)² のとき
+// sは整数なので、k² - k + 1 ≤ s ≤ k² + k と同じ（sqrtを使わずに整数だけで作れる）
+void fill_edge_roots(void)
+{
+    for (int k = 0; k < 256; k++)
+    {
+        for (int s = k * k - k + 1; s <= k * k + k && s < EDGE_ROOT_SIZE; s++)
+        {
+            edge_roots[s < 0 ? 0 : s] = k;
+        }
+    }
+}
+
+// Start a color transform
+// 何も変えない色の変換（恒等変換）を作る関数
+// ここにcolor_curve, color_mix, color_gamma, color_levelsを順に重ねていき、最後にapply_colorで1回だけかける
+void color_identity(color_transform *t)
+{
+    t->mixes = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            t->curve[c][v] = v;
+        }
+    }
+}
+
+// Append per-channel tone curves
+// 色ごとの表（トーンカーブ）curves[c][v]を、今までの変換の後に重ねる関数（c = 0: 赤, 1: 緑, 2: 青）
+// 表を表で引き直すだけなので、いくつ重ねても1つの表のまま
+void color_curve(color_transform *t, const uint8_t curves[3][256])
+{
+    for (int c = 0; c < 3; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            t->curve[c][v] = curves[c][t->curve[c][v]];
+        }
+    }
+}
+
+// Append a gamma curve
+// ガンマ補正を重ねる関数: 出力 = round(255 × (入力 / 255)^gamma)（gammaが1より小さいと明るく、大きいと暗くなる）
+// 戻り値: 成功なら0、gammaが正の有限の数でなければ1（変換は変わらない）
+int color_gamma(color_transform *t, double gamma)
+{
+    return color_levels(t, 0, 255, gamma);
+}
+
+// Append a levels adjustment
+// レベル補正を重ねる関数: black以下を0、white以上を255にし、その間をガンマgammaの曲線で引き伸ばす
+//   出力 = round(255 × ((入力 - black) / (white - black))^gamma)
+// 戻り値: 成功なら0、0 ≤ black < white ≤ 255でないかgammaが正の有限の数でなければ1（変換は変わらない）
+int color_levels(color_transform *t, int black, int white, double gamma)
+{
+    if (black < 0 || white > 255 || black >= white || !(gamma > 0 && isfinite(gamma)))
+    {
+        return 1;
+    }
+    uint8_t curves[3][256];
+    for (int v = 0; v < 256; v++)
+    {
+        double x = (double) (v - black) / (white - black);
+        x = x < 0 ? 0 : x > 1 ? 1 : x;
+        curves[0][v] = curves[1][v] = curves[2][v] = (uint8_t) lround(255 * pow(x, gamma));
+    }
+    // C17までは「配列へのポインター」にconstを暗黙に足せない（-Wpedanticで警告）ので、明示的に変換する
+    color_curve(t, (const uint8_t (*)[256]) curves);
+    return 0;
+}
+
+// Append a channel mix
+// 色を混ぜる変換（出力の色c = Σ weights[c][k] × 入力の色k、四捨五入して0〜255で制限）を重ねる関数
+// 入力の色ごとに「係数 × 値」の表（部分積の表）を作っておくので、かけるときは表を3回引いて2回足すだけになる
+// 今までの色ごとの表は、部分積の表の中に入れてしまう（mix[c][k][v] = weights[c][k] × curve[k][v]）
+//
+// 色を混ぜる変換を2回重ねると、1回目の結果の丸めと制限が間に入るので、一般には1つの表にまとめられない
+// ただし1回目の出力が3色とも同じ（グレースケールなど）なら、2回目は1つの値からの色ごとの表になるので重ねられる
+// 戻り値: 成功なら0、まとめられなければ1（変換は変わらない。apply_colorを2回に分けてかける）
+int color_mix(color_transform *t, const double weights[3][3])
+{
+    if (!t->mixes)
+    {
+        // 今までの色ごとの表を、部分積の表の入力側に入れる
+        memcpy(t->weights, weights, sizeof(t->weights));
+        memcpy(t->input, t->curve, sizeof(t->input));
+        for (int c = 0; c < 3; c++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                for (int v = 0; v < 256; v++)
+                {
+                    t->mix[c][k][v] = (int32_t) lround(weights[c][k] * t->input[k][v] * COLOR_SCALE);
+                }
+            }
+            for (int v = 0; v < 256; v++)
+            {
+                t->curve[c][v] = v;
+            }
+        }
+        t->mixes = 1;
+        return 0;
+    }
+
+    // 混ぜた結果が3色とも同じか（係数が3色で同じ）
+    if (memcmp(t->weights[0], t->weights[1], sizeof(t->weights[0])) != 0 || memcmp(t->weights[0], t->weights[2], sizeof(t->weights[0])) != 0)
+    {
+        return 1;
+    }
+
+    // 3色とも同じ値mになるので、新しい出力は mの色ごとの表 で表せる
+    // 今の色ごとの表だけを持つ変換に新しく混ぜる変換を重ね、(m, m, m)を入れたときの出力を表にする
+    color_transform next;
+    next.mixes = 0;
+    memcpy(next.curve, t->curve, sizeof(next.curve));
+    color_mix(&next, weights);
+    for (int m = 0; m < 256; m++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            t->curve[c][m] = mix_channel(&next, c, m, m, m);
+        }
+    }
+    return 0;
+}
+
+// Append grayscale as a color transform
+// グレースケール（round((R + G + B) / 3)）を重ねる関数（grayscaleと同じ結果）
+// 戻り値: color_mixと同じ
+int color_grayscale(color_transform *t)
+{
+    const double weights[3][3] = {{1.0 / 3, 1.0 / 3, 1.0 / 3}, {1.0 / 3, 1.0 / 3, 1.0 / 3}, {1.0 / 3, 1.0 / 3, 1.0 / 3}};
+    return color_mix(t, weights);
+}
+
+// Append sepia as a color transform
+// セピア（SEPIA_WEIGHTS）を重ねる関数（sepiaと同じ結果）
+// 戻り値: color_mixと同じ
+int color_sepia(color_transform *t)
+{
+    return color_mix(t, SEPIA_WEIGHTS);
+}
+
+// Mix one output channel
+// 出力の色cを、部分積の表を3回引いて2回足して求め、四捨五入して0〜255で制限する関数（curveを引く前の値）
+// COLOR_SCALEは定数なので、コンパイラは割り算を掛け算とシフトに置き換える
+// ちょうど○.5になる場合だけは、sepia_planes_scalarと同じく、doubleの計算で求め直す
+// （doubleでは係数の誤差により切り上がる場合と切り捨てられる場合があり、sepiaと同じ結果にするため）
+uint8_t mix_channel(const color_transform *t, int c, int red, int green, int blue)
+{
+    int sum = t->mix[c][0][red] + t->mix[c][1][green] + t->mix[c][2][blue];
+    if (sum <= 0)
+    {
+        return 0;
+    }
+    int value = sum / COLOR_SCALE;
+    int rest = sum - value * COLOR_SCALE;
+    if (rest == COLOR_SCALE / 2)
+    {
+        const double *w = t->weights[c];
+        value = (int) round(w[0] * t->input[0][red] + w[1] * t->input[1][green] + w[2] * t->input[2][blue]);
+    }
+    else if (rest > COLOR_SCALE / 2)
+    {
+        value++;
+    }
+    return value > 255 ? 255 : value;
+}
+
+// Apply a color transform to an image
+// 重ねた色の変換を画像にかける関数（いくつ重ねても、1ピクセルあたりの計算は1回分）
+void apply_color(int height, int width, RGBTRIPLE image[height][width], const color_transform *t)
+{
+    for (int i = 0; i < height; i++)
+    {
+        color_row(image[i], width, t);
+    }
+}
+
+// Apply a color transform to one row
+// 1行のピクセルに色の変換をかける関数
+// 色を混ぜないなら色ごとに表を1回引くだけ、混ぜるなら出力の色ごとに部分積の表を3回引いて2回足す
+void color_row(RGBTRIPLE *row, int width, const color_transform *t)
+{
+    if (!t->mixes)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            row[j].rgbtRed = t->curve[0][row[j].rgbtRed];
+            row[j].rgbtGreen = t->curve[1][row[j].rgbtGreen];
+            row[j].rgbtBlue = t->curve[2][row[j].rgbtBlue];
+        }
+        return;
+    }
+
+    for (int j = 0; j < width; j++)
+    {
+        int red = row[j].rgbtRed;
+        int green = row[j].rgbtGreen;
+        int blue = row[j].rgbtBlue;
+        uint8_t out[3];
+        for (int c = 0; c < 3; c++)
+        {
+            // mix_channelと同じ計算。ちょうど○.5になるまれな場合だけmix_channelを呼ぶ
+            int sum = t->mix[c][0][red] + t->mix[c][1][green] + t->mix[c][2][blue];
+            int value = sum > 0 ? (sum + COLOR_SCALE / 2) / COLOR_SCALE : 0;
+            if (value * COLOR_SCALE == sum + COLOR_SCALE / 2)
+            {
+                value = mix_channel(t, c, red, green, blue);
+            }
+            out[c] = t->curve[c][value > 255 ? 255 : value];
+        }
+        row[j].rgbtRed = out[0];
+        row[j].rgbtGreen = out[1];
+        row[j].rgbtBlue = out[2];
+    }
+}
+
+// Convolve with an arbitrary kernel
+// K × Kのカーネル（重みの表）で画像を畳み込む関数（シャープ、エンボス、ガウシアンなど）
+// 各ピクセルの各色成分を、周囲K × Kピクセルの同じ色に重みを掛けて合計した値に置き換える
+//   整数の重み: round(合計 / divisor) + bias、小数の重み: round(合計 + bias)。どちらも0〜255で制限する（0.5は切り上げ）
+// 画像の端では、画像の外のピクセルを一番近い端のピクセルと同じとみなす（端を伸ばす）
+// 戻り値: 成功なら0、カーネルが不正か作業用のメモリを確保できなければ1（画像は変わらない）
+int convolve(int height, int width, RGBTRIPLE image[height][width], const conv_kernel *kernel)
+{
+    if (!conv_kernel_valid(kernel))
+    {
+        return 1;
+    }
+    if (height < 1 || width < 1)
+    {
+        return 0;
+    }
+    void *scratch = malloc(conv_scratch_bytes(width, kernel->size));
+    if (scratch == NULL)
+    {
+        return 1;
+    }
+    conv_band(height, width, image, 0, 0, height, kernel, scratch);
+    free(scratch);
+    return 0;
+}
+
+// Check a convolution kernel
+// カーネルが使えるかを確かめる関数（使えれば1、使えなければ0）
+// 整数の重みは、絶対値の合計がCONV_WEIGHT_LIMIT以下、divisorが1〜CONV_DIVISOR_LIMITなら、計算の途中であふれない
+// 小数の重みは、有限で絶対値の合計がCONV_WEIGHT_LIMIT以下なら、合計が無限大にならない（inf - infのNaNも出ない）
+int conv_kernel_valid(const conv_kernel *kernel)
+{
+    if (kernel == NULL || kernel->size < 1 || kernel->size > CONV_MAX_SIZE || kernel->size % 2 == 0)
+    {
+        return 0;
+    }
+    if (kernel->bias < -CONV_BIAS_LIMIT || kernel->bias > CONV_BIAS_LIMIT)
+    {
+        return 0;
+    }
+    int taps = kernel->size * kernel->size;
+    if (kernel->weights != NULL)
+    {
+        if (kernel->divisor < 1 || kernel->divisor > CONV_DIVISOR_LIMIT)
+        {
+            return 0;
+        }
+        long total = 0;
+        for (int t = 0; t < taps; t++)
+        {
+            total += labs((long) kernel->weights[t]);
+            if (total > CONV_WEIGHT_LIMIT)
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    if (kernel->fweights == NULL)
+    {
+        return 0;
+    }
+    double total = 0;
+    for (int t = 0; t < taps; t++)
+    {
+        if (!isfinite(kernel->fweights[t]))
+        {
+            return 0;
+        }
+        total += fabs(kernel->fweights[t]);
+        if (total > CONV_WEIGHT_LIMIT)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Scratch memory needed by conv_band
+// conv_bandの作業用のメモリのバイト数を求める関数
+// 1行分の合計（3 × width個）、縦の合計（左右を伸ばした行の長さ）、元の行のリング（size行、左右を伸ばしたもの）
+size_t conv_scratch_bytes(int width, int size)
+{
+    size_t n = (size_t) 3 * width;
+    size_t padded = n + (size_t) 3 * (size - 1);
+    return (n + padded) * sizeof(int32_t) + (size_t) size * padded;
+}
+
+// Analyse a convolution kernel
+// カーネルを調べて、畳み込みに使う形（conv_plan）にする関数
+// 1. 対称: 重みが上下にも左右にも対称なら、同じ重みのピクセルを先に足してから掛ける（掛け算が約4分の1）
+// 2. 分離可能: 重みが「縦の重み × 横の重み」に分けられれば、縦と横の2回の1次元の畳み込みにする（K × K回が2K回に）
+//    整数の重みは、ある行を最大公約数で割ったものが横の重みになる（整数のまま、誤差なしで分けられる）
+void plan_convolution(const conv_kernel *kernel, conv_plan *plan)
+{
+    int size = kernel->size;
+    plan->size = size;
+    plan->is_float = kernel->weights == NULL;
+    plan->divisor = plan->is_float ? 1 : kernel->divisor;
+    plan->bias = kernel->bias;
+    plan->inverse = 1.0f / (2 * plan->divisor);
+
+    int taps = size * size;
+    for (int t = 0; t < taps; t++)
+    {
+        if (plan->is_float)
+        {
+            plan->fweights[t] = kernel->fweights[t];
+        }
+        else
+        {
+            plan->weights[t] = kernel->weights[t];
+        }
+    }
+
+    // 対称かどうか（(k, l)、上下の反対側、左右の反対側の重みが同じ）
+    plan->symmetric = 1;
+    for (int k = 0; k < size && plan->symmetric; k++)
+    {
+        for (int l = 0; l < size; l++)
+        {
+            int t = k * size + l;
+            int flipped_row = (size - 1 - k) * size + l;
+            int flipped_column = k * size + (size - 1 - l);
+            int same = plan->is_float
+                ? plan->fweights[t] == plan->fweights[flipped_row] && plan->fweights[t] == plan->fweights[flipped_column]
+                : plan->weights[t] == plan->weights[flipped_row] && plan->weights[t] == plan->weights[flipped_column];
+            if (!same)
+            {
+                plan->symmetric = 0;
+                break;
+            }
+        }
+    }
+
+    plan->separable = plan->is_float ? split_float_kernel(plan) : split_int_kernel(plan);
+}
+
+// Split an integer kernel into column and row weights
+// 整数の重みを「縦の重み（column） × 横の重み（row）」に分けられるか調べる関数（分けられれば1）
+// 0でない行を1つ選び、その行を最大公約数で割ったものを横の重みにする
+// ほかの行は、その何倍か（整数倍）になっていなければならない
+int split_int_kernel(conv_plan *plan)
+{
+    int size = plan->size;
+    const int32_t *w = plan->weights;
+    int pivot = -1;
+    int lead = -1;
+    for (int t = 0; t < size * size && pivot < 0; t++)
+    {
+        if (w[t] != 0)
+        {
+            pivot = t / size;
+            lead = t % size;
+        }
+    }
+    if (pivot < 0)
+    {
+        return 0;
+    }
+
+    int divisor = 0;
+    for (int l = 0; l < size; l++)
+    {
+        divisor = greatest_common_divisor(divisor, abs(w[pivot * size + l]));
+    }
+    for (int l = 0; l < size; l++)
+    {
+        plan->row[l] = w[pivot * size + l] / divisor;
+    }
+    for (int k = 0; k < size; k++)
+    {
+        if (w[k * size + lead] % plan->row[lead] != 0)
+        {
+            return 0;
+        }
+        plan->column[k] = w[k * size + lead] / plan->row[lead];
+        for (int l = 0; l < size; l++)
+        {
+            if (w[k * size + l] != plan->column[k] * plan->row[l])
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Split a float kernel into column and row weights
+// 小数の重みを「縦の重み × 横の重み」に分けられるか調べる関数（分けられれば1）
+// 絶対値が一番大きい重みの行を横の重みにし、ほかの行がその何倍かを縦の重みにする
+// 小数は丸め誤差があるので、一番大きい重みの100万分の1までの違いは同じとみなす
+int split_float_kernel(conv_plan *plan)
+{
+    int size = plan->size;
+    const float *w = plan->fweights;
+    int largest = 0;
+    for (int t = 1; t < size * size; t++)
+    {
+        if (fabsf(w[t]) > fabsf(w[largest]))
+        {
+            largest = t;
+        }
+    }
+    if (w[largest] == 0)
+    {
+        return 0;
+    }
+
+    int pivot = largest / size;
+    int lead = largest % size;
+    float tolerance = fabsf(w[largest]) * 1e-6f;
+    for (int l = 0; l < size; l++)
+    {
+        plan->frow[l] = w[pivot * size + l];
+    }
+    for (int k = 0; k < size; k++)
+    {
+        plan->fcolumn[k] = w[k * size + lead] / w[largest];
+        for (int l = 0; l < size; l++)
+        {
+            if (fabsf(w[k * size + l] - plan->fcolumn[k] * plan->frow[l]) > tolerance)
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Greatest common divisor
+// 0以上の2つの整数の最大公約数を求める関数（ユークリッドの互除法）
+int greatest_common_divisor(int a, int b)
+{
+    while (b != 0)
+    {
+        int rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+// Convolve one band of rows
+// top行目からbottom - 1行目までだけを畳み込み、その場で書き換える関数
+// rows[k - first]: 画像のk行目（top - size / 2行目からbottom + size / 2 - 1行目まで、画像の範囲内が必要）
+// scratch: conv_scratch_bytesバイトの作業用のメモリ
+//
+// 元の行は、左右にsize / 2ピクセルずつ端のピクセルを伸ばしてリングに写す（上下の端は、一番近い行を使う）
+// 写した行は画像の外を読むことがないので、内側のループに範囲の確認がいらない
+// i行目を書き換える前に、i + size / 2行目までをリングに写しておくので、書き換えた行を読むことはない
+void conv_band(int height, int width, RGBTRIPLE rows[][width], int first, int top, int bottom, const conv_kernel *kernel, void *scratch)
+{
+    conv_plan plan;
+    plan_convolution(kernel, &plan);
+    int size = plan.size;
+    int radius = size / 2;
+    int n = 3 * width;
+    int padded = n + 3 * (size - 1);
+
+    // 作業用のメモリ: 合計（n個）、縦の合計（padded個）、元の行のリング（size × paddedバイト）
+    // 合計は、整数の重みならint32_t、小数の重みならfloatとして使う（どちらも4バイト）
+    int32_t *acc = scratch;
+    int32_t *tmp = acc + n;
+    uint8_t *ring = (uint8_t *) (tmp + padded);
+
+    // カーネルの大きさに合わせた関数を選ぶ（3, 5, 7は専用のループ、それ以外は共通のループ）
+    void (*int_row)(const conv_plan *, const uint8_t *const *, int32_t *, int32_t *, int) = conv_row_int_any;
+    void (*float_row)(const conv_plan *, const uint8_t *const *, float *, float *, int) = conv_row_float_any;
+    switch (size)
+    {
+        case 3:
+            int_row = conv_row_int3;
+            float_row = conv_row_float3;
+            break;
+        case 5:
+            int_row = conv_row_int5;
+            float_row = conv_row_float5;
+            break;
+        case 7:
+            int_row = conv_row_int7;
+            float_row = conv_row_float7;
+            break;
+    }
+
+    // 最初の出力行に必要な、上のradius行と自分の行からradius - 1行下までを写す
+    for (int v = top - radius; v < top + radius; v++)
+    {
+        int k = v < 0 ? 0 : v >= height ? height - 1 : v;
+        pad_row(ring + (size_t) ((v % size + size) % size) * padded, rows[k - first], width, radius);
+    }
+
+    const uint8_t *src[CONV_MAX_SIZE];
+    for (int i = top; i < bottom; i++)
+    {
+        // radius行下を写す（まだ書き換えていない）
+        int v = i + radius;
+        int k = v >= height ? height - 1 : v;
+        pad_row(ring + (size_t) (v % size) * padded, rows[k - first], width, radius);
+
+        for (int t = 0; t < size; t++)
+        {
+            int u = i - radius + t;
+            src[t] = ring + (size_t) ((u % size + size) % size) * padded;
+        }
+
+        uint8_t *out = (uint8_t *) rows[i - first];
+        if (plan.is_float)
+        {
+            float_row(&plan, src, (float *) acc, (float *) tmp, n);
+            conv_store_float(out, (const float *) acc, n, &plan);
+        }
+        else
+        {
+            int_row(&plan, src, acc, tmp, n);
+            conv_store_int(out, acc, n, &plan);
+        }
+    }
+}
+
+// Copy a row with its end pixels repeated
+// 1行を、左右にradiusピクセルずつ端のピクセルを伸ばして写す関数
+void pad_row(uint8_t *padded, const RGBTRIPLE *row, int width, int radius)
+{
+    for (int j = 0; j < radius; j++)
+    {
+        memcpy(padded + 3 * j, &row[0], 3);
+        memcpy(padded + 3 * (radius + width + j), &row[width - 1], 3);
+    }
+    memcpy(padded + 3 * radius, row, (size_t) 3 * width);
+}
+
+// Round and store integer convolution sums
+// 整数の合計をround(合計 / divisor) + biasにして、0〜255で制限して書く関数
+// 割り算（div命令）はベクトル命令にできないので、floatの逆数を掛けて商の見当をつけ、余りで±1を直す
+//   商をq = floor((2 × 合計 + divisor) / (2 × divisor))とすると、0.5を切り上げた丸めになる
+//   2 × 合計 + divisorは2^24未満（CONV_WEIGHT_LIMITとCONV_DIVISOR_LIMITで制限）なので、見当のずれは1以内
+void conv_store_int(uint8_t *out, const int32_t *acc, int n, const conv_plan *plan)
+{
+    int divisor = plan->divisor;
+    int bias = plan->bias;
+    if (divisor == 1)
+    {
+        for (int b = 0; b < n; b++)
+        {
+            int value = acc[b] + bias;
+            out[b] = value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+        return;
+    }
+
+    int twice = 2 * divisor;
+    float inverse = plan->inverse;
+    for (int b = 0; b < n; b++)
+    {
+        int numerator = 2 * acc[b] + divisor;
+        int q = (int) ((float) numerator * inverse);
+        int rest = numerator - q * twice;
+        q += (rest >= twice) - (rest < 0);
+        int value = q + bias;
+        out[b] = value < 0 ? 0 : value > 255 ? 255 : value;
+    }
+}
+
+// Round and store float convolution sums
+// 小数の合計をround(合計 + bias)にして、0〜255で制限して書く関数
+// 先に0〜255に制限してから0.5を足して切り捨てる（0以上なので、切り捨てと床関数が同じになる）
+// NaNをintに変換するのは未定義動作なので、「0より大きくない」（NaNを含む）ときは0にする
+void conv_store_float(uint8_t *out, const float *acc, int n, const conv_plan *plan)
+{
+    float bias = plan->bias + 0.5f;
+    for (int b = 0; b < n; b++)
+    {
+        float value = acc[b] + bias;
+        value = value > 0.0f ? value : 0.0f;
+        value = value > 255.0f ? 255.0f : value;
+        out[b] = (int) value;
+    }
+}
+
+// Row convolution loops, specialized by kernel size
+// 1行分の畳み込みの合計を求める関数を作るマクロ（Cにはテンプレートがないので、マクロで同じ形の関数を作る）
+// NAME: 作る関数の名前、SIZE: カーネルの一辺の長さ、T: 重みと合計の型（int32_tかfloat）
+// W, COLUMN, ROW: conv_planの中の重み（整数ならweights, column, row、小数ならfweights, fcolumn, frow）
+//
+// SIZEに3, 5, 7のような定数を渡すと、k, lのループの回数がコンパイル時に決まる
+// コンパイラはk, lのループを展開し、重みをレジスターに置いたまま、外側のバイトのループをベクトル命令にする
+// SIZEにplan->sizeを渡すと、どの大きさでも使える共通の関数になる
+// src[k]: 上からk番目の元の行（左右に伸ばしたもの）。出力のbバイト目は、src[k]のb + 3lバイト目（l = 0〜SIZE - 1）から求める
+// acc: 出力の合計（n個）、tmp: 分離可能なときの縦の合計（n + 3 × (SIZE - 1)個）
+#define DEFINE_CONV_ROW(NAME, SIZE, T, W, COLUMN, ROW)                                      \
+    void NAME(const conv_plan *plan, const uint8_t *const *src, T *acc, T *tmp, int n)      \
+    {                                                                                       \
+        const int K = (SIZE);                                                               \
+        const int R = K / 2;                                                                \
+        if (plan->separable)                                                                \
+        {                                                                                   \
+            /* 縦の重みで各列を合計してから、その結果を横の重みで合計する */                \
+            const T *column = plan->COLUMN;                                                 \
+            const T *row = plan->ROW;                                                       \
+            int padded = n + 3 * (K - 1);                                                   \
+            if (plan->symmetric)                                                            \
+            {                                                                               \
+                /* 対称なら、同じ重みの2つを先に足してから掛ける */                          \
+                for (int x = 0; x < padded; x++)                                            \
+                {                                                                           \
+                    T sum = column[R] * src[R][x];                                          \
+                    for (int k = 0; k < R; k++)                                             \
+                    {                                                                       \
+                        sum += column[k] * (src[k][x] + src[K - 1 - k][x]);                 \
+                    }                                                                       \
+                    tmp[x] = sum;                                                           \
+                }                                                                           \
+                for (int b = 0; b < n; b++)                                                 \
+                {                                                                           \
+                    T sum = row[R] * tmp[b + 3 * R];                                        \
+                    for (int l = 0; l < R; l++)                                             \
+                    {                                                                       \
+                        sum += row[l] * (tmp[b + 3 * l] + tmp[b + 3 * (K - 1 - l)]);        \
+                    }                                                                       \
+                    acc[b] = sum;                                                           \
+                }                                                                           \
+            }                                                                               \
+            else                                                                            \
+            {                                                                               \
+                for (int x = 0; x < padded; x++)                                            \
+                {                                                                           \
+                    T sum = 0;                                                              \
+                    for (int k = 0; k < K; k++)                                             \
+                    {                                                                       \
+                        sum += column[k] * src[k][x];                                       \
+                    }                                                                       \
+                    tmp[x] = sum;                                                           \
+                }                                                                           \
+                for (int b = 0; b < n; b++)                                                 \
+                {                                                                           \
+                    T sum = 0;                                                              \
+                    for (int l = 0; l < K; l++)                                             \
+                    {                                                                       \
+                        sum += row[l] * tmp[b + 3 * l];                                     \
+                    }                                                                       \
+                    acc[b] = sum;                                                           \
+                }                                                                           \
+            }                                                                               \
+            return;                                                                         \
+        }                                                                                   \
+        const T *w = plan->W;                                                               \
+        if (plan->symmetric)                                                                \
+        {                                                                                   \
+            /* 上下左右の4つの同じ重みのピクセルを先に足してから掛ける（中央の行・列は2つか1つ） */ \
+            for (int b = 0; b < n; b++)                                                     \
+            {                                                                               \
+                T sum = 0;                                                                  \
+                for (int k = 0; k <= R; k++)                                                \
+                {                                                                           \
+                    for (int l = 0; l <= R; l++)                                            \
+                    {                                                                       \
+                        int x = b + 3 * l;                                                  \
+                        int y = b + 3 * (K - 1 - l);                                        \
+                        int taps = src[k][x];                                               \
+                        if (l < R)                                                          \
+                        {                                                                   \
+                            taps += src[k][y];                                              \
+                        }                                                                   \
+                        if (k < R)                                                          \
+                        {                                                                   \
+                            taps += src[K - 1 - k][x];                                      \
+                            if (l < R)                                                      \
+                            {                                                               \
+                                taps += src[K - 1 - k][y];                                  \
+                            }                                                               \
+                        }                                                                   \
+                        sum += w[k * K + l] * taps;                                         \
+                    }                                                                       \
+                }                                                                           \
+                acc[b] = sum;                                                               \
+            }                                                                               \
+            return;                                                                         \
+        }                                                                                   \
+        for (int b = 0; b < n; b++)                                                         \
+        {                                                                                   \
+            T sum = 0;                                                                      \
+            for (int k = 0; k < K; k++)                                                     \
+            {                                                                               \
+                for (int l = 0; l < K; l++)                                                 \
+                {                                                                           \
+                    sum += w[k * K + l] * src[k][b + 3 * l];                                \
+                }                                                                           \
+            }                                                                               \
+            acc[b] = sum;                                                                   \
+        }                                                                                   \
+    }
+
+DEFINE_CONV_ROW(conv_row_int3, 3, int32_t, weights, column, row)
+DEFINE_CONV_ROW(conv_row_int5, 5, int32_t, weights, column, row)
+DEFINE_CONV_ROW(conv_row_int7, 7, int32_t, weights, column, row)
+DEFINE_CONV_ROW(conv_row_int_any, plan->size, int32_t, weights, column, row)
+DEFINE_CONV_ROW(conv_row_float3, 3, float, fweights, fcolumn, frow)
+DEFINE_CONV_ROW(conv_row_float5, 5, float, fweights, fcolumn, frow)
+DEFINE_CONV_ROW(conv_row_float7, 7, float, fweights, fcolumn, frow)
+DEFINE_CONV_ROW(conv_row_float_any, plan->size, float, fweights, fcolumn, frow)
+
+// Build a summed-area table
+// 画像の積分画像（summed-area table）を作る関数
+// 表のi行j列目 = 画像の(0, 0)から(i-1, j-1)までの長方形に含まれる、各色成分の合計
+// 0行目と0列目はすべて0にしておくので、長方形の合計を求めるときに端の場合分けがいらない
+// 合計は2^32で割った余りとして足していく（unsigned intはあふれると自動的に余りになる）
+// 戻り値: 成功なら0、メモリを確保できなければ1（tableは使えない）
+int build_summed_area(int height, int width, RGBTRIPLE image[height][width], summed_area *table)
+{
+    table->height = height;
+    table->width = width;
+    table->sums = calloc((size_t) (height + 1) * (width + 1) * 3, sizeof(uint32_t));
+    if (table->sums == NULL)
+    {
+        return 1;
+    }
+
+    // 1行上の合計に、この行の左端からの合計（rowRed等）を足すと、長方形全体の合計になる
+    // 各ピクセルの計算は足し算2回だけなので、表全体を1回の走査で作れる
+    size_t stride = (size_t) (width + 1) * 3;  // 表の1行の要素数
+    for (int i = 0; i < height; i++)
+    {
+        uint32_t *above = table->sums + (size_t) i * stride;
+        uint32_t *row = above + stride;
+        uint32_t rowRed = 0, rowGreen = 0, rowBlue = 0;
+        for (int j = 0; j < width; j++)
+        {
+            rowRed += image[i][j].rgbtRed;
+            rowGreen += image[i][j].rgbtGreen;
+            rowBlue += image[i][j].rgbtBlue;
+            row[(j + 1) * 3 + 0] = above[(j + 1) * 3 + 0] + rowRed;
+            row[(j + 1) * 3 + 1] = above[(j + 1) * 3 + 1] + rowGreen;
+            row[(j + 1) * 3 + 2] = above[(j + 1) * 3 + 2] + rowBlue;
+        }
+    }
+    return 0;
+}
+
+// Free a summed-area table
+// build_summed_areaで確保したメモリを解放する関数
+void free_summed_area(summed_area *table)
+{
+    free(table->sums);
+    table->sums = NULL;
+}
+
+// Sum of a rectangle
+// top行left列からbottom行right列まで（両端を含む）の長方形の、各色成分の合計を求める関数
+// 表の4つの値を足し引きするだけなので、長方形の大きさに関係なく一定の時間で求まる
+//   合計 = S[bottom+1][right+1] - S[top][right+1] - S[bottom+1][left] + S[top][left]
+// 表の値は2^32で割った余りだが、引き算も余りのまま行えば、長方形の合計が2^32未満である限り正しい値になる
+// 255 × SAT_EXACT_PIXELS < 2^32 なので、それより大きな長方形は上下に分けて64ビットで足す
+void region_sum(const summed_area *table, int top, int left, int bottom, int right, uint64_t sum[3])
+{
+    if ((uint64_t) (bottom - top + 1) * (right - left + 1) > SAT_EXACT_PIXELS)
+    {
+        uint64_t lower[3];
+        int middle = top + (bottom - top) / 2;
+        region_sum(table, top, left, middle, right, sum);
+        region_sum(table, middle + 1, left, bottom, right, lower);
+        for (int c = 0; c < 3; c++)
+        {
+            sum[c] += lower[c];
+        }
+        return;
+    }
+
+    size_t stride = (size_t) (table->width + 1) * 3;
+    const uint32_t *upper = table->sums + (size_t) top * stride;
+    const uint32_t *below = table->sums + (size_t) (bottom + 1) * stride;
+    for (int c = 0; c < 3; c++)
+    {
+        sum[c] = (uint32_t) (below[(right + 1) * 3 + c] - upper[(right + 1) * 3 + c] - below[left * 3 + c] + upper[left * 3 + c]);
+    }
+}
+
+// Average color of a rectangle
+// top行left列からbottom行right列まで（両端を含む）の平均の色を返す関数
+// 画像の外にはみ出した部分は切り取り、実在するピクセルだけで平均する（blurの端の扱いと同じ）
+// 長方形が画像と重ならなければ黒（0, 0, 0）を返す
+RGBTRIPLE region_mean(const summed_area *table, int top, int left, int bottom, int right)
+{
+    RGBTRIPLE mean = {0, 0, 0};
+    top = top < 0 ? 0 : top;
+    left = left < 0 ? 0 : left;
+    bottom = bottom >= table->height ? table->height - 1 : bottom;
+    right = right >= table->width ? table->width - 1 : right;
+    if (top > bottom || left > right)
+    {
+        return mean;
+    }
+
+    // 四捨五入はbox_blurと同じく整数だけで行う: (2×合計 + 個数) / (2×個数)
+    uint64_t sum[3];
+    region_sum(table, top, left, bottom, right, sum);
+    uint64_t count = (uint64_t) (bottom - top + 1) * (right - left + 1);
+    mean.rgbtRed = (2 * sum[0] + count) / (2 * count);
+    mean.rgbtGreen = (2 * sum[1] + count) / (2 * count);
+    mean.rgbtBlue = (2 * sum[2] + count) / (2 * count);
+    return mean;
+}
+
+// Box blur from a summed-area table
+// 作成済みの積分画像を使って、半径radiusのボックスブラーをimageに書き込む関数（tableは同じ大きさの画像から作ったもの）
+// 結果はbox_blurとすべて一致する
+// 積分画像が元のピクセルを覚えているので、imageを直接書き換えてもよい（一時コピーがいらない）
+// 同じ画像から複数の半径のぼかしや領域の平均を求める場合は、表を1回作って使い回す
+void box_blur_table(int height, int width, RGBTRIPLE image[height][width], const summed_area *table, int radius)
+{
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            image[i][j] = region_mean(table, i - radius, j - radius, i + radius, j + radius);
+        }
+    }
+}
+
+// Blur with a different radius for every pixel
+// ピクセルごとに異なる半径でぼかす関数（radius[i][j]: i行j列目のピクセルの半径。0ならそのまま）
+// 被写界深度の表現（奥ほど強くぼかす）や、マスクの部分だけをぼかす処理に使う
+// どの半径でも積分画像の4つの値から求まるので、1ピクセルあたりの計算量は一定
+// 戻り値: 成功なら0、メモリを確保できなければ1（imageは変更しない）
+int variable_blur(int height, int width, RGBTRIPLE image[height][width], int radius[height][width])
+{
+    summed_area table;
+    if (build_summed_area(height, width, image, &table) != 0)
+    {
+        return 1;
+    }
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            int r = radius[i][j] < 0 ? 0 : radius[i][j];
+            image[i][j] = region_mean(&table, i - r, j - r, i + r, j + r);
+        }
+    }
+    free_summed_area(&table);
+    return 0;
+}
+
+// Allocate a planar image
+// 高さheight、幅widthの面分け画像（赤・緑・青を別々の面に分けた画像）のメモリを確保する関数
+// 3つの面は1回のaligned_allocでまとめて確保し、各行の先頭をPLANE_ALIGNMENTの倍数のアドレスに揃える
+// 戻り値: 成功なら0、メモリを確保できなければ1
+int planar_alloc(planar_image *p, int height, int width)
+{
+    // 1行のバイト数をPLANE_ALIGNMENTの倍数に切り上げる（行の末尾の余りは使わない）
+    p->height = height;
+    p->width = width;
+    p->stride = ((size_t) width + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+    size_t plane_size = p->stride * (size_t) height;
+    p->red = aligned_alloc(PLANE_ALIGNMENT, plane_size * 3 > 0 ? plane_size * 3 : PLANE_ALIGNMENT);
+    if (p->red == NULL)
+    {
+        return 1;
+    }
+    p->green = p->red + plane_size;
+    p->blue = p->green + plane_size;
+    return 0;
+}
+
+// Free a planar image
+// planar_allocで確保したメモリを解放する関数
+void planar_free(planar_image *p)
+{
+    free(p->red);  // 3つの面はまとめて確保しているので、先頭の1回だけ解放する
+    p->red = NULL;
+    p->green = NULL;
+    p->blue = NULL;
+}
+
+// Convert an image to planar layout
+// RGBTRIPLEの配列（青・緑・赤の3バイトが交互に並ぶ）を、面分け画像に変換する関数
+// 戻り値: 成功なら0、メモリを確保できなければ1（pは使えない）
+int planar_load(int height, int width, RGBTRIPLE image[height][width], planar_image *p)
+{
+    if (planar_alloc(p, height, width) != 0)
+    {
+        return 1;
+    }
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < height; i++)
+    {
+        size_t row = (size_t) i * p->stride;
+        split_row(p->red + row, p->green + row, p->blue + row, image[i], width);
+    }
+    return 0;
+}
+
+// Convert a planar image back
+// 面分け画像を、RGBTRIPLEの配列に書き戻す関数（imageはpと同じ大きさ）
+void planar_store(const planar_image *p, int height, int width, RGBTRIPLE image[height][width])
+{
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < height; i++)
+    {
+        size_t row = (size_t) i * p->stride;
+        merge_row(image[i], p->red + row, p->green + row, p->blue + row, width);
+    }
+}
+
+// Apply a plane kernel to one row
+// RGBTRIPLEの1行を、ROW_CHUNKピクセルずつ面に分けてkernelで処理し、元の並びに戻す関数
+// 面に分けたバッファ（3 × ROW_CHUNKバイト）はL1キャッシュに収まるので、分ける・戻すの往復は速い
+// grayscaleやsepiaのように、ピクセルごとに独立した（周りのピクセルを使わない）処理に使う
+void filter_row(RGBTRIPLE *row, int width, plane_kernel kernel)
+{
+    // _Alignas(64): 配列の先頭アドレスを64バイト境界に揃える（ベクトル命令のロードが速くなる）
+    _Alignas(64) uint8_t red[ROW_CHUNK];
+    _Alignas(64) uint8_t green[ROW_CHUNK];
+    _Alignas(64) uint8_t blue[ROW_CHUNK];
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int j = 0; j < width; j += ROW_CHUNK)
+    {
+        int count = width - j < ROW_CHUNK ? width - j : ROW_CHUNK;
+        split_row(red, green, blue, row + j, count);
+        kernel(red, green, blue, count);
+        merge_row(row + j, red, green, blue, count);
+    }
+}
+
+// Convert planes to grayscale (reference implementation)
+// 赤・緑・青の面のcount個のピクセルをグレースケールにする関数（基準となるスカラー版）
+// grayscaleの計算 round((red + green + blue) / 3.0) を、整数だけで行う
+// SSE2/AVX2版はこの関数とまったく同じ結果を出す
+void gray_planes_scalar(uint8_t *red, uint8_t *green, uint8_t *blue, int count)
+{
+    for (int j = 0; j < count; j++)
+    {
+        // 3つの色成分の算術平均を四捨五入する
+        // 合計を3で割った余りは0, 1, 2で、小数部分は0, 0.333..., 0.666...
+        // 四捨五入で切り上がるのは小数部分が0.666...のときだけなので、合計に1を足してから切り捨てればよい
+        // 例: (100 + 150 + 200 + 1) / 3 = 150 → round(150.0) = 150
+        //     (100 + 150 + 201 + 1) / 3 = 150 → round(150.333...) = 150
+        //     (100 + 150 + 202 + 1) / 3 = 151 → round(150.666...) = 151
+        uint8_t average = (red[j] + green[j] + blue[j] + 1) / 3;
+        red[j] = average;
+        green[j] = average;
+        blue[j] = average;
+    }
+}
+
+// Convert planes to sepia (reference implementation)
+// 赤・緑・青の面のcount個のピクセルをセピア調にする関数（基準となるスカラー版）
+// sepiaの計算 round(.393 * R + .769 * G + .189 * B) 等を、できるだけ整数だけで行う
+// SSE2/AVX2版はこの関数とまったく同じ結果を出す
+void sepia_planes_scalar(uint8_t *red, uint8_t *green, uint8_t *blue, int count)
+{
+    for (int j = 0; j < count; j++)
+    {
+        int original[3] = {red[j], green[j], blue[j]};
+        int result[3];
+        for (int c = 0; c < 3; c++)
+        {
+            // 係数はどれも小数第3位までなので、1000倍した整数（SEPIA_COEFS）で計算すれば誤差が出ない
+            // 1000倍した値tを四捨五入して1000で割る: (t + 500) / 1000
+            int t = SEPIA_COEFS[c][0] * original[0] + SEPIA_COEFS[c][1] * original[1] + SEPIA_COEFS[c][2] * original[2];
+            if (t % 1000 != 500)
+            {
+                result[c] = (t + 500) / 1000;
+            }
+            else
+            {
+                // ちょうど○.5になる場合、doubleの計算では係数（.393等）が2進数で正確に表せない誤差により、
+                // 切り上がる場合と切り捨てられる場合がある（1000個に1個程度）
+                // 以前と同じ結果にするため、この場合だけ以前と同じdoubleの計算で求める
+                result[c] = round(SEPIA_WEIGHTS[c][0] * original[0] + SEPIA_WEIGHTS[c][1] * original[1] + SEPIA_WEIGHTS[c][2] * original[2]);
+            }
+
+            // 255を超えた場合は255に制限する
+            if (result[c] > 255)
+            {
+                result[c] = 255;
+            }
+        }
+        red[j] = result[0];
+        green[j] = result[1];
+        blue[j] = result[2];
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Convert planes to grayscale with SSE2
+// 16ピクセルずつグレースケールにする関数
+// 1. 8ビットの値を16ビットに広げ（_mm_unpacklo_epi8等）、R + G + B + 1 を計算する（最大766）
+// 2. 3で割る代わりに、21846（2^16 / 3 を切り上げた値）を掛けて上位16ビットを取る（_mm_mulhi_epu16）
+//    766以下のどの値でも、3で割って切り捨てた値と一致する（割り算の命令は遅く、ベクトル版もない）
+// 3. 16ビットの結果を8ビットに詰めて（_mm_packus_epi16）、3つの面に書き込む
+void gray_planes_sse2(uint8_t *red, uint8_t *green, uint8_t *blue, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i third = _mm_set1_epi16((short) 21846);
+    int j = 0;
+    for (; j + 16 <= count; j += 16)
+    {
+        __m128i r = _mm_loadu_si128((const __m128i *) (red + j));
+        __m128i g = _mm_loadu_si128((const __m128i *) (green + j));
+        __m128i b = _mm_loadu_si128((const __m128i *) (blue + j));
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero)),
+                                   _mm_add_epi16(_mm_unpacklo_epi8(b, zero), one));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero)),
+                                   _mm_add_epi16(_mm_unpackhi_epi8(b, zero), one));
+        __m128i average = _mm_packus_epi16(_mm_mulhi_epu16(lo, third), _mm_mulhi_epu16(hi, third));
+        _mm_storeu_si128((__m128i *) (red + j), average);
+        _mm_storeu_si128((__m128i *) (green + j), average);
+        _mm_storeu_si128((__m128i *) (blue + j), average);
+    }
+    gray_planes_scalar(red + j, green + j, blue + j, count - j);
+}
+
+// Convert planes to sepia with SSE2
+// 16ピクセルずつセピア調にする関数（sepia_planes_scalarと同じ整数の計算）
+// 1. 1000倍の値 t = 393R + 769G + 189B を32ビットで求める
+//    _mm_madd_epi16: 16ビットの値を2つずつ掛けて足す（(R, G)と(393, 769)の組で R×393 + G×769 が1回で求まる）
+// 2. (t + 500) / 1000 を、8で割る（右シフト）→ 125で割る（33555を掛けて上位16ビットを取り、さらに6ビット右シフト）で求める
+//    8で割った値は43125以下なので16ビットに収まり、この範囲ではどの値でも割り算と一致する
+// 3. 255を超えた値は、8ビットに詰めるとき（_mm_packus_epi16）に自動的に255になる（飽和）
+//    以前の「255を超えたら255にする」if文の代わり
+// 4. ちょうど○.5（t + 500 が1000で割り切れる）になるピクセルが1つでもあれば、
+//    その16ピクセルはスカラー版で計算し直す（doubleの計算と同じ結果にするため。20回に1回程度）
+void sepia_planes_sse2(uint8_t *red, uint8_t *green, uint8_t *blue, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(500);
+    const __m128i seven = _mm_set1_epi32(7);
+    const __m128i offset32 = _mm_set1_epi32(32768);
+    const __m128i offset16 = _mm_set1_epi16((short) 0x8000);
+    const __m128i reciprocal = _mm_set1_epi16((short) 33555);  // 2^22 / 125 を切り上げた値
+    const __m128i c125 = _mm_set1_epi16(125);
+
+    // 各出力の係数: (Rの係数, Gの係数)の組と、(Bの係数, 0)の組
+    __m128i coef_rg[3];
+    __m128i coef_b[3];
+    for (int c = 0; c < 3; c++)
+    {
+        coef_rg[c] = _mm_set1_epi32((SEPIA_COEFS[c][1] << 16) | SEPIA_COEFS[c][0]);
+        coef_b[c] = _mm_set1_epi32(SEPIA_COEFS[c][2]);
+    }
+
+    int j = 0;
+    for (; j + 16 <= count; j += 16)
+    {
+        __m128i r = _mm_loadu_si128((const __m128i *) (red + j));
+        __m128i g = _mm_loadu_si128((const __m128i *) (green + j));
+        __m128i b = _mm_loadu_si128((const __m128i *) (blue + j));
+
+        // 16ピクセルを4ピクセルずつの4組に分け、(R, G)の組と(B, 0)の組を作る
+        __m128i r16[2] = {_mm_unpacklo_epi8(r, zero), _mm_unpackhi_epi8(r, zero)};
+        __m128i g16[2] = {_mm_unpacklo_epi8(g, zero), _mm_unpackhi_epi8(g, zero)};
+        __m128i b16[2] = {_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero)};
+        __m128i rg[4];
+        __m128i b0[4];
+        for (int h = 0; h < 2; h++)
+        {
+            rg[2 * h] = _mm_unpacklo_epi16(r16[h], g16[h]);
+            rg[2 * h + 1] = _mm_unpackhi_epi16(r16[h], g16[h]);
+            b0[2 * h] = _mm_unpacklo_epi16(b16[h], zero);
+            b0[2 * h + 1] = _mm_unpackhi_epi16(b16[h], zero);
+        }
+
+        __m128i out[3];
+        __m128i ties = zero;
+        for (int c = 0; c < 3; c++)
+        {
+            __m128i q16[2];
+            for (int h = 0; h < 2; h++)
+            {
+                // t + 500（32ビット、4ピクセル×2）
+                __m128i y_lo = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rg[2 * h], coef_rg[c]), _mm_madd_epi16(b0[2 * h], coef_b[c])), half);
+                __m128i y_hi = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rg[2 * h + 1], coef_rg[c]), _mm_madd_epi16(b0[2 * h + 1], coef_b[c])), half);
+
+                // 8で割って16ビットに詰める
+                // _mm_packs_epi32は符号付きで飽和させるので、32768を引いてから詰め、最上位ビットを反転して戻す
+                __m128i z = _mm_packs_epi32(_mm_sub_epi32(_mm_srli_epi32(y_lo, 3), offset32), _mm_sub_epi32(_mm_srli_epi32(y_hi, 3), offset32));
+                z = _mm_xor_si128(z, offset16);
+
+                // 125で割る
+                __m128i q = _mm_srli_epi16(_mm_mulhi_epu16(z, reciprocal), 6);
+
+                // ちょうど○.5の判定: t + 500 が8で割り切れ、かつ8で割った値が125で割り切れる
+                __m128i low = _mm_packs_epi32(_mm_and_si128(y_lo, seven), _mm_and_si128(y_hi, seven));
+                __m128i tie = _mm_and_si128(_mm_cmpeq_epi16(low, zero), _mm_cmpeq_epi16(_mm_mullo_epi16(q, c125), z));
+                ties = _mm_or_si128(ties, tie);
+                q16[h] = q;
+            }
+            out[c] = _mm_packus_epi16(q16[0], q16[1]);
+        }
+
+        // _mm_movemask_epi8: 各バイトの最上位ビットを集めた整数（0なら判定がすべて偽）
+        if (_mm_movemask_epi8(ties) != 0)
+        {
+            sepia_planes_scalar(red + j, green + j, blue + j, 16);
+            continue;
+        }
+        _mm_storeu_si128((__m128i *) (red + j), out[0]);
+        _mm_storeu_si128((__m128i *) (green + j), out[1]);
+        _mm_storeu_si128((__m128i *) (blue + j), out[2]);
+    }
+    sepia_planes_scalar(red + j, green + j, blue + j, count - j);
+}
+
+// Convert planes to grayscale with AVX2
+// gray_planes_sse2と同じ計算を、256ビットのレジスターで32ピクセルずつ行う関数
+// AVX2のunpack/packは128ビットの半分ごとに働くが、広げる・詰めるの両方が同じ並びなので、結果の順序は元に戻る
+TARGET_AVX2 void gray_planes_avx2(uint8_t *red, uint8_t *green, uint8_t *blue, int count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i third = _mm256_set1_epi16((short) 21846);
+    int j = 0;
+    for (; j + 32 <= count; j += 32)
+    {
+        __m256i r = _mm256_loadu_si256((const __m256i *) (red + j));
+        __m256i g = _mm256_loadu_si256((const __m256i *) (green + j));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (blue + j));
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(r, zero), _mm256_unpacklo_epi8(g, zero)),
+                                      _mm256_add_epi16(_mm256_unpacklo_epi8(b, zero), one));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(r, zero), _mm256_unpackhi_epi8(g, zero)),
+                                      _mm256_add_epi16(_mm256_unpackhi_epi8(b, zero), one));
+        __m256i average = _mm256_packus_epi16(_mm256_mulhi_epu16(lo, third), _mm256_mulhi_epu16(hi, third));
+        _mm256_storeu_si256((__m256i *) (red + j), average);
+        _mm256_storeu_si256((__m256i *) (green + j), average);
+        _mm256_storeu_si256((__m256i *) (blue + j), average);
+    }
+    gray_planes_sse2(red + j, green + j, blue + j, count - j);
+}
+
+// Convert planes to sepia with AVX2
+// sepia_planes_sse2と同じ計算を、256ビットのレジスターで32ピクセルずつ行う関数
+TARGET_AVX2 void sepia_planes_avx2(uint8_t *red, uint8_t *green, uint8_t *blue, int count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi32(500);
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256i offset32 = _mm256_set1_epi32(32768);
+    const __m256i offset16 = _mm256_set1_epi16((short) 0x8000);
+    const __m256i reciprocal = _mm256_set1_epi16((short) 33555);
+    const __m256i c125 = _mm256_set1_epi16(125);
+
+    __m256i coef_rg[3];
+    __m256i coef_b[3];
+    for (int c = 0; c < 3; c++)
+    {
+        coef_rg[c] = _mm256_set1_epi32((SEPIA_COEFS[c][1] << 16) | SEPIA_COEFS[c][0]);
+        coef_b[c] = _mm256_set1_epi32(SEPIA_COEFS[c][2]);
+    }
+
+    int j = 0;
+    for (; j + 32 <= count; j += 32)
+    {
+        __m256i r = _mm256_loadu_si256((const __m256i *) (red + j));
+        __m256i g = _mm256_loadu_si256((const __m256i *) (green + j));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (blue + j));
+
+        __m256i r16[2] = {_mm256_unpacklo_epi8(r, zero), _mm256_unpackhi_epi8(r, zero)};
+        __m256i g16[2] = {_mm256_unpacklo_epi8(g, zero), _mm256_unpackhi_epi8(g, zero)};
+        __m256i b16[2] = {_mm256_unpacklo_epi8(b, zero), _mm256_unpackhi_epi8(b, zero)};
+        __m256i rg[4];
+        __m256i b0[4];
+        for (int h = 0; h < 2; h++)
+        {
+            rg[2 * h] = _mm256_unpacklo_epi16(r16[h], g16[h]);
+            rg[2 * h + 1] = _mm256_unpackhi_epi16(r16[h], g16[h]);
+            b0[2 * h] = _mm256_unpacklo_epi16(b16[h], zero);
+            b0[2 * h + 1] = _mm256_unpackhi_epi16(b16[h], zero);
+        }
+
+        __m256i out[3];
+        __m256i ties = zero;
+        for (int c = 0; c < 3; c++)
+        {
+            __m256i q16[2];
+            for (int h = 0; h < 2; h++)
+            {
+                __m256i y_lo = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg[2 * h], coef_rg[c]), _mm256_madd_epi16(b0[2 * h], coef_b[c])), half);
+                __m256i y_hi = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg[2 * h + 1], coef_rg[c]), _mm256_madd_epi16(b0[2 * h + 1], coef_b[c])), half);
+                __m256i z = _mm256_packs_epi32(_mm256_sub_epi32(_mm256_srli_epi32(y_lo, 3), offset32), _mm256_sub_epi32(_mm256_srli_epi32(y_hi, 3), offset32));
+                z = _mm256_xor_si256(z, offset16);
+                __m256i q = _mm256_srli_epi16(_mm256_mulhi_epu16(z, reciprocal), 6);
+                __m256i low = _mm256_packs_epi32(_mm256_and_si256(y_lo, seven), _mm256_and_si256(y_hi, seven));
+                __m256i tie = _mm256_and_si256(_mm256_cmpeq_epi16(low, zero), _mm256_cmpeq_epi16(_mm256_mullo_epi16(q, c125), z));
+                ties = _mm256_or_si256(ties, tie);
+                q16[h] = q;
+            }
+            out[c] = _mm256_packus_epi16(q16[0], q16[1]);
+        }
+
+        if (_mm256_movemask_epi8(ties) != 0)
+        {
+            sepia_planes_sse2(red + j, green + j, blue + j, 32);  // 16ピクセルずつ判定し直す
+            continue;
+        }
+        _mm256_storeu_si256((__m256i *) (red + j), out[0]);
+        _mm256_storeu_si256((__m256i *) (green + j), out[1]);
+        _mm256_storeu_si256((__m256i *) (blue + j), out[2]);
+    }
+    sepia_planes_sse2(red + j, green + j, blue + j, count - j);
+}
+#endif
+
+// Split one row into planes (reference implementation)
+// 1行分のピクセル（width個）を、赤・緑・青の面に分ける関数（基準となるスカラー版）
+// SSSE3版はこの関数とまったく同じ結果を出す
+void split_row_scalar(uint8_t *red, uint8_t *green, uint8_t *blue, const RGBTRIPLE *src, int width)
+{
+    for (int j = 0; j < width; j++)
+    {
+        red[j] = src[j].rgbtRed;
+        green[j] = src[j].rgbtGreen;
+        blue[j] = src[j].rgbtBlue;
+    }
+}
+
+// Merge planes into one row (reference implementation)
+// 赤・緑・青の面の1行分を、RGBTRIPLEの並びに戻す関数（基準となるスカラー版）
+void merge_row_scalar(RGBTRIPLE *dst, const uint8_t *red, const uint8_t *green, const uint8_t *blue, int width)
+{
+    for (int j = 0; j < width; j++)
+    {
+        dst[j].rgbtRed = red[j];
+        dst[j].rgbtGreen = green[j];
+        dst[j].rgbtBlue = blue[j];
+    }
+}
+
+// Reverse one plane row in place (reference implementation)
+// 面の1行分（width バイト）の並びを、その場で逆順にする関数（基準となるスカラー版）
+void reverse_row_scalar(uint8_t *row, int width)
+{
+    for (int j = 0; j < width / 2; j++)
+    {
+        uint8_t temp = row[j];
+        row[j] = row[width - 1 - j];
+        row[width - 1 - j] = temp;
+    }
+}
+
+// Reflect one row in place (reference implementation)
+// 1行（widthピクセル）の左右を、その場で反転する関数（基準となるスカラー版）
+void reflect_row_scalar(RGBTRIPLE *row, int width)
+{
+    // Loop over each column up to the middle
+    // 各行の幅の半分までループする
+    // 重要: width / 2 までで十分
+    // 例: 幅が4なら、0, 1までループ (2, 3は交換済み)
+    for (int j = 0; j < width / 2; j++)
+    {
+        // Swap pixels on opposite sides
+        //　反対側のピクセルを交換する
+        // 3つのステップで値を交換　(temp変数をつかった標準的な交換方法)
+
+        // ステップ1: 一時変数に左側のピクセルを保存
+        // temp = 左側の値
+        RGBTRIPLE temp = row[j];
+        // ステップ2: 右側のピクセルを左側にコピー
+        // 左側　= 右側の値
+        // row[j] = 右側の値
+        row[j] = row[width - 1 - j];
+
+        // ステップ3: 一時変数の値を右側にコピー
+        // 右側 = tempに保存した元の右側の値
+        row[width - 1 - j] = temp;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Split one row into planes with SSSE3
+// 16ピクセル（48バイト = 16バイトのレジスター3つ）ずつ、赤・緑・青の面に分ける関数
+// _mm_shuffle_epi8（pshufb）: 表で指定した位置のバイトを集める命令（表の値が-1なら0にする）
+// 各面の16バイトは、3つのレジスターからそれぞれ集めた分をOR（_mm_or_si128）で1つにまとめて作る
+// 端数（16ピクセル未満）はスカラー版で処理する
+TARGET_SSSE3 void split_row_ssse3(uint8_t *red, uint8_t *green, uint8_t *blue, const RGBTRIPLE *src, int width)
+{
+    const uint8_t *bytes = (const uint8_t *) src;
+    uint8_t *planes[3] = {blue, green, red};  // RGBTRIPLEのバイトの順（青, 緑, 赤）
+    __m128i masks[3][3];
+    for (int c = 0; c < 3; c++)
+    {
+        for (int q = 0; q < 3; q++)
+        {
+            masks[c][q] = _mm_loadu_si128((const __m128i *) SPLIT_MASKS[c][q]);
+        }
+    }
+
+    int j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (bytes + 3 * j));
+        __m128i b = _mm_loadu_si128((const __m128i *) (bytes + 3 * j + 16));
+        __m128i d = _mm_loadu_si128((const __m128i *) (bytes + 3 * j + 32));
+        for (int c = 0; c < 3; c++)
+        {
+            __m128i v = _mm_or_si128(_mm_shuffle_epi8(a, masks[c][0]), _mm_shuffle_epi8(b, masks[c][1]));
+            v = _mm_or_si128(v, _mm_shuffle_epi8(d, masks[c][2]));
+            _mm_storeu_si128((__m128i *) (planes[c] + j), v);
+        }
+    }
+    split_row_scalar(red + j, green + j, blue + j, src + j, width - j);
+}
+
+// Merge planes into one row with SSSE3
+// 各面から16バイトずつ読み、48バイト（16ピクセル）のRGBTRIPLEの並びに組み立てる関数
+// 出力の各レジスターは、3つの面からそれぞれ集めた分のORで作る（split_row_ssse3の逆）
+TARGET_SSSE3 void merge_row_ssse3(RGBTRIPLE *dst, const uint8_t *red, const uint8_t *green, const uint8_t *blue, int width)
+{
+    uint8_t *bytes = (uint8_t *) dst;
+    const uint8_t *planes[3] = {blue, green, red};
+    __m128i masks[3][3];
+    for (int q = 0; q < 3; q++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            masks[q][c] = _mm_loadu_si128((const __m128i *) MERGE_MASKS[q][c]);
+        }
+    }
+
+    int j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        __m128i v[3];
+        for (int c = 0; c < 3; c++)
+        {
+            v[c] = _mm_loadu_si128((const __m128i *) (planes[c] + j));
+        }
+        for (int q = 0; q < 3; q++)
+        {
+            __m128i out = _mm_or_si128(_mm_shuffle_epi8(v[0], masks[q][0]), _mm_shuffle_epi8(v[1], masks[q][1]));
+            out = _mm_or_si128(out, _mm_shuffle_epi8(v[2], masks[q][2]));
+            _mm_storeu_si128((__m128i *) (bytes + 3 * j + 16 * q), out);
+        }
+    }
+    merge_row_scalar(dst + j, red + j, green + j, blue + j, width - j);
+}
+
+// Reverse one plane row with SSSE3
+// 行の両端から16バイトずつ読み、それぞれを逆順に並べ替えてから入れ替える関数
+// 真ん中に残った32バイト未満はスカラー版で処理する
+TARGET_SSSE3 void reverse_row_ssse3(uint8_t *row, int width)
+{
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    int left = 0;
+    int right = width;  // 未処理の範囲は [left, right)
+    while (right - left >= 32)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + left));
+        __m128i b = _mm_loadu_si128((const __m128i *) (row + right - 16));
+        _mm_storeu_si128((__m128i *) (row + left), _mm_shuffle_epi8(b, reverse));
+        _mm_storeu_si128((__m128i *) (row + right - 16), _mm_shuffle_epi8(a, reverse));
+        left += 16;
+        right -= 16;
+    }
+    reverse_row_scalar(row + left, right - left);
+}
+
+// Reflect one row with SSSE3
+// 行の両端から16ピクセル（48バイト = レジスター3つ）ずつ読み、それぞれのピクセルの並びを逆にしてから入れ替える関数
+// 1ピクセルは3バイトなので、16バイトのレジスターの境目とピクセルの境目がそろわない
+// そこで出力の各レジスターを、3つの入力レジスターからREFLECT_MASKSで集めたバイトのORで作る（split_row_ssse3と同じ方法）
+// 真ん中に残った32ピクセル未満はスカラー版で処理する
+TARGET_SSSE3 void reflect_row_ssse3(RGBTRIPLE *row, int width)
+{
+    uint8_t *bytes = (uint8_t *) row;
+    __m128i masks[3][3];
+    for (int q = 0; q < 3; q++)
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            masks[q][r] = _mm_loadu_si128((const __m128i *) REFLECT_MASKS[q][r]);
+        }
+    }
+
+    int left = 0;
+    int right = width;  // 未処理の範囲は [left, right)
+    while (right - left >= 32)
+    {
+        uint8_t *ends[2] = {bytes + 3 * left, bytes + 3 * (right - 16)};
+        __m128i v[2][3];
+        for (int e = 0; e < 2; e++)
+        {
+            for (int r = 0; r < 3; r++)
+            {
+                v[e][r] = _mm_loadu_si128((const __m128i *) (ends[e] + 16 * r));
+            }
+        }
+        // 左端の16ピクセルを逆にして右端へ、右端の16ピクセルを逆にして左端へ書く
+        for (int e = 0; e < 2; e++)
+        {
+            for (int q = 0; q < 3; q++)
+            {
+                __m128i out = _mm_or_si128(_mm_shuffle_epi8(v[e][0], masks[q][0]), _mm_shuffle_epi8(v[e][1], masks[q][1]));
+                out = _mm_or_si128(out, _mm_shuffle_epi8(v[e][2], masks[q][2]));
+                _mm_storeu_si128((__m128i *) (ends[1 - e] + 16 * q), out);
+            }
+        }
+        left += 16;
+        right -= 16;
+    }
+    reflect_row_scalar(row + left, right - left);
+}
+#endif
+
+// Select the image kernel
+// 名前に合ったカーネルをsplit_row, merge_row, reverse_row, reflect_row, gray_planes, sepia_planesに設定する関数
+// 名前はscalar, sse2, ssse3, avx2, auto
+// "auto"ならCPUが対応している中で最も速いものを選ぶ
+// 呼ばなくても、フィルターを最初に使うときに"auto"が選ばれる（比べたいときに"scalar"等を選ぶ）
+// 先に初回の自動選択を済ませてから設定するので、後から自動選択で上書きされることはない
+// 戻り値: 成功なら0、未知の名前やCPUが対応していない場合は1（設定は変わらない）
+int select_image_kernel(const char *name)
+{
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    return set_image_kernel(name);
+}
+
+// Select the fastest kernel once
+// CPUが対応している中で最も速いカーネルを設定する関数
+// image_kernel_onceから1回だけ呼ばれる（pthread_onceに渡すので、引数も戻り値もない）
+void select_auto_kernel(void)
+{
+    set_image_kernel("auto");
+}
+
+// Set the kernel pointers
+// select_image_kernelの中身。名前に合ったカーネルを関数ポインタに設定する
+// 戻り値: 成功なら0、未知の名前やCPUが対応していない場合は1
+int set_image_kernel(const char *name)
+{
+    if (strcmp(name, "scalar") == 0)
+    {
+        split_row = split_row_scalar;
+        merge_row = merge_row_scalar;
+        reverse_row = reverse_row_scalar;
+        reflect_row = reflect_row_scalar;
+        gray_planes = gray_planes_scalar;
+        sepia_planes = sepia_planes_scalar;
+        return 0;
+    }
+#ifdef HAVE_X86_SIMD
+    // __builtin_cpu_supports: 実行中のCPUがその命令セットを持っているか調べる（GCC/Clangの組み込み関数）
+    // AVX2を持つCPUは必ずSSSE3も持ち、x86-64のCPUは必ずSSE2を持つ
+    int has_ssse3 = __builtin_cpu_supports("ssse3");
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    if (strcmp(name, "auto") == 0)
+    {
+        name = has_avx2 ? "avx2" : has_ssse3 ? "ssse3" : "sse2";
+    }
+    if (strcmp(name, "avx2") == 0 || strcmp(name, "ssse3") == 0)
+    {
+        if (!has_ssse3 || (strcmp(name, "avx2") == 0 && !has_avx2))
+        {
+            return 1;
+        }
+        split_row = split_row_ssse3;
+        merge_row = merge_row_ssse3;
+        reverse_row = reverse_row_ssse3;
+        reflect_row = reflect_row_ssse3;
+        gray_planes = strcmp(name, "avx2") == 0 ? gray_planes_avx2 : gray_planes_sse2;
+        sepia_planes = strcmp(name, "avx2") == 0 ? sepia_planes_avx2 : sepia_planes_sse2;
+        return 0;
+    }
+    if (strcmp(name, "sse2") == 0)
+    {
+        // SSSE3がないCPUでは、面への分割はスカラー版、色の計算だけSSE2版にする
+        split_row = split_row_scalar;
+        merge_row = merge_row_scalar;
+        reverse_row = reverse_row_scalar;
+        reflect_row = reflect_row_scalar;
+        gray_planes = gray_planes_sse2;
+        sepia_planes = sepia_planes_sse2;
+        return 0;
+    }
+#else
+    if (strcmp(name, "auto") == 0)
+    {
+        return set_image_kernel("scalar");
+    }
+#endif
+    return 1;
+}
+
+// Flip image vertically
+// 画像を上下反転する関数
+// i行目とheight - 1 - i行目を丸ごと入れ替える。行の中の並びは変わらないので、memcpyでまとめて写せる
+// 作業用の配列はFLIP_CHUNKピクセルだけにして、長い行は区切って入れ替える
+void flip_vertical(int height, int width, RGBTRIPLE image[height][width])
+{
+    RGBTRIPLE temp[FLIP_CHUNK];
+    for (int i = 0; i < height / 2; i++)
+    {
+        RGBTRIPLE *upper = image[i];
+        RGBTRIPLE *lower = image[height - 1 - i];
+        for (int j = 0; j < width; j += FLIP_CHUNK)
+        {
+            size_t bytes = (size_t) (width - j < FLIP_CHUNK ? width - j : FLIP_CHUNK) * sizeof(RGBTRIPLE);
+            memcpy(temp, upper + j, bytes);
+            memcpy(upper + j, lower + j, bytes);
+            memcpy(lower + j, temp, bytes);
+        }
+    }
+}
 
-    // Loop over all pixels (すべてのピクセルをループする)
-    // 2重ループを使用して画像の全ピクセルを順番に処理
-    // 外側のループ: 縦方向 (行) を処理
-    for (int i = 0; i < height; i++)
+// Rotate image by 90 degrees
+// 画像を90度回転してrotatedに書く関数（回転後は幅と高さが入れ替わるので、rotatedはwidth行height列）
+// clockwise: 0でなければ時計回り、0なら反時計回り
+//   時計回り:   rotated[j][height - 1 - i] = image[i][j]
+//   反時計回り: rotated[width - 1 - j][i] = image[i][j]
+// 行列の転置と同じで、1行ずつ順に読むと、書き込み先は1ピクセルごとに別の行（離れたアドレス）になる
+// 画像が大きいと、書き込み先のキャッシュラインが再び使われる前にキャッシュから追い出されてしまう
+// そこでTRANSPOSE_BLOCK × TRANSPOSE_BLOCKピクセルのブロックごとに回転する（キャッシュブロッキング）
+// ブロックの読み込み元と書き込み先はどちらもL1キャッシュに収まるので、各キャッシュラインはほぼ1回ずつしか読み書きしない
+void rotate_image(int height, int width, RGBTRIPLE image[height][width], RGBTRIPLE rotated[width][height], int clockwise)
+{
+    for (int top = 0; top < height; top += TRANSPOSE_BLOCK)
     {
-        // 内側のループ: 横方向 (行)　を処理
-        // この2重ループにより、左上から右下まで全ピクセルを網羅
-        for (int j = 0; j < width; j++)
+        int bottom = top + TRANSPOSE_BLOCK > height ? height : top + TRANSPOSE_BLOCK;
+        for (int left = 0; left < width; left += TRANSPOSE_BLOCK)
         {
-            // Take average of red, green, and blue
-            // 赤、緑、青の平均値を取る
-
-            // 現在のピクセル (i行i列) のRGB値を個別の変数に取得
-            // RGBTRIPLE構造体のメンバ変数にアクセス
-            // rgbtRed: 赤成分　(0-255の値)
-            // rgbtGreen: 緑成分 (0-255の値)
-            // rgbtBlue: 青成分 (0-255の値)
-            
-            int red = image[i][j].rgbtred;
-            int green = image[i][j].rgbtGreen;
-            int blue = image[i][j].rgbtBlue;
-
-            // グレースケールの変換の計算
-            // 3つの色成分の算術平均を計算してグレー値を求める
-            // 3.0で割ることで浮動小数点数の除算を行い、より正確な平均を求める
-            // round()関数: 浮動小数点数を最もちかい整数に四捨五入する。
-            // 例: (100 + 150 + 200) / 3.0 = 150.0 → round(150.0) = 150
-            //    (100 + 150 + 201) / 3.0 = 150.333... → round(150.333...) = 150
-            //    (100 + 150 + 202) / 3.0 = 150.666... → round(150.666...) = 151
-            int average = round((red + green + blue) / 3.0);
-
-            // Set each color value to the average
-            // 各色の値を平均値に設定する
-            // グレースケールでは、R、G、Bすべてが同じ値になる
-            // 同じ値のRGBは灰色を表現する
-            // 例: (128, 128, 128) = 中間の灰色
-            //     (0, 0, 0) = 黒
-            //     (255, 255, 255) = 白
-            image[i][j].rgbtRed = average;
-            image[i][j].rgbtGreen = average;
-            image[i][j].rgbtBlue = average;
-        }
-    }
-
-    //return文は省略可能 (void関数の場合)
-    // 明示的に書くことで関数の終了を明確にしている
-    return;
+            int right = left + TRANSPOSE_BLOCK > width ? width : left + TRANSPOSE_BLOCK;
+
+            // ブロックの中では、書き込み先の1行（rotatedの連続したピクセル）ずつ埋める
+            for (int j = left; j < right; j++)
+            {
+                RGBTRIPLE *out = clockwise ? rotated[j] + (height - 1) : rotated[width - 1 - j];
+                int step = clockwise ? -1 : 1;
+                for (int i = top; i < bottom; i++)
+                {
+                    out[step * i] = image[i][j];
+                }
+            }
+        }
+    }
 }
 
-// Convert image to sepia
-// 画像をセピア調に変換する関数
-// セピア調: 古い写真のように茶褐色がかかった色調
-// 温かみのある色合いでノスタルジックな雰囲気を演出する
-void sepia(int height, int width, RGBTRIPLE image[height][width])
+// Convert a planar image to grayscale
+// 面分け画像をグレースケールに変換する関数（grayscaleと同じ結果）
+// 面に分ける必要がないので、各行をそのままgray_planesカーネルに渡す
+void planar_grayscale(planar_image *p)
 {
-    // Loop over each pixel
-    // 各ピクセルをループして処理する
-    // grayscale関数と同じ2重ループ構造
-    for (int i = 0; i < height; i++)
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < p->height; i++)
+    {
+        size_t row = (size_t) i * p->stride;
+        gray_planes(p->red + row, p->green + row, p->blue + row, p->width);
+    }
+}
+
+// Convert a planar image to sepia
+// 面分け画像をセピア調に変換する関数（sepiaと同じ結果）
+void planar_sepia(planar_image *p)
+{
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int i = 0; i < p->height; i++)
+    {
+        size_t row = (size_t) i * p->stride;
+        sepia_planes(p->red + row, p->green + row, p->blue + row, p->width);
+    }
+}
+
+// Reflect a planar image horizontally
+// 面分け画像を左右反転する関数（reflectと同じ結果）
+// 各面の各行を、reverse_row（SSSE3版なら16バイトずつ）で逆順にする
+void planar_reflect(planar_image *p)
+{
+    uint8_t *planes[3] = {p->red, p->green, p->blue};
+    pthread_once(&image_kernel_once, select_auto_kernel);
+    for (int c = 0; c < 3; c++)
+    {
+        for (int i = 0; i < p->height; i++)
+        {
+            reverse_row(planes[c] + (size_t) i * p->stride, p->width);
+        }
+    }
+}
+
+// Box blur one plane
+// 1つの面に半径radiusのボックスブラーをかける関数（box_blurの1色分）
+// source: 元の面のコピー, col: 幅widthの作業用配列（列ごとの縦の合計）
+// 縦の合計の更新は、1行分のバイトを先頭から順に足し引きするだけなのでベクトル化できる
+void blur_plane(uint8_t *plane, const uint8_t *source, int height, int width, size_t stride, int radius, uint32_t *col)
+{
+    for (int j = 0; j < width; j++)
+    {
+        col[j] = 0;
+    }
+    for (int k = 0; k <= radius && k < height; k++)
     {
+        const uint8_t *row = source + (size_t) k * stride;
         for (int j = 0; j < width; j++)
         {
-            // Get original RGB values
-            // 元のRGB値を取得する
-            // 元の値を変数に保存してから計算に使用
-
-            int originalRed = image[i][j].rgbtRed;
-            int originalGreen = image[i][j].rgbtGreen;
-            int originalBlue = image[i][j].rgbtBlue;
-        }
-            // Calculate new colors using the sepia formula
-            // セピアの公式を使って新しい色を計算する
-            // セピアアルゴリズム: 各色成分に特定の係数をかけて合計する
-            // この係数は実際の古い写真の色調を分析して決められた値
-                  
-            // 赤成分の計算: 元の赤×0.393 + 元の緑×0.769 + 元の青×0.189
-            // セピアでは赤成分が強調されるため、緑の係数が最も大きい
-            int sepiaRed = round(.393 * originalRed + .769 * originalGreen + .189 * originalBlue);
-            
-            // 緑成分の計算: 元の赤×0.349 + 元の緑×0.686 + 元の青×0.168
-            // セピアの中間色 (茶色っぽい緑) を作る
-            int sepiaGreen = round(.349 * originalRed + .686 * originalGreen + .168 * originalBlue);
-
-            // 青成分の計算: 元の赤×0.272 + 元の緑×0.534 + 元の青×0.131
-            // セピアでは青成分が最も抑制される (暖かい色調にするため)
-            int sepiaBlue = round(.272 * originalRed + .534 * originalGreen + .131 * originalBlue);
-
-            // Cap the values at 255 if they exceed it
-            // 値が255を超えた場合は255に制限する
-            // RGB値の範囲は0-255なので、計算結果がこの範囲を超えないように制限
-            if (sepiaRed > 255)
+            col[j] += row[j];
+        }
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        // 縦の窓を1行下にずらす（入る行を足し、出る行を引く）
+        if (i > 0 && i + radius < height)
+        {
+            const uint8_t *enter = source + (size_t) (i + radius) * stride;
+            for (int j = 0; j < width; j++)
             {
-                sepiaRed = 255;  // 赤成分の上限制限
+                col[j] += enter[j];
             }
-            if (sepiaGreen > 255)
+        }
+        if (i > 0 && i - radius - 1 >= 0)
+        {
+            const uint8_t *leave = source + (size_t) (i - radius - 1) * stride;
+            for (int j = 0; j < width; j++)
             {
-                sepiaGreen = 255;
+                col[j] -= leave[j];
             }
-            if (sepiaBlue > 255)
+        }
+
+        int top = i - radius < 0 ? 0 : i - radius;
+        int bottom = i + radius >= height ? height - 1 : i + radius;
+        int rows = bottom - top + 1;
+
+        // 横の窓をずらしながら平均を書き込む（四捨五入はbox_blurと同じ）
+        uint8_t *out = plane + (size_t) i * stride;
+        long long sum = 0;
+        for (int l = 0; l <= radius && l < width; l++)
+        {
+            sum += col[l];
+        }
+        for (int j = 0; j < width; j++)
+        {
+            if (j > 0 && j + radius < width)
             {
-                sepiaBlue = 255;  // 青成分の上限制限
+                sum += col[j + radius];
             }
-            if (sepiaGreen > 255)
+            if (j > 0 && j - radius - 1 >= 0)
             {
-                sepiaGreen = 255;  // 緑成分の上限制限
+                sum -= col[j - radius - 1];
             }
+            int left = j - radius < 0 ? 0 : j - radius;
+            int right = j + radius >= width ? width - 1 : j + radius;
+            long long count = (long long) rows * (right - left + 1);
+            out[j] = (2 * sum + count) / (2 * count);
+        }
+    }
+}
 
-            // Update pixel with sepia values
-            // 計算した新しいRGB値で元のピクセルを上書き
-            image[i][j].rgbtRed = sepiaRed;
-            image[i][j].rgbtGreen = sepiaGreen;
-            image[i][j].rgbtBlue = sepiaBlue;
+// Blur a planar image
+// 面分け画像に半径radiusのボックスブラーをかける関数（box_blurと同じ結果）
+// 元の値を残すための一時コピーは1面分だけ確保し、3つの面で使い回す
+// 戻り値: 成功なら0、メモリを確保できなければ1（pは変更しない）
+int planar_blur(planar_image *p, int radius)
+{
+    if (radius < 1 || p->height < 1 || p->width < 1)
+    {
+        return 0;
     }
-    return;
+    size_t plane_size = p->stride * (size_t) p->height;
+    uint8_t *source = aligned_alloc(PLANE_ALIGNMENT, plane_size);
+    uint32_t *col = malloc((size_t) p->width * sizeof(uint32_t));
+    if (source == NULL || col == NULL)
+    {
+        free(source);
+        free(col);
+        return 1;
+    }
+
+    uint8_t *planes[3] = {p->red, p->green, p->blue};
+    for (int c = 0; c < 3; c++)
+    {
+        memcpy(source, planes[c], plane_size);
+        blur_plane(planes[c], source, p->height, p->width, p->stride, radius, col);
+    }
+    free(source);
+    free(col);
+    return 0;
 }
 
-// Reflect image horizontally
-// 画像を水平方向に反転する関数
-// 鏡に映したような効果を作る (左右反転)
-void reflect(int height, int width, RGBTRIPLE image[height][width])
+// Run a filter on several threads, one band of rows at a time
+// フィルターを1つだけ、複数のスレッドで並列にかける関数（フィルターが1つのrun_pipeline）
+// threads: スレッドの数（0ならCPUの数）
+// 戻り値: 成功なら0、メモリを確保できないかフィルターが不正なら1
+int run_filter(int height, int width, RGBTRIPLE image[height][width], image_filter filter, int threads)
 {
-    // Loop over each row
-    // 各行をループする
-    // 行ごとに左右のピクセルを交換していく
-    for (int i = 0; i < height; i++)
+    return run_pipeline(height, width, image, &filter, 1, threads);
+}
+
+// Rows a filter reads above and below each output row
+// フィルターが1行を計算するときに読む、上下それぞれの行数（のりしろの幅）
+// ぼかしは半径の行数、輪郭の検出は1行、畳み込みはカーネルの一辺の半分、行ごとに独立したフィルター（grayscale, sepia, reflect）は0
+int filter_reach(image_filter filter)
+{
+    switch (filter.kind)
+    {
+        case FILTER_BLUR:
+            return filter.radius;
+        case FILTER_EDGES:
+            return 1;
+        case FILTER_CONVOLVE:
+            // 1 × 1でも作業用のメモリ（ring）を使うので、のりしろを1行以上取る
+            return filter.kernel->size > 1 ? filter.kernel->size / 2 : 1;
+        default:
+            return 0;
+    }
+}
+
+// Apply a filter that needs no halo to a band of rows
+// のりしろのいらないフィルターを、rows行の帯（小さな画像とみなす）にかける関数
+void filter_band(image_filter filter, int rows, int width, RGBTRIPLE band[rows][width])
+{
+    switch (filter.kind)
+    {
+        case FILTER_GRAYSCALE:
+            grayscale(rows, width, band);
+            break;
+        case FILTER_SEPIA:
+            sepia(rows, width, band);
+            break;
+        case FILTER_REFLECT:
+            reflect(rows, width, band);
+            break;
+        case FILTER_COLOR:
+            apply_color(rows, width, band, filter.transform);
+            break;
+        default:
+            break;  // 半径0のぼかし（何も変わらない）
+    }
+}
+
+// Total halo of a chain of filters
+// フィルターの並びに必要なのりしろの幅（全部のぼかしの半径の合計）を求める関数
+// のりしろは画像の高さより広くても意味がない（画像全体を読めば足りる）ので、heightで打ち切る
+// 戻り値: のりしろの幅。不正なフィルターがあれば-1
+int pipeline_reach(const image_filter *stages, int count, int height)
+{
+    int reach = 0;
+    for (int s = 0; s < count; s++)
+    {
+        if ((unsigned) stages[s].kind >= FILTER_KINDS || (stages[s].kind == FILTER_BLUR && stages[s].radius < 0))
+        {
+            return -1;
+        }
+        if (stages[s].kind == FILTER_CONVOLVE && !conv_kernel_valid(stages[s].kernel))
+        {
+            return -1;
+        }
+        if (stages[s].kind == FILTER_COLOR && stages[s].transform == NULL)
+        {
+            return -1;
+        }
+        int rows = filter_reach(stages[s]);
+        reach = rows >= height - reach ? height : reach + rows;
+    }
+    return reach;
+}
+
+// Rows of blur ring needed by a chain of filters
+// filter_tileに渡すリング（作業用のメモリ）の行数を求める関数
+// ぼかしには列の合計のBLUR_COLUMN_ROWS行と、一番大きな半径 + 1行のリング（ただしリングはタイルの行数tile_rowsより多くはいらない）
+// 輪郭の検出にはEDGE_SCRATCH_ROWS行
+// 畳み込みにはconv_scratch_bytesバイト（幅widthの行の数に切り上げる）
+int pipeline_ring_rows(const image_filter *stages, int count, int tile_rows, int width)
+{
+    int ring_rows = 1;
+    size_t row_bytes = (size_t) width * sizeof(RGBTRIPLE);
+    for (int s = 0; s < count; s++)
+    {
+        int rows = stages[s].kind == FILTER_EDGES ? EDGE_SCRATCH_ROWS : filter_reach(stages[s]) + 1;
+        if (stages[s].kind == FILTER_CONVOLVE)
+        {
+            rows = (conv_scratch_bytes(width, stages[s].kernel->size) + row_bytes - 1) / row_bytes;
+        }
+        if (stages[s].kind == FILTER_BLUR)
+        {
+            rows = (rows > tile_rows ? tile_rows : rows) + BLUR_COLUMN_ROWS;
+        }
+        if (rows > ring_rows)
+        {
+            ring_rows = rows;
+        }
+    }
+    return ring_rows;
+}
+
+// Run every stage on a tile
+// タイルに全部のフィルターを順にかける関数（run_pipelineとstream_bmpで共通）
+// tile[k - first]: 画像のk行目（first行目からlast - 1行目まで）。heightは画像全体の高さ
+// ring: pipeline_ring_rows行の作業用のメモリ（のりしろのいるフィルターがなければNULLでよい）
+// lo行目からhi - 1行目までが、ここまでのフィルターを正しくかけた行
+// ぼかした結果は、上下radius行がそろっている行だけ正しいので、ぼかすたびに範囲が上下radius行ずつ狭くなる
+// （画像の上端・下端はそれ以上の行がないので狭くならない）
+// そのため、帯の行を正しく求めるには、タイルに上下のりしろ（pipeline_reach行）を含めておく
+void filter_tile(int height, int width, RGBTRIPLE tile[][width], int first, int last, const image_filter *stages, int count, RGBTRIPLE ring[][width])
+{
+    int lo = first;
+    int hi = last;
+    for (int s = 0; s < count; s++)
     {
-        // Loop over each column up to the middle
-        // 各行の幅の半分までループする
-        // 重要: width / 2 までで十分
-        // 例: 幅が4なら、0, 1までループ (2, 3は交換済み)
-        for (int j = 0; j < width / 2; j++)
+        int radius = filter_reach(stages[s]);
+        if (radius == 0)
+        {
+            filter_band(stages[s], hi - lo, width, tile + (lo - first));
+            continue;
+        }
+        int out_lo = lo == 0 ? 0 : lo + radius;
+        int out_hi = hi == height ? height : hi - radius;
+        if (stages[s].kind == FILTER_EDGES)
+        {
+            edges_band(height, width, tile, first, out_lo, out_hi, ring);
+        }
+        else if (stages[s].kind == FILTER_CONVOLVE)
         {
-            // Swap pixels on opposite sides
-            //　反対側のピクセルを交換する
-            // 3つのステップで値を交換　(temp変数をつかった標準的な交換方法)
+            conv_band(height, width, tile, first, out_lo, out_hi, stages[s].kernel, ring);
+        }
+        else
+        {
+            blur_band(height, width, tile, first, out_lo, out_hi, radius, ring);
+        }
+        lo = out_lo;
+        hi = out_hi;
+    }
+}
+
+// Run a chain of filters on several threads, tile by tile
+// 複数のフィルターを順にかける関数（例: グレースケール → セピア → 左右反転 → ぼかし）
+// フィルターごとに画像全体を走査するのではなく、1つのタイル（行の帯）に全部のフィルターをかけてから次のタイルへ進む
+// タイルはL2キャッシュに収まる大きさなので、フィルターがいくつあっても、画像はメインメモリから1回読んで1回書くだけで済む
+// 1. 画像を行の帯に分ける。1つの帯はTILE_BYTESほど
+// 2. ぼかしがあれば、帯の境目の上下reach行（のりしろ。reachは全部のぼかしの半径の合計）を先に写しておく
+// 3. threads個のスレッドが、共有カウンターから帯の番号を取って1つずつ処理する
+// stages: かけるフィルターの配列（stages[0]から順にかける）、count: フィルターの数
+// threads: スレッドの数（0ならCPUの数）
+// 戻り値: 成功なら0、メモリを確保できないかフィルターが不正なら1（画像は一部だけ変わっていることがある）
+int run_pipeline(int height, int width, RGBTRIPLE image[height][width], const image_filter *stages, int count, int threads)
+{
+    int reach = pipeline_reach(stages, count, height);
+    if (reach < 0)
+    {
+        return 1;
+    }
+    if (height < 1 || width < 1 || count < 1)
+    {
+        return 0;
+    }
+    if (threads == 0)
+    {
+        // sysconf: 実行中のシステムの情報を調べる（ここでは使えるCPUの数）
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
 
-            // ステップ1: 一時変数に左側のピクセルを保存
-            // temp = 左側の値
-            RGBTRIPLE temp = image[i][j];
-            // ステップ2: 右側のピクセルを左側にコピー
-            // 左側　= 右側の値
-            // image[i][j] = 右側の値
-            image[i][j] = image[i][width - 1 - j];
+    // 1. 帯の高さを決める
+    // のりしろの行は隣の帯と重複して計算するので、帯を2×reach行以上にして無駄を抑える
+    // そうすると境目ののりしろ（2×reach行）の合計も画像の高さ以下に収まる
+    tile_job job;
+    job.height = height;
+    job.width = width;
+    job.image = &image[0][0];
+    job.stages = stages;
+    job.count = count;
+    job.reach = reach;
+    job.halo = NULL;
+    job.band_rows = (int) (TILE_BYTES / ((size_t) width * sizeof(RGBTRIPLE)));
+    if (job.band_rows < 1)
+    {
+        job.band_rows = 1;
+    }
+    if (job.band_rows < 2 * reach)
+    {
+        job.band_rows = 2 * reach;
+    }
+    job.band_count = (height + job.band_rows - 1) / job.band_rows;
+    atomic_init(&job.next_band, 0);
+    atomic_init(&job.failed, 0);
 
-            // ステップ3: 一時変数の値を右側にコピー
-            // 右側 = tempに保存した元の右側の値
-            image[i][width - 1 - j] = temp;
+    // 2. のりしろを写す
+    // 帯bとb-1の境目（y = b × band_rows行目）ごとに、y - reach行目からy + reach - 1行目までを写す
+    // どのスレッドも書き込む前に写すので、隣の帯が先に書き換えられても、元のピクセルから計算できる
+    if (reach > 0 && job.band_count > 1)
+    {
+        size_t halo_rows = (size_t) (job.band_count - 1) * 2 * reach;
+        job.halo = malloc(halo_rows * width * sizeof(RGBTRIPLE));
+        if (job.halo == NULL)
+        {
+            return 1;
+        }
+        for (int b = 1; b < job.band_count; b++)
+        {
+            int y = b * job.band_rows;
+            int rows = y + reach > height ? height - (y - reach) : 2 * reach;
+            memcpy(job.halo + (size_t) (b - 1) * 2 * reach * width, &image[y - reach][0], (size_t) rows * width * sizeof(RGBTRIPLE));
         }
     }
-    return;
+
+    // 3. スレッドを起動し、全スレッドの終了を待つ（帯の数より多くは起動しない）
+    // pthread_create(スレッドID, 属性, 実行する関数, 関数に渡す引数)
+    // pthread_join: 指定したスレッドが終わるまで待つ
+    if (threads > job.band_count)
+    {
+        threads = job.band_count;
+    }
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < threads; i++)
+    {
+        if (pthread_create(&workers[started], NULL, tile_worker, &job) != 0)
+        {
+            break;  // 起動できた分だけで処理を続ける
+        }
+        started++;
+    }
+    tile_worker(&job);  // このスレッドも1つの作業スレッドとして働く
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(job.halo);
+    return atomic_load(&job.failed);
 }
 
-// Blur image using box blur
-// 画像にぼかしをかける関数
-// ボックスブラー: 各ピクセルを周囲のピクセルとの平均値に置き換える
-void blur(int height, int width, RGBTRIPLE image[height][width])
+// Worker thread: run every stage on bands until none are left
+// 作業スレッドの本体
+// 共有カウンターから次の帯の番号を取り、その帯に全部のフィルターをかけることを繰り返す
+// 帯は重ならず、のりしろは写しから読むので、結果は1つずつ順に画像全体へかけた場合と同じになる
+void *tile_worker(void *arg)
 {
-    // Create a temporary copy of the image
-    // 画像のm一時的なコピーを作成する
-    // 重要: ぼかし計算中に元のピクセル値を参照し続けるため
-    // 元の配列を直接変更すると、後のピクセルの計算ですでに変更された値を使ってしまう。
-    RGBTRIPLE temp[height][width];
+    tile_job *job = arg;
+    int height = job->height;
+    int width = job->width;
+    int reach = job->reach;
+    RGBTRIPLE (*image)[width] = (RGBTRIPLE (*)[width]) job->image;
 
-    // 元の画像を一時配列にコピー
-    // 二重ループですべてのピクセルをコピー
-    for (int i = 0; i < height; i++)
+    // のりしろがあるときは、帯と上下reach行が入るタイルと、ぼかし用のリングを用意する（スレッドごとに専用）
+    RGBTRIPLE (*tile)[width] = NULL;
+    RGBTRIPLE (*ring)[width] = NULL;
+    if (reach > 0)
     {
-        for (int j = 0; J < width; j++)
+        int tile_rows = job->band_rows + 2 * reach;
+        tile = malloc((size_t) tile_rows * width * sizeof(RGBTRIPLE));
+        ring = malloc((size_t) pipeline_ring_rows(job->stages, job->count, tile_rows, width) * width * sizeof(RGBTRIPLE));
+        if (tile == NULL || ring == NULL)
         {
-            temp[i][j] = image[i][j]:// 構造体の値コピー
+            free(tile);
+            free(ring);
+            atomic_store(&job->failed, 1);
+            return NULL;
         }
     }
 
-    // Loop over all pixels
-    // すべてのピクセルに対してぼかし処理を実行
-    for (int i = 0; i < height; i++)
+    while (!atomic_load(&job->failed))
     {
-        for (int j = 0; j < width; j++)
+        // atomic_fetch_add: 値を1増やし、増やす前の値を返す
+        // 複数のスレッドが同時に呼んでも、同じ番号を2つのスレッドが受け取ることはない
+        int band = atomic_fetch_add(&job->next_band, 1);
+        if (band >= job->band_count)
         {
-           int sumRed = 0, sumGreen = 0, sumBlue = 0;
-           int count = 0;  // 有効なピクセル数をカウント
+            break;  // 全部の帯が処理済み（または処理中）
+        }
+        int top = band * job->band_rows;
+        int bottom = top + job->band_rows > height ? height : top + job->band_rows;
 
-            // Loop over neighboring pixels (3×3 grid)
-            // 周囲のピクセルを(3×3のグリッド)をループする
-            // 現在のピクセルを中心とした3×3の範囲を処理
-            // k=-1,0,1: 上の行、現在の行、下の行
-            // l=-1,0,1: 左の列、現在の列、右の列
-            for (int k = -1; k <= 1; k++)
-            {
-                for (int l = -1; l <= 1; l++)
-                {
-                    // 隣接ピクセルの座標を計算
-                    int new_i = i + k; //　新しい行座標
-                    int new_j = j + l; // 新しい列座標
-
-                    // check if the neighbor pixel is within the image boundaries
-                    // 隣のピクセルが画像の範囲内にあるかチェックする
-                    // 境界チェック：0以上かつ、画像サイズであること
-                    // 画像の端のピクセルでは、存在しない隣接ピクセルは無視する
-                    if (new_i >= 0 && new_i < height && new_j <= 0 && new_j < width)
-                    {
-                        // Add the color values from the temporary copy
-                        // 一時コピーから色の値を追加する
-                        // 元の画像データ (temp) から値を取得することができます
-                        sumRed += temp[new_i][new_j].rgbtRed;
-                        sumGreen += temp[new_i][new_j].rgbtGreen;
-                        sumBlue += temp[new_i][new_j].rgbtBlue;
-                        count++;  // 有効ピクセル数を増加
-                    }
-                }
-            }
+        // のりしろがいらなければ、帯を小さな画像とみなして、画像の上でそのままフィルターをかける
+        if (reach == 0)
+        {
+            filter_tile(height, width, image + top, top, bottom, job->stages, job->count, NULL);
+            continue;
+        }
+
+        // タイルを組み立てる: 上ののりしろ（境目bの写しの前半）、帯自身の行、下ののりしろ（境目b+1の写しの後半）
+        // tile[k - first]が画像のk行目。帯自身の行はこのスレッドしか書き換えないので、画像から直接写せる
+        int first = top - reach < 0 ? 0 : top - reach;
+        int last = bottom + reach > height ? height : bottom + reach;
+        if (top > first)
+        {
+            memcpy(tile[0], job->halo + (size_t) (band - 1) * 2 * reach * width, (size_t) reach * width * sizeof(RGBTRIPLE));
+        }
+        memcpy(tile[top - first], image[top], (size_t) (bottom - top) * width * sizeof(RGBTRIPLE));
+        if (last > bottom)
+        {
+            memcpy(tile[bottom - first], job->halo + ((size_t) band * 2 + 1) * reach * width, (size_t) (last - bottom) * width * sizeof(RGBTRIPLE));
+        }
+
+        // フィルターを順にかけ、正しく求まった帯の行だけを画像に戻す
+        filter_tile(height, width, tile, first, last, job->stages, job->count, ring);
+        memcpy(image[top], tile[top - first], (size_t) (bottom - top) * width * sizeof(RGBTRIPLE));
+    }
+
+    free(tile);
+    free(ring);
+    return NULL;
+}
+
+// Filter a BMP file row by row without loading the whole image
+// BMPファイルを、画像全体をメモリに読み込まずに、行の帯ごとに読み込み・フィルター・書き込みする関数
+// メモリに置くのは「帯 + 上下のりしろ」の行だけなので、メモリに入りきらない大きな画像でも処理できる
+// 1. ヘッダーを読んで確かめ、そのまま出力に書く
+// 2. 帯ごとに、まだ読んでいない行だけを窓（window）に読み足す（のりしろの行は前の帯と共有し、読み直さない）
+// 3. 窓をタイルに写して全部のフィルターをかけ（filter_tile）、帯の行だけを書き出す
+// 行はファイルに並んでいる順番（BMPは通常下の行から）のまま処理する。CS50のfilter.cも同じ順番で画像を渡すので、
+// 上下で結果が変わるフィルター（FILTER_CONVOLVEのEMBOSS等）も、filter.cでかけた場合と同じ結果になる
+// 入出力はファイルの先頭から順に読み書きするだけなので、パイプでもよい
+// 戻り値: 成功なら0、対応していない形式・フィルターが不正・読み書きやメモリの確保に失敗したら1
+int stream_bmp(FILE *input, FILE *output, const image_filter *stages, int count)
+{
+    // 1. ヘッダー（ファイルヘッダーと情報ヘッダー）を読む
+    // 24ビット・非圧縮のBMP 4.0だけに対応する（CS50のfilterプログラムと同じ条件）
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    if (fread(&bf, sizeof(BITMAPFILEHEADER), 1, input) != 1 || fread(&bi, sizeof(BITMAPINFOHEADER), 1, input) != 1)
+    {
+        return 1;
+    }
+    if (bf.bfType != 0x4d42 || bf.bfOffBits != 54 || bi.biSize != 40 || bi.biBitCount != 24 || bi.biCompression != 0)
+    {
+        return 1;
+    }
 
-            // Calculate the average color and update the original image
-            // 平均色を計算し、元の画像を更新する
-            // 合計値を有効ピクセル数で割って平均を求める
-            // (float)キャスト： 整数除算ではなく浮動小数点除算を行うため
-            // round()関数を使用して整数に変換
-            image[i][j].rgbtRed = round((float)sumRed / count);
-            image[i][j].rgbtGreen = round((float)sumGreen / count);
-            image[i][j].rgbtBlue = round((float)sumBlue / count);
+    // 高さが負のBMPは上の行から並んでいる（行の順番は気にしないので、高さは絶対値を使う）
+    // 1行のバイト数は4の倍数になるように、行の終わりに0のバイト（詰め物）が入っている
+    long long rows = bi.biHeight < 0 ? -(long long) bi.biHeight : bi.biHeight;
+    if (bi.biWidth < 1 || bi.biWidth > INT_MAX / (int) sizeof(RGBTRIPLE) || rows < 1 || rows > INT_MAX)
+    {
+        return 1;
+    }
+    int width = bi.biWidth;
+    int height = (int) rows;
+    int padding = (4 - (width * sizeof(RGBTRIPLE)) % 4) % 4;
+    int reach = pipeline_reach(stages, count, height);
+    if (reach < 0)
+    {
+        return 1;
+    }
+    if (fwrite(&bf, sizeof(BITMAPFILEHEADER), 1, output) != 1 || fwrite(&bi, sizeof(BITMAPINFOHEADER), 1, output) != 1)
+    {
+        return 1;
+    }
+
+    // 2. 窓・タイル・リングを確保する（帯の高さの決め方はrun_pipelineと同じ）
+    // のりしろがなければ、窓の上で直接フィルターをかける（タイルは作らない）
+    int band_rows = (int) (TILE_BYTES / ((size_t) width * sizeof(RGBTRIPLE)));
+    if (band_rows < 1)
+    {
+        band_rows = 1;
+    }
+    if (band_rows < 2 * reach)
+    {
+        band_rows = 2 * reach;
+    }
+    int tile_rows = band_rows + 2 * reach;
+    RGBTRIPLE (*window)[width] = malloc((size_t) tile_rows * width * sizeof(RGBTRIPLE));
+    RGBTRIPLE (*tile)[width] = window;
+    RGBTRIPLE (*ring)[width] = NULL;
+    if (reach > 0)
+    {
+        tile = malloc((size_t) tile_rows * width * sizeof(RGBTRIPLE));
+        ring = malloc((size_t) pipeline_ring_rows(stages, count, tile_rows, width) * width * sizeof(RGBTRIPLE));
+    }
+    int status = window == NULL || tile == NULL || (reach > 0 && ring == NULL);
+
+    // 3. 帯ごとに読み込み・フィルター・書き込みをする
+    // window[k - loaded_first]: 画像のk行目（loaded_first行目からloaded_last - 1行目までが入っている）
+    int loaded_first = 0;
+    int loaded_last = 0;
+    for (int top = 0; top < height && status == 0; top += band_rows)
+    {
+        int bottom = top + band_rows > height ? height : top + band_rows;
+        int first = top - reach < 0 ? 0 : top - reach;
+        int last = bottom + reach > height ? height : bottom + reach;
+
+        // もう使わない行を捨て、前の帯と共有する行（のりしろ）を窓の先頭へ詰める
+        // memmove: 写す元と写す先が重なっていても正しく写せるmemcpy
+        memmove(window[0], window[first - loaded_first], (size_t) (loaded_last - first) * width * sizeof(RGBTRIPLE));
+        loaded_first = first;
+        for (; loaded_last < last && status == 0; loaded_last++)
+        {
+            status = read_bmp_row(input, window[loaded_last - loaded_first], width, padding);
+        }
+        if (status != 0)
+        {
+            break;
+        }
+
+        if (tile != window)
+        {
+            memcpy(tile[0], window[0], (size_t) (last - first) * width * sizeof(RGBTRIPLE));
+        }
+        filter_tile(height, width, tile, first, last, stages, count, ring);
+        for (int i = top; i < bottom && status == 0; i++)
+        {
+            status = write_bmp_row(output, tile[i - first], width, padding);
         }
     }
-return;
-    
+
+    if (tile != window)
+    {
+        free(tile);
+    }
+    free(window);
+    free(ring);
+    return status;
+}
+
+// Read one row of a BMP file
+// BMPファイルから1行（widthピクセル）を読み、行の終わりの詰め物を読み飛ばす関数
+// fseekではなく読んで捨てるので、パイプからでも読める
+// 戻り値: 成功なら0、ファイルが途中で終わっていたら1
+int read_bmp_row(FILE *input, RGBTRIPLE *row, int width, int padding)
+{
+    uint8_t skip[3];
+    if (fread(row, sizeof(RGBTRIPLE), width, input) != (size_t) width)
+    {
+        return 1;
+    }
+    if (padding > 0 && fread(skip, 1, padding, input) != (size_t) padding)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+// Write one row of a BMP file
+// BMPファイルに1行（widthピクセル）を書き、行の終わりに詰め物（0のバイト）を書く関数
+// 戻り値: 成功なら0、書き込みに失敗したら1
+int write_bmp_row(FILE *output, const RGBTRIPLE *row, int width, int padding)
+{
+    static const uint8_t zeros[3] = {0, 0, 0};
+    if (fwrite(row, sizeof(RGBTRIPLE), width, output) != (size_t) width)
+    {
+        return 1;
+    }
+    if (padding > 0 && fwrite(zeros, 1, padding, output) != (size_t) padding)
+    {
+        return 1;
+    }
+    return 0;
 }
 
 /*
@@ -291,10 +2996,164 @@ return;
 
     ぼかし処理の仕組み：
     1. 画像にぼかし効果を適用する処理
-    2. 各ピクセルを周囲3×3の平均値で置換
-    3. 元画像のコピーを作成してから処理
+    2. 各ピクセルを周囲(2×radius+1)×(2×radius+1)の平均値で置換 (blurは半径1なので3×3)
+    3. 元画像の全体はコピーせず、書き換えた行の元の値だけをradius + 1行のリングに写しておく
+       - 作業用のメモリは幅 × 半径に比例し、画像の高さに関係しない
+       - 列ごとの合計もヒープに置くので、幅が広い画像でもスタックがあふれない
     4. 画像端では存在するピクセルのみで平均計算
-    5. ぼかし効果を得るために、周囲のピクセルの平均値を計算
+    5. 列ごとの縦の合計と、それを横に足した合計を、窓を1つずらすたびに「入る分を足し、出る分を引く」で更新
+       - 半径がいくつでも1ピクセルあたりの計算量は同じ
+       - 範囲内を毎回すべて足す方法では(2×radius+1)²回 (半径15なら961回) の足し算が必要
+    6. 平均の四捨五入は整数だけで行う: (2×合計 + 個数) / (2×個数)
+
+    積分画像（summed-area table）の仕組み:
+
+    1. 表の(i, j)に、画像の左上から(i-1, j-1)までの長方形の合計を記録する（build_summed_area）
+       各行の左端からの合計を、1行上の表の値に足していくので、表は1回の走査で作れる
+    2. 任意の長方形の合計は、表の4つの値の足し引きで求まる（region_sum）
+       合計 = S[下+1][右+1] - S[上][右+1] - S[下+1][左] + S[上][左]
+    3. 長方形の大きさに関係なく一定の時間なので、同じ画像に対して
+       - いろいろな半径のボックスブラー（box_blur_table）
+       - ピクセルごとに半径が違うぼかし（variable_blur）
+       - 顔や文字などの領域の平均の色（region_mean）
+       を何回求めても、表を作る1回の走査だけで済む
+    4. 合計は色成分ごとに32ビットで、2^32で割った余りとして記録する
+       - 画像全体の合計は2^32を超えることがある（255 × 2400万ピクセル ≈ 61億）
+       - 余りどうしの引き算の結果も余りなので、長方形の合計が2^32未満なら正しい値になる
+       - 1685万ピクセルを超える長方形は上下に分けて求め、64ビットで足す
+       - 64ビットの表より使うメモリが半分で済む（1ピクセルあたり12バイト）
+    5. 1回だけぼかすならbox_blurのほうがメモリを使わない（表は画像の4倍の大きさ）
+
+    面分け画像（planar_image）の仕組み:
+
+    1. RGBTRIPLEの配列は「青・緑・赤」の3バイトが交互に並ぶ（配列の構造体、AoS）
+       - 1ピクセルが3バイトなので、16バイトのベクトル命令で読むと色の区切りがずれる
+       - そのままではコンパイラもベクトル命令を使いにくい
+    2. 面分け画像は色ごとに別の配列（面）に分ける（構造体の配列、SoA）
+       - 各面は同じ色のバイトが連続し、各行の先頭は64バイト境界に揃っている
+       - 16ピクセル分の同じ色を1回のロードで読めるので、どのフィルターもベクトル命令で処理できる
+    3. 変換（planar_load / planar_store）はSSSE3の_mm_shuffle_epi8で16ピクセル（48バイト）ずつ行う
+       - 3つのレジスターから各色のバイトを表（SPLIT_MASKS, MERGE_MASKS）の位置で集め、ORでまとめる
+    4. 面分け画像用のフィルター（planar_grayscale, planar_sepia, planar_reflect, planar_blur）は
+       RGBTRIPLE版（grayscale, sepia, reflect, box_blur）とすべて同じ結果になる
+       - 複数のフィルターを続けてかけるときは、最初に1回変換し、最後に1回戻す
+    5. フィルターを最初に使うときにCPUに合ったSSSE3/AVX2版が選ばれる（select_image_kernelで選び直せる）
+    6. グレースケールとセピアはSSE2/AVX2の整数カーネル、ぼかしの縦の合計はコンパイラの自動ベクトル化に任せる
+       gccでは-O3、clangでは-O2から有効（例: clang -O3 -o filter filter.c grayscale.c -lm）
+
+    使い方の例:
+        planar_image p;
+        if (planar_load(height, width, image, &p) == 0)
+        {
+            planar_sepia(&p);
+            planar_blur(&p, 5);
+            planar_store(&p, height, width, image);
+            planar_free(&p);
+        }
+
+    整数カーネル（gray_planes, sepia_planes）の仕組み:
+
+    1. grayscale, sepiaは各行をROW_CHUNKピクセルずつ面に分け（filter_row）、面ごとのカーネルで計算して戻す
+    2. グレースケール: round((R + G + B) / 3.0) = (R + G + B + 1) / 3
+       - 3で割る代わりに21846（2^16 / 3 を切り上げ）を掛けて上位16ビットを取る（割り算はベクトル命令にない）
+    3. セピア: 係数（.393等）を1000倍した整数で、t = 393R + 769G + 189B を誤差なく求める
+       - 結果は (t + 500) / 1000。1000で割るのは「8で割る → 33555を掛けて上位16ビット → 64で割る」で行う
+       - 255を超えた値は、8ビットに詰める命令（_mm_packus_epi16）が自動的に255にする（飽和）
+       - ちょうど○.5になる場合だけは、doubleの計算で丸める向きが決まっていないので、以前と同じdoubleで計算する
+         （そのようなピクセルを含む16ピクセルはスカラー版で計算し直す。全体の数%）
+    4. どのカーネル（スカラー, SSE2, AVX2）も、以前のround()を使った計算とすべてのピクセルで同じ結果になる
+    5. 2進数の固定小数点（係数×256や×65536）では、○.5付近の丸めを以前と同じにできないため使っていない
+
+    タイル実行（run_filter, run_pipeline）の仕組み:
+
+    1. 画像をband_rows行ずつの帯（タイル）に分ける。1つの帯はTILE_BYTES（256KB）ほどで、L2キャッシュに収まる
+       - 画像は行ごとに連続してメモリに並ぶので、行の帯に分けると各スレッドは連続した領域だけを読み書きする
+    2. 作業スレッドは共有カウンター（atomic_fetch_add）から帯の番号を取り、終わったら次の帯を取る
+       - 帯の数はスレッドの数よりずっと多いので、処理の重さに偏りがあっても全スレッドが最後まで働く
+       - 呼び出したスレッドも作業スレッドの1つとして働く（threads = 1ならスレッドを作らない）
+    3. run_pipelineは1つの帯に全部のフィルターをかけてから次の帯へ進む（フィルターの融合）
+       - 1つずつ画像全体にかけると、4つのフィルターで画像がメインメモリを4往復する
+       - 帯ごとにまとめると、帯がキャッシュにある間に全部のフィルターが済み、メインメモリの読み書きは1往復になる
+    4. grayscale, sepia, reflectは行ごとに独立しているので、帯をそのまま小さな画像として関数に渡す
+    5. ぼかしは上下radius行（のりしろ、halo）のピクセルも読むが、そこは隣の帯で、別のスレッドが書き換えている最中かもしれない
+       - そこで、スレッドを起動する前に、帯の境目ごとに上下reach行（reach = ぼかしの半径の合計）を写しておく
+       - 各スレッドは「上ののりしろの写し + 帯自身の行 + 下ののりしろの写し」をタイルに組み立て、タイルの上でぼかす
+       - ぼかしの前のフィルターはのりしろの行にもかけ、ぼかすたびに正しい行の範囲が上下radius行ずつ狭くなる
+       - のりしろの行は隣の帯と重複して計算するが、帯を2×reach行以上にしているので重複は多くても全体と同じ量
+    6. どのフィルターの組み合わせも、スレッドの数に関係なく、1つずつ順に画像全体へかけた場合とすべてのピクセルで同じ結果になる
+    7. コンパイル時に-pthreadが必要
+
+    BMPのストリーム処理（stream_bmp）の仕組み:
+
+    1. 画像全体（image[height][width]）をメモリに置かず、行の帯ごとに読み込み・フィルター・書き込みをする
+       - メモリに置くのは「帯 + 上下のりしろ」の行の窓と、同じ大きさのタイル、ぼかし用のリングだけ
+       - 帯の大きさはrun_pipelineと同じ（TILE_BYTESほど）なので、ギガピクセルの画像でも使うメモリは数MB
+    2. 窓はずらしながら使う（スライディングウィンドウ）
+       - 次の帯に必要なのりしろの行は窓の先頭へ詰めて残し、まだ読んでいない行だけを読み足す
+       - どの行もファイルから1回だけ読み、1回だけ書く
+    3. フィルターのかけ方はrun_pipelineと同じ関数（filter_tile）を使うので、結果も同じになる
+    4. BMPの1行のバイト数は4の倍数で、足りない分は行の終わりに0のバイト（詰め物）が入る
+       - 詰め物のバイト数 = (4 - 幅 × 3 % 4) % 4。読むときは読み飛ばし、書くときは0を書く
+    5. 行の順番（下から・上から）はファイルの順のまま扱う（CS50のfilterプログラムと同じ）
+
+    反転・回転の仕組み:
+
+    1. 左右反転（reflect）: 行の両端のピクセルを入れ替える
+       - SSSE3版（reflect_row_ssse3）は両端から16ピクセル（48バイト）ずつ読み、_mm_shuffle_epi8で並びを逆にして入れ替える
+       - 1ピクセル3バイトなので、出力の各レジスターは3つの入力レジスターから集めたバイトのORで作る（REFLECT_MASKS）
+       - 1ピクセルずつ入れ替えるのに比べ、メモリのコピー（memcpy）に近い速さになる
+    2. 上下反転（flip_vertical）: 行の並びの中身は変わらないので、行を丸ごとmemcpyで入れ替える
+    3. 90度回転（rotate_image）: 行列の転置と同じく、読み込みと書き込みのどちらかが必ず飛び飛びのアドレスになる
+       - 32 × 32ピクセルのブロックごとに処理し、ブロックの読み書きをL1キャッシュの中で済ませる（キャッシュブロッキング）
+       - 回転後は幅と高さが入れ替わるので、その場では回転せず、別の配列に書く
+
+    輪郭の検出（edges）の仕組み:
+
+    1. Sobelフィルター: 周囲3×3に横方向（Gx）と縦方向（Gy）の重みを掛け、色成分ごとに round(√(Gx² + Gy²)) を求める（255で制限）
+    2. 重みの分解: Gxは「縦に1 2 1でならす × 横の差」、Gyは「縦の差 × 横に1 2 1でならす」に分けられる
+       - 各行の横の差と横にならした値を1回だけ求め、3行分をリングに置いて上下の行と組み合わせる
+       - 求めた値を保存してから行を書き換えるので、画像のコピーなしでその場で処理できる
+       - バイトの並びのまま計算するので、行の中のループは条件分岐がなくベクトル命令にできる
+    3. 平方根の表: Gx² + Gy² ≥ 65280 ならどれも255になるので、0〜65280の表（64KB）を1回だけ作って引く
+       - ピクセルごとにsqrtを呼ばない。表はpthread_onceで作るので、複数のスレッドから使っても安全
+    4. タイル実行: 上下1行ずつを使うので、run_pipelineやstream_bmpの中ではぼかしの半径1と同じように扱う（FILTER_EDGES）
+
+    畳み込み（convolve）の仕組み:
+
+    1. カーネル（conv_kernel）: K × Kの重みの表。整数の重み（合計をdivisorで割る）か小数の重みを使える
+       - よく使うものはSHARPEN_KERNEL, EMBOSS_KERNEL, GAUSSIAN5_KERNELとして用意してある
+       - 画像の端では、端のピクセルを外側に伸ばしたものとみなす
+    2. 端の処理を内側のループから追い出す: 元の行を、左右にK / 2ピクセル伸ばしてリングに写しておく
+       - 内側のループは画像の外を読まないので、重みごとの範囲の確認（if）がいらない
+    3. 大きさごとの専用のループ: DEFINE_CONV_ROWマクロで、3 × 3, 5 × 5, 7 × 7専用の関数と、どの大きさでも使える関数を作る
+       - 大きさが定数なら、コンパイラが重みのループを展開し、ピクセルのループをベクトル命令にできる
+    4. カーネルの形に合わせた計算（plan_convolutionが調べる）
+       - 対称: 同じ重みのピクセルを先に足してから掛ける（7 × 7なら49回の掛け算が16回に）
+       - 分離可能: 縦の重みと横の重みの2回の1次元の畳み込みにする（7 × 7なら49回が14回に）
+       - 整数の重みは、どの計算でも結果が同じ（誤差がない）
+    5. 割り算: floatの逆数を掛けて商の見当をつけ、余りで直す（div命令を使わず、ベクトル命令にできる）
+    6. タイル実行: FILTER_CONVOLVEとしてrun_pipelineやstream_bmpでも使える（のりしろはK / 2行）
+
+    ガウシアンぼかし（gaussian_blur）の仕組み:
+
+    1. ボックスブラーを3回続けてかけると、重みは山の形になり、ガウシアン（正規分布）にほぼ等しくなる（中心極限定理）
+    2. 幅wのボックスの分散は (w² - 1) / 12。3回分の分散の合計がsigma²に一番近くなるように、奇数の幅を2種類組み合わせる
+    3. ボックスブラーは窓をずらしながら合計を更新するので、sigmaが2でも20でも1ピクセルあたりの計算量は同じ
+       - 本物のガウシアンの畳み込みは (6 × sigma)² 回ほどの掛け算がいるので、sigmaが大きいほど差が大きい
+    4. 3回のぼかしはFILTER_BLURの3段としてrun_pipelineに渡し、タイルごとに複数のスレッドで続けてかける
+       - gaussian_stagesで3段を取り出せば、ほかのフィルターと一緒に1つの並びにできる
+
+    表を引く色の変換（color_transform）の仕組み:
+
+    1. 色ごとの変換（ガンマ補正、レベル補正、トーンカーブ）は、256個の表を引くだけで済む
+       - 変換を重ねるときは、表を表で引き直して1つの表にする（curve[c][v] = 新しい表[c][curve[c][v]]）
+    2. 色を混ぜる変換（セピアなど）は、入力の色ごとに「係数 × 値」の表（部分積の表）を作る
+       - 出力の1色は、表を3回引いて2回足し、四捨五入するだけ（掛け算がいらない）
+       - 前にある色ごとの表は部分積の表に、後にある色ごとの表は最後の表に入れるので、何段重ねても計算は1回分
+       - 表の値はCOLOR_SCALE（3000）倍の整数なので、セピアとグレースケールはsepia, grayscaleとまったく同じ結果になる
+    3. 色を混ぜる変換を2回重ねるのは、1回目の出力が3色とも同じ（グレースケール）ときだけ（それ以外は1を返す）
+    4. FILTER_COLORとしてrun_pipelineやstream_bmpでも使える
+    5. 1回だけのセピアやグレースケールは、SSE2/AVX2版のカーネル（sepia, grayscale）のほうが表を引くより速い
 
     学習ポイント
     1. 画像処理の基本的なアルゴリズム
@@ -1,14 +1,383 @@
 // Modifies the volume of an audio file
 // 音声ファイルの音量を変更するプログラム
 
-#include <stdint.h>  // 固定幅整数型（uint8_t, int16_t等）を使用するため
-#include <stdio.h>   // ファイル操作（fopen, fread, fwrite等）を使用するため
-#include <stdlib.h>  // atof関数（文字列を浮動小数点数に変換）を使用するため
+// mmap, ftruncate等のPOSIX関数を -std=c11 でも使えるようにするための宣言
+// 必ずすべての#includeより前に書く必要がある
+#define _POSIX_C_SOURCE 200809L
 
-// Number of bytes in .wav header
-// WAVファイルのヘッダーサイズは44バイト固定
-// ヘッダーには音声データの情報（サンプリングレート、チャンネル数、ビット深度等）が含まれる
-const int HEADER_SIZE = 44;
+#include <dirent.h>    // opendir, readdir関数（ディレクトリ内のファイル一覧）を使用するため
+#include <errno.h>     // errno（strtoullが範囲外を知らせる）を使用するため
+#include <fcntl.h>     // open関数（ファイル記述子でファイルを開く）を使用するため
+#include <math.h>      // pow, log10, sqrt関数（デシベルの計算）を使用するため
+#include <pthread.h>   // pthread_create等（複数のスレッドで並列に処理する）を使用するため
+#include <stdatomic.h> // atomic_fetch_add等（スレッド間で安全にカウンターを共有する）を使用するため
+#include <stdint.h>    // 固定幅整数型（uint8_t, int16_t等）を使用するため
+#include <stdio.h>     // ファイル操作（fopen, fread, fwrite等）を使用するため
+#include <stdlib.h>    // atof関数（文字列を浮動小数点数に変換）を使用するため
+#include <string.h>    // strcmp関数（オプション文字列の比較）を使用するため
+#include <sys/mman.h>  // mmap関数（ファイルをメモリに割り当てる）を使用するため
+#include <sys/stat.h>  // fstat関数（ファイルサイズの取得）を使用するため
+#include <time.h>      // clock_gettime関数（--statsの時間の計測）を使用するため
+#include <unistd.h>    // ftruncate, close, pread, pwrite関数を使用するため
+
+// x86のCPUではSSE2/AVX2のベクトル命令（SIMD）を使ったカーネルを用意する
+// immintrin.h: _mm_mul_ps等のベクトル命令を関数の形で呼び出すためのヘッダー
+// それ以外のCPUではスカラー（1サンプルずつの）カーネルだけを使う
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Largest header accepted before the data chunk
+// dataチャンクより前に置けるヘッダー（fmt, LIST, fact等のチャンク）の最大バイト数
+// 壊れたファイルで巨大なメモリを確保しないための上限
+#define MAX_HEADER_SIZE (16 * 1024 * 1024)
+
+// Data size written by encoders that do not know the length in advance
+// パイプに書き出すエンコーダーなど、長さが分からないときにdataチャンクに書かれるサイズ
+// この値のときはファイルの終わりまでをサンプルとして扱う
+#define WAV_SIZE_UNKNOWN 0xFFFFFFFFu
+
+// Number of samples processed per block (default)
+// 1回のfread/fwriteでまとめて処理するサンプル数の既定値
+// 65536サンプル = 128KiB。1サンプルずつ処理する場合と比べてライブラリ呼び出しが1/65536になる
+const size_t DEFAULT_BLOCK_SAMPLES = 65536;
+
+// Largest block size accepted by --block-size
+// --block-sizeで指定できるサンプル数の最大（2^24サンプル = 16ビットで32MiB）
+// これ以下なら、サンプル数 × 1サンプルのバイト数（最大8）がsize_tであふれない
+const size_t MAX_BLOCK_SAMPLES = 16777216;
+
+// Alignment of the sample buffer in bytes
+// サンプルバッファの先頭アドレスとサイズをこのバイト数の倍数に揃える
+// 64バイト = 一般的なキャッシュラインのサイズ（ベクトル命令のロードにも都合がよい）
+const size_t BLOCK_ALIGNMENT = 64;
+
+// Largest number of worker threads
+// --threadsで指定できるスレッド数の上限
+#define MAX_THREADS 256
+
+// Number of buffers in the stdin/stdout pipeline
+// 標準入出力モードで使うバッファの数（3つでトリプルバッファ）
+// 読み込み・計算・書き込みの3つが、それぞれ別のバッファを同時に使える
+#define RING_SLOTS 3
+
+// State of a pipeline buffer
+// パイプラインのバッファの状態。EMPTY → FILLED → SCALED → EMPTY の順に巡回する
+#define SLOT_EMPTY 0    // 空き（読み込みスレッドが使える）
+#define SLOT_FILLED 1   // 読み込み済み（計算待ち）
+#define SLOT_SCALED 2   // 計算済み（書き込み待ち）
+
+// Longest line or path accepted in batch mode
+// バッチモードで扱えるマニフェストの1行・ファイルパスの最大文字数
+#define MAX_PATH_LENGTH 4096
+
+// Range of a 16-bit sample
+// 16ビットサンプルが取り得る範囲。倍率を掛けた結果はこの範囲に収める（飽和させる）
+#define SAMPLE_MAX 32767.0f
+#define SAMPLE_MIN -32768.0f
+
+// Largest number of breakpoints in a gain envelope
+// --envelopeで指定できる折れ点（時刻と倍率の組）の最大数
+#define MAX_BREAKPOINTS 64
+
+// Longest run of frames interpolated from one starting gain
+// 包絡線の倍率は「開始時の倍率 + 1フレームあたりの増分 × フレーム番号」で求める
+// フレーム番号をfloatで誤差なく表せるよう、区間をこのフレーム数ごとに区切って開始時の倍率を求め直す
+#define ENVELOPE_PIECE_FRAMES 65536
+
+// Largest shift of the fixed-point gain
+// 固定小数点の倍率は q_mul / 2^q_shift で表す（q_mulは16ビット整数）
+// q_shift = 15 のとき Q15形式（-1.0〜1.0未満を1/32768刻みで表せる）
+#define MAX_Q_SHIFT 15
+
+// Result of parse_wav_header
+// parse_wav_header関数の戻り値
+#define WAV_OK 0            // dataチャンクまで解析できた
+#define WAV_INVALID 1       // WAVファイルではない、または壊れている
+#define WAV_UNSUPPORTED 2   // WAVファイルだが対応していないサンプル形式
+#define WAV_NEED_MORE 3     // 続きのバイトが必要（*neededバイトまで読んでから再度呼ぶ）
+
+// ===== 構造体定義 =====
+// envelope: 時間とともに変わる倍率（折れ線）
+// 折れ点の間は直線で補間し、最初の折れ点より前と最後の折れ点より後ろはその倍率のままにする
+typedef struct
+{
+    int count;                        // 折れ点の数
+    double times[MAX_BREAKPOINTS];    // 折れ点の時刻（秒。小さい順）
+    float gains[MAX_BREAKPOINTS];     // 折れ点での倍率
+} envelope;
+
+// gain: サンプルに掛ける倍率と、その処理方法
+typedef struct
+{
+    float factor;     // 倍率（浮動小数点）
+    int fixed;        // 1なら固定小数点（整数演算）で処理する
+    int16_t q_mul;    // 固定小数点の倍率の分子（factor ≈ q_mul / 2^q_shift）
+    int q_shift;      // 固定小数点の倍率の分母の指数
+    const envelope *env;  // NULLでなければ、factorにさらに包絡線の倍率を掛ける（固定小数点は使わない）
+    int16_t clip_low;     // 16ビットのサンプルのうち、倍率を掛けてもクリッピングしない範囲（--statsで使う）
+    int16_t clip_high;    // clip_low > clip_high なら全サンプルがクリッピングする
+} gain;
+
+// sample_format: 1サンプルの形式
+typedef enum
+{
+    FORMAT_U8,    // 8ビット符号なし整数（無音が128）
+    FORMAT_S16,   // 16ビット符号付き整数
+    FORMAT_S24,   // 24ビット符号付き整数（3バイトに詰めて格納）
+    FORMAT_S32,   // 32ビット符号付き整数
+    FORMAT_F32    // 32ビット浮動小数点数（-1.0〜1.0）
+} sample_format;
+
+// wav_info: fmtチャンクとdataチャンクから読み取った情報
+typedef struct
+{
+    sample_format format;     // サンプルの形式
+    int channels;             // チャンネル数（1=モノラル, 2=ステレオ）
+    uint32_t sample_rate;     // サンプリングレート（1秒あたりのフレーム数）
+    int bytes_per_sample;     // 1サンプルのバイト数
+    int block_align;          // 1フレーム（全チャンネル分のサンプル）のバイト数
+    size_t data_offset;       // ファイル先頭からdataチャンクの中身までのバイト数（= ヘッダーのサイズ）
+    uint32_t data_size;       // dataチャンクの中身のバイト数（WAV_SIZE_UNKNOWNなら不明）
+} wav_info;
+
+// format_kernel: 1つのサンプル形式専用の、倍率を掛ける関数
+// count個のサンプルをsrcから読み、dstに書く（dstとsrcは同じ場所でもよい）
+typedef void (*format_kernel)(uint8_t *dst, const uint8_t *src, size_t count, const gain *g);
+
+// format_ramp: 1つのサンプル形式専用の、フレームごとに直線的に変わる倍率を掛ける関数
+// サンプルiの倍率は start + step × (frame + i / channels)。dstとsrcはフレームの先頭から始まる
+typedef void (*format_ramp)(uint8_t *dst, const uint8_t *src, size_t count, int channels, float start, float step, uint32_t frame);
+
+// format_mixer: 1つのサンプル形式専用の、ミックス用の2つの関数
+// accumulate: count個のサンプルに倍率を掛けてaccに足す
+// store:      accの合計を範囲内に収めて（飽和させて）dstに書く
+// clipped:    storeで飽和させることになるサンプルの数を返す
+// accの型は形式ごとに決まる（16ビットはfloat、それ以外はdouble。どちらもサンプルより広い）
+typedef struct
+{
+    void (*accumulate)(void *acc, const uint8_t *src, size_t count, float gain);
+    void (*store)(uint8_t *dst, const void *acc, size_t count);
+    uint64_t (*clipped)(const void *acc, size_t count);  // storeで飽和するサンプルを数える（--stats用）
+} format_mixer;
+
+// run_stats: --statsで表示する計測結果
+// 時間は秒。複数のスレッドで処理した場合は、全スレッドの合計になる
+typedef struct
+{
+    double header;        // ヘッダーの読み込みと解析
+    double read;          // サンプルの読み込み
+    double compute;       // 倍率の計算
+    double write;         // 書き込み
+    uint64_t samples;     // 処理したサンプル数
+    uint64_t bytes;       // 処理したサンプル部分のバイト数
+    uint64_t clipped;     // 範囲外になり、最大値・最小値に飽和させたサンプル数
+    int clip_unknown;     // 1ならクリッピングを数えていない（包絡線を使った場合）
+} run_stats;
+
+// mix_input: ミックスモードの入力1つ分
+typedef struct
+{
+    FILE *file;           // 入力ファイル
+    wav_info info;        // ヘッダーから読み取った形式
+    float gain;           // この入力に掛ける倍率
+    uint64_t remaining;   // dataチャンクの残りのバイト数
+} mix_input;
+
+// level_stats: 解析パスで集計するサンプルの大きさ（単位は各形式のサンプル値そのもの）
+typedef struct
+{
+    double peak;          // 絶対値の最大
+    double sum_squares;   // 2乗の合計（RMS = sqrt(sum_squares / count)）
+    uint64_t count;       // 集計したサンプル数
+} level_stats;
+
+// format_analyzer: 1つのサンプル形式専用の、count個のサンプルをstatsに集計する関数
+typedef void (*format_analyzer)(const uint8_t *src, size_t count, level_stats *stats);
+
+// normalize_target: --normalize-toで指定された目標の大きさ
+typedef struct
+{
+    double target_db;         // 目標のレベル（dBFS。0がフルスケール、-1.0なら少し下）
+    int by_rms;               // 1ならRMS、0ならピークを目標に合わせる
+    const char *fixed_mode;   // 求めた倍率に固定小数点を使うかどうか
+} normalize_target;
+
+// parallel_job: 複数のスレッドで分担するサンプル部分の情報
+// サンプル部分をchunk_bytesずつの区間に分け、各スレッドが次の区間を1つずつ取って処理する
+typedef struct
+{
+    int in_fd;                  // 入力ファイルの記述子
+    int out_fd;                 // 出力ファイルの記述子
+    format_kernel kernel;       // サンプル形式に合った関数
+    const gain *g;              // 倍率
+    const wav_info *info;       // サンプルの形式（包絡線の時刻の計算に使う）
+    int bytes_per_sample;       // 1サンプルのバイト数
+    size_t start;               // サンプル部分の開始位置（ファイル先頭からのバイト数）
+    size_t total_bytes;         // サンプル部分のバイト数
+    size_t chunk_bytes;         // 1つの区間のバイト数（フレームの大きさの倍数）
+    size_t chunk_count;         // 区間の数
+    atomic_size_t next_chunk;   // 次に処理する区間の番号（全スレッドで共有）
+    atomic_int failed;          // 読み書きに失敗したら1
+} parallel_job;
+
+// ring_slot: パイプラインのバッファ1つ分
+typedef struct
+{
+    uint8_t *data;      // バッファ本体
+    size_t size;        // 有効なバイト数
+    size_t samples;     // 倍率を掛けるサンプル数（dataチャンクより後ろのバイトなら0）
+    int last;           // 1なら入力の終わりを表す目印（dataは空）
+    int state;          // SLOT_EMPTY, SLOT_FILLED, SLOT_SCALEDのいずれか
+} ring_slot;
+
+// pipe_ring: 読み込みスレッド・計算（メインスレッド）・書き込みスレッドで共有するリングバッファ
+typedef struct
+{
+    ring_slot slots[RING_SLOTS];
+    pthread_mutex_t lock;       // slotsのstateを操作するときにかける鍵
+    pthread_cond_t changed;     // どれかのstateが変わったことを知らせる条件変数
+    FILE *input;
+    FILE *output;
+    wav_info info;
+    size_t block_bytes;         // 1つのバッファに読み込むバイト数
+    atomic_int read_failed;     // 読み込みエラーがあれば1
+    atomic_int write_failed;    // 書き込みエラーがあれば1（読み込みスレッドも読むので、鍵の外で共有できるatomic_intにする）
+    run_stats stats;            // 計測結果（read・compute・writeはそれぞれ担当のスレッドだけが足す）
+} pipe_ring;
+
+// batch_entry: バッチモードで処理する1ファイル分の指定（入力, 出力, 倍率）
+typedef struct
+{
+    char *input;
+    char *output;
+    float factor;
+} batch_entry;
+
+// work_deque: 作業スレッド1つが持つ「仕事の列」（両端から取り出せる列）
+// 持ち主は末尾（tail側）から取り出し、仕事がなくなったスレッドは他のスレッドの先頭（head側）から盗む
+// 持ち主と盗む側が列の反対の端を使うので、同じ仕事を取り合うことが少ない
+typedef struct
+{
+    pthread_mutex_t lock;   // この列を操作するときにかける鍵
+    size_t *items;          // batch_entryの番号
+    size_t head;            // 先頭（次に盗まれる位置）
+    size_t tail;            // 末尾の次（items[tail - 1]が持ち主が次に取る仕事）
+} work_deque;
+
+// batch_pool: バッチモードの全スレッドで共有する情報
+typedef struct
+{
+    batch_entry *entries;       // 全ファイルの指定
+    work_deque *deques;         // スレッドごとの仕事の列
+    int workers;                // スレッドの数
+    const char *fixed_mode;     // 固定小数点を使うかどうか
+    size_t block_samples;       // 1ブロックのサンプル数（1ファイルあたりのメモリ使用量を決める）
+    const normalize_target *normalize;  // NULLでなければ、ファイルごとに倍率を求めて正規化する
+    const envelope *env;        // NULLでなければ、全ファイルに同じ包絡線を掛ける
+    atomic_int failures;        // 失敗したファイルの数
+} batch_pool;
+
+// batch_worker_arg: 各スレッドに渡す引数（共有情報と自分の番号）
+typedef struct
+{
+    batch_pool *pool;
+    int id;
+} batch_worker_arg;
+
+// ===== 関数プロトタイプ宣言 =====
+void scale_samples_scalar(int16_t *dst, const int16_t *src, size_t count, float factor);    // 基準となるスカラー版
+#ifdef HAVE_X86_SIMD
+void scale_samples_sse2(int16_t *dst, const int16_t *src, size_t count, float factor);      // SSE2版（8サンプルずつ）
+TARGET_AVX2 void scale_samples_avx2(int16_t *dst, const int16_t *src, size_t count, float factor);  // AVX2版（16サンプルずつ）
+#endif
+void scale_fixed_scalar(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift);   // 固定小数点のスカラー版
+#ifdef HAVE_X86_SIMD
+void scale_fixed_sse2(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift);     // 固定小数点のSSE2版
+TARGET_AVX2 void scale_fixed_avx2(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift);  // 固定小数点のAVX2版
+#endif
+void measure_samples_scalar(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares);  // ピークと2乗和を集計する
+#ifdef HAVE_X86_SIMD
+void measure_samples_sse2(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares);      // 集計のSSE2版
+TARGET_AVX2 void measure_samples_avx2(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares);  // 集計のAVX2版
+#endif
+void scale_ramp_scalar(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame);  // 変化する倍率を掛ける
+#ifdef HAVE_X86_SIMD
+void scale_ramp_sse2(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame);    // 変化する倍率のSSE2版
+TARGET_AVX2 void scale_ramp_avx2(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame);  // 変化する倍率のAVX2版
+#endif
+void mix_accumulate_scalar(float *acc, const int16_t *src, size_t count, float gain);       // 倍率を掛けて足し込む
+void mix_store_scalar(int16_t *dst, const float *acc, size_t count);                        // 合計を飽和させて書く
+#ifdef HAVE_X86_SIMD
+void mix_accumulate_sse2(float *acc, const int16_t *src, size_t count, float gain);         // 足し込みのSSE2版
+void mix_store_sse2(int16_t *dst, const float *acc, size_t count);                          // 書き出しのSSE2版
+TARGET_AVX2 void mix_accumulate_avx2(float *acc, const int16_t *src, size_t count, float gain);  // 足し込みのAVX2版
+TARGET_AVX2 void mix_store_avx2(int16_t *dst, const float *acc, size_t count);                   // 書き出しのAVX2版
+#endif
+size_t count_outside_scalar(const int16_t *src, size_t count, int16_t low, int16_t high);  // 範囲外のサンプルを数える
+#ifdef HAVE_X86_SIMD
+size_t count_outside_sse2(const int16_t *src, size_t count, int16_t low, int16_t high);    // 数えるSSE2版
+TARGET_AVX2 size_t count_outside_avx2(const int16_t *src, size_t count, int16_t low, int16_t high);  // 数えるAVX2版
+#endif
+int select_kernel(const char *name);                                                        // 使うカーネルを選ぶ
+int make_gain(gain *g, float factor, const char *fixed_mode);                               // 倍率から処理方法を決める
+int fit_fixed_point(gain *g, const char *fixed_mode);                                       // 固定小数点で表せるか調べる
+void find_clip_range(gain *g);                                                              // クリッピングしない範囲を求める
+void apply_gain(int16_t *dst, const int16_t *src, size_t count, const gain *g);             // 倍率を掛ける
+int parse_wav_header(const uint8_t *bytes, size_t size, wav_info *info, size_t *needed);    // RIFFチャンクをたどる
+int read_wav_header(FILE *input, uint8_t **header, wav_info *info);                         // ヘッダーを読み込む
+format_kernel select_format_kernel(sample_format format);                                   // 形式に合う関数を選ぶ
+format_analyzer select_format_analyzer(sample_format format);                               // 形式に合う解析関数を選ぶ
+double format_full_scale(sample_format format);                                             // 形式のフルスケールの値
+format_ramp select_format_ramp(sample_format format);                                       // 形式に合う変化する倍率の関数を選ぶ
+format_mixer select_format_mixer(sample_format format);                                     // 形式に合うミックス用の関数を選ぶ
+uint64_t count_clipped(const uint8_t *src, size_t count, const gain *g, sample_format format);  // 飽和するサンプルを数える
+void tally_block(run_stats *s, const uint8_t *src, size_t count, const gain *g, const wav_info *info);  // ブロックを計測結果に数える
+double now_seconds(void);                                                                   // 現在の時刻（秒）
+void merge_stats(const run_stats *part);                                                    // 計測結果を全体に足す
+void print_stats(const run_stats *s, double elapsed);                                       // 計測結果を表示する
+int parse_envelope(const char *spec, envelope *env);                                        // 折れ点の指定を読む
+size_t parse_block_size(const char *text);                                                  // --block-sizeの値を読む
+size_t frame_block_bytes(size_t block_samples, const wav_info *info);                       // 1ブロックのバイト数（フレーム単位）
+void scale_block(format_kernel kernel, uint8_t *dst, const uint8_t *src, size_t count, const gain *g, const wav_info *info, uint64_t position);  // ブロックに倍率を掛ける
+float normalize_factor(const level_stats *stats, double full_scale, const normalize_target *target, double *peak_db, double *rms_db);  // 目標に合う倍率を求める
+int process_stream(FILE *input, FILE *output, const gain *g, size_t block_samples);          // ブロック単位で読み書きする
+int process_mapped(const char *input_path, const char *output_path, const gain *g, const normalize_target *normalize);  // mmapで処理する
+int pread_full(int fd, uint8_t *buffer, size_t size, size_t offset);                       // 指定位置から全部読む
+int pwrite_full(int fd, const uint8_t *buffer, size_t size, size_t offset);                // 指定位置へ全部書く
+void *gain_worker(void *arg);                                                               // 作業スレッドの本体
+int process_parallel(const char *input_path, const char *output_path, const gain *g, size_t block_samples, int threads);  // 複数スレッドで処理する
+int process_file(const char *input_path, const char *output_path, const gain *g, size_t block_samples);  // 1ファイルを処理する
+int process_mix(const char *output_path, int count, char *inputs[], size_t block_samples);  // 複数の入力をミックスする
+ring_slot *wait_slot(pipe_ring *ring, size_t index, int state);                            // バッファが指定の状態になるまで待つ
+void post_slot(pipe_ring *ring, ring_slot *slot, int state);                                // バッファを次の状態にする
+void *pipe_reader(void *arg);                                                               // 読み込みスレッド
+void *pipe_writer(void *arg);                                                               // 書き込みスレッド
+int process_pipe(FILE *input, FILE *output, const gain *g, size_t block_samples);           // 標準入出力で処理する
+int load_manifest(const char *path, batch_entry **entries, size_t *count);                 // マニフェストを読み込む
+int load_directory(const char *input_dir, const char *output_dir, float factor, batch_entry **entries, size_t *count);  // ディレクトリから作る
+int add_batch_entry(batch_entry **list, size_t *size, size_t *capacity, const char *input, const char *output, float factor);  // 一覧に1つ加える
+void free_batch(batch_entry *list, size_t size);                                           // 一覧を解放する
+void *batch_worker(void *arg);                                                              // バッチの作業スレッド
+int process_batch(batch_entry *entries, size_t count, int threads, const char *fixed_mode, size_t block_samples, const normalize_target *normalize, const envelope *env);  // 多数のファイルを処理する
+
+// ===== グローバル変数の定義 =====
+// 実際にサンプルを処理するカーネル（関数ポインタ）
+// 起動時にselect_kernel()がCPUに合わせてSSE2/AVX2版に差し替える
+void (*scale_samples)(int16_t *dst, const int16_t *src, size_t count, float factor) = scale_samples_scalar;
+void (*scale_fixed)(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift) = scale_fixed_scalar;
+void (*measure_samples)(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares) = measure_samples_scalar;
+void (*scale_ramp)(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame) = scale_ramp_scalar;
+void (*mix_accumulate)(float *acc, const int16_t *src, size_t count, float gain) = mix_accumulate_scalar;
+void (*mix_store)(int16_t *dst, const float *acc, size_t count) = mix_store_scalar;
+size_t (*count_outside)(const int16_t *src, size_t count, int16_t low, int16_t high) = count_outside_scalar;
+
+// --statsの計測結果の合計（--statsを付けなければNULL）
+// 複数のスレッドから足し込むので、stats_lockで守る
+run_stats *total_stats = NULL;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int main(int argc, char *argv[])
 {
@@ -16,126 +385,3372 @@ int main(int argc, char *argv[])
     // コマンドライン引数をチェック
     // argc: 引数の個数（プログラム名も含む）
     // argv: 引数の配列（argv[0]=プログラム名, argv[1]=入力ファイル名, argv[2]=出力ファイル名, argv[3]=倍率）
-    if (argc != 4)
+    // 先頭に次のオプションを付けられる
+    // "--block-size N": 1ブロックあたりのサンプル数を変更する
+    // "--mmap":         入力と出力をmmapでメモリに割り当てて処理する
+    // "--in-place":     入力ファイルをmmapし、その場で書き換える（出力ファイル名は指定しない）
+    // "--kernel NAME":  使うカーネルを指定する（auto, scalar, sse2, avx2。既定はauto）
+    // "--fixed MODE":   固定小数点で処理するか（auto, on, off。既定はauto）
+    // "--threads N":    N個のスレッドで並列に処理する（0ならCPUの数。既定は1）
+    // "--batch FILE":   マニフェスト（1行に「入力 出力 倍率」）に書かれた全ファイルを処理する
+    // "--batch-dir":    引数を「入力ディレクトリ 出力ディレクトリ 倍率」と読み、中の全.wavを処理する
+    // "--normalize-to DB": 倍率の代わりに目標のピーク（dBFS）を指定する。倍率の引数は書かない
+    // "--rms":          --normalize-toの目標をピークではなくRMSにする
+    // "--envelope SPEC": 「秒:倍率」をカンマで並べた折れ線を、倍率にさらに掛ける（例: 0:0,2:1,58:1,60:0）
+    // "--stats":        段階ごとの時間（ヘッダー, 読み込み, 計算, 書き込み）と処理速度、クリッピング数を表示する
+    // "--mix":          引数を「出力 入力1 倍率1 入力2 倍率2 ...」と読み、全入力を足し合わせて1つに書き出す
+    // 入力ファイル名・出力ファイル名に "-" を指定すると、標準入力・標準出力を使う
+    size_t block_samples = DEFAULT_BLOCK_SAMPLES;
+    int use_mmap = 0;   // 1ならmmapで処理する
+    int in_place = 0;   // 1なら入力ファイルを直接書き換える
+    const char *kernel = "auto";  // 使うカーネルの名前
+    const char *fixed_mode = "auto";  // 固定小数点を使うかどうか
+    long threads = 1;   // 作業スレッドの数
+    const char *manifest = NULL;  // バッチモードのマニフェストのパス
+    int batch_dir = 0;  // 1ならディレクトリ内の全ファイルを処理する
+    int normalize = 0;  // 1なら解析して求めた倍率で正規化する
+    normalize_target target = {0.0, 0, NULL};
+    static envelope env;  // 大きいのでスタックではなく静的領域に置く
+    int use_envelope = 0;   // 1なら包絡線を掛ける
+    int mix = 0;        // 1なら複数の入力をミックスする
+    int show_stats = 0; // 1なら計測結果を表示する
+    int arg = 1;        // 次に調べる引数の位置
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+    {
+        if (strcmp(argv[arg], "--block-size") == 0 && arg + 1 < argc)
+        {
+            // 不正な値・大きすぎる値なら0になる（parse_block_sizeを参照）
+            block_samples = parse_block_size(argv[arg + 1]);
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--kernel") == 0 && arg + 1 < argc)
+        {
+            kernel = argv[arg + 1];
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--fixed") == 0 && arg + 1 < argc)
+        {
+            fixed_mode = argv[arg + 1];
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc)
+        {
+            threads = strtol(argv[arg + 1], NULL, 10);
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc)
+        {
+            manifest = argv[arg + 1];
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--batch-dir") == 0)
+        {
+            batch_dir = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--normalize-to") == 0 && arg + 1 < argc)
+        {
+            // 2回の走査（解析と倍率の適用）で同じデータを使えるよう、mmapで処理する
+            normalize = 1;
+            use_mmap = 1;
+            target.target_db = atof(argv[arg + 1]);
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--envelope") == 0 && arg + 1 < argc)
+        {
+            if (parse_envelope(argv[arg + 1], &env) != 0)
+            {
+                fprintf(stderr, "Invalid envelope: %s\n", argv[arg + 1]);
+                return 1;
+            }
+            use_envelope = 1;
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "--stats") == 0)
+        {
+            show_stats = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--mix") == 0)
+        {
+            mix = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--rms") == 0)
+        {
+            target.by_rms = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--mmap") == 0)
+        {
+            use_mmap = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--in-place") == 0)
+        {
+            use_mmap = 1;
+            in_place = 1;
+            arg++;
+        }
+        else
+        {
+            block_samples = 0;  // 未知のオプションは使い方の表示に回す
+            break;
+        }
+    }
+
+    // その場で書き換える場合は「ファイル名 倍率」の2つ、マニフェストを使う場合は0、
+    // それ以外は「入力 出力 倍率」（--batch-dirではディレクトリ）の3つ
+    // 正規化する場合は倍率を解析で求めるので、最後の倍率を書かない
+    int positional = in_place ? 2 : manifest != NULL ? 0 : 3;
+    if (normalize && positional > 0)
     {
-        printf("Usage: ./volume input.wav output.wav factor\n");
+        positional--;
+    }
+    if (mix)
+    {
+        // ミックスは「出力」と「入力 倍率」の組が1つ以上なので、3以上の奇数
+        positional = argc - arg >= 3 && (argc - arg) % 2 == 1 ? argc - arg : -1;
+    }
+    if (threads == 0)
+    {
+        // sysconf: 実行中のシステムの情報を調べる（ここでは使えるCPUの数）
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (argc - arg != positional || block_samples == 0 || threads < 1 || threads > MAX_THREADS)
+    {
+        fprintf(stderr, "Usage: ./volume [--block-size samples] [--kernel name] [--fixed mode] [--threads n] [--mmap] [--envelope t:g,...] [--stats] input.wav output.wav factor\n");
+        fprintf(stderr, "       ./volume [--block-size samples] - - factor   (stdin to stdout)\n");
+        fprintf(stderr, "       ./volume --in-place file.wav factor\n");
+        fprintf(stderr, "       ./volume [--threads n] --batch manifest.txt\n");
+        fprintf(stderr, "       ./volume [--threads n] --batch-dir input_dir output_dir factor\n");
+        fprintf(stderr, "       ./volume --normalize-to dBFS [--rms] [--in-place] input.wav [output.wav]\n");
+        fprintf(stderr, "       ./volume [--block-size samples] --mix output.wav input1.wav gain1 [input2.wav gain2 ...]\n");
         return 1;  // エラー終了
     }
 
-    // Open files and determine scaling factor
-    // ファイルを開き、音量変更の倍率を決定
+    // ミックスは入力ごとの一定の倍率で足し合わせるだけなので、包絡線・正規化・その場での書き換え・
+    // バッチ処理とは組み合わせられない（黙って無視すると、指定と違う出力ができてしまう）
+    if (mix && (use_envelope || normalize || in_place || manifest != NULL || batch_dir))
+    {
+        fprintf(stderr, "--mix cannot be combined with --envelope, --normalize-to, --in-place or --batch.\n");
+        return 1;
+    }
+
+    // CPUがサポートしている命令セットに合わせてカーネルを選ぶ
+    if (select_kernel(kernel) != 0)
+    {
+        fprintf(stderr, "Unknown or unsupported kernel: %s\n", kernel);
+        return 1;
+    }
+
+    // 音量変更の倍率を文字列から浮動小数点数に変換
+    // atof: ASCII to Float（文字列を浮動小数点数に変換する関数）
+    // 例："2.0"なら factor = 2.0（音量2倍）
+    //     "0.5"なら factor = 0.5（音量半分）
+    // 倍率は常に最後の引数（マニフェストを使う場合は各行に書く。正規化する場合は書かない）
+    float factor = positional > 0 && !normalize ? atof(argv[argc - 1]) : 1.0f;
+
+    // 倍率が固定小数点で十分正確に表せるなら、整数演算のカーネルを使う
+    gain g;
+    if (make_gain(&g, factor, fixed_mode) != 0)
+    {
+        fprintf(stderr, "Invalid --fixed mode: %s\n", fixed_mode);
+        return 1;
+    }
+    g.env = use_envelope ? &env : NULL;
+
+    // 正規化はファイル全体を2回走査するので、先頭から1回しか読めない標準入出力では使えない
+    target.fixed_mode = fixed_mode;
+    for (int i = arg; normalize && i < argc; i++)
+    {
+        if (strcmp(argv[i], "-") == 0)
+        {
+            fprintf(stderr, "--normalize-to needs regular files, not \"-\".\n");
+            return 1;
+        }
+    }
+
+    // "-"（標準入出力）はmmapや位置指定の読み書きができない
+    int use_pipe = positional == 3 && !batch_dir && !mix && (strcmp(argv[arg], "-") == 0 || strcmp(argv[arg + 1], "-") == 0);
+    if (use_pipe && (use_mmap || threads > 1))
+    {
+        fprintf(stderr, "--mmap and --threads need regular files, not \"-\".\n");
+        return 1;
+    }
+
+    // --stats: 各処理関数が自分の計測結果をtotal_statsに足し込み、最後にまとめて表示する
+    static run_stats totals;
+    if (show_stats)
+    {
+        total_stats = &totals;
+    }
+    double started = now_seconds();
+    int status;
+
+    if (mix)
+    {
+        // ミックスモード: 全入力をブロックごとに足し合わせ、1回の走査で1つの出力にする
+        status = process_mix(argv[arg], argc - arg - 1, argv + arg + 1, block_samples);
+    }
+    else if (use_pipe)
+    {
+        // 標準入出力モード: パイプの途中に置けるよう、シークせずに先頭から順に読み書きする
+        // 読み込み・計算・書き込みを別々のスレッドで重ねて行う
+        FILE *input = strcmp(argv[arg], "-") == 0 ? stdin : fopen(argv[arg], "rb");
+        FILE *output = strcmp(argv[arg + 1], "-") == 0 ? stdout : fopen(argv[arg + 1], "wb");
+        status = 1;
+        if (input == NULL || output == NULL)
+        {
+            fprintf(stderr, "Could not open file.\n");
+        }
+        else
+        {
+            status = process_pipe(input, output, &g, block_samples);
+        }
+        if (input != NULL && input != stdin)
+        {
+            fclose(input);
+        }
+        if (output != NULL && fclose(output) != 0 && status == 0)
+        {
+            fprintf(stderr, "Could not write file.\n");
+            status = 1;
+        }
+    }
+    else if (manifest != NULL || batch_dir)
+    {
+        // バッチモード: 多数のファイルを1つのプロセスの中で、決まった数のスレッドで処理する
+        // ファイルごとにプロセスを起動する費用がかからない
+        batch_entry *entries;
+        size_t count;
+        int loaded = manifest != NULL ? load_manifest(manifest, &entries, &count)
+                                      : load_directory(argv[arg], argv[arg + 1], factor, &entries, &count);
+        if (loaded != 0)
+        {
+            return 1;
+        }
+        status = process_batch(entries, count, (int) threads, fixed_mode, block_samples, normalize ? &target : NULL, g.env);
+        free_batch(entries, count);
+    }
+    else if (use_mmap)
+    {
+        // mmapモード: ファイルをメモリに割り当て、カーネルとの間のコピーを省く
+        // ページキャッシュに載っているファイルでは、読み書きのコピーが丸ごと不要になる
+        status = process_mapped(argv[arg], in_place ? NULL : argv[arg + 1], &g, normalize ? &target : NULL);
+    }
+    else if (threads > 1)
+    {
+        // 並列モード: サンプル部分を区間に分け、複数のスレッドが位置指定の読み書き（pread/pwrite）で処理する
+        status = process_parallel(argv[arg], argv[arg + 1], &g, block_samples, (int) threads);
+    }
+    else
+    {
+        // 通常モード: ヘッダーのコピーとサンプルの処理をブロック単位で行う
+        status = process_file(argv[arg], argv[arg + 1], &g, block_samples);
+    }
+
+    if (total_stats != NULL)
+    {
+        print_stats(total_stats, now_seconds() - started);
+    }
+    return status;
+}
+
+// Open files and process them block by block
+// 入力ファイルと出力ファイルを開き、process_streamで処理して閉じる関数
+// 戻り値: 成功なら0、失敗なら1
+int process_file(const char *input_path, const char *output_path, const gain *g, size_t block_samples)
+{
+    // Open files
+    // ファイルを開く
 
     // 入力ファイルを読み取り専用で開く
-    // "r"モード: 読み取り専用でテキストファイルを開く
-    // WAVファイルはバイナリファイルなので本来は"rb"が適切だが、この例では"r"を使用
-    FILE *input = fopen(argv[1], "r");
+    // "rb"モード: 読み取り専用でバイナリファイルを開く
+    // WAVファイルはバイナリファイルなので"b"を付け、改行コードの変換が起きないようにする
+    FILE *input = fopen(input_path, "rb");
     if (input == NULL)
     {
-        printf("Could not open file.\n");
+        fprintf(stderr, "Could not open file.\n");
         return 1;  // ファイルが開けない場合はエラー終了
     }
 
     // 出力ファイルを書き込み専用で開く
-    // "w"モード: 書き込み専用でファイルを開く（既存ファイルがあれば上書き）
-    // 同様にバイナリファイルなので本来は"wb"が適切
-    FILE *output = fopen(argv[2], "w");
+    // "wb"モード: 書き込み専用でバイナリファイルを開く（既存ファイルがあれば上書き）
+    FILE *output = fopen(output_path, "wb");
     if (output == NULL)
     {
-        printf("Could not open file.\n");
+        fprintf(stderr, "Could not open file.\n");
+        fclose(input);
         return 1;  // ファイルが開けない場合はエラー終了
     }
 
-    // 音量変更の倍率を文字列から浮動小数点数に変換
-    // atof: ASCII to Float（文字列を浮動小数点数に変換する関数）
-    // 例：argv[3]が"2.0"なら factor = 2.0（音量2倍）
-    //     argv[3]が"0.5"なら factor = 0.5（音量半分）
-    float factor = atof(argv[3]);
+    // ヘッダーのコピーとサンプルの処理をブロック単位で行う
+    int status = process_stream(input, output, g, block_samples);
 
-    // --- ここからが実装部分 ---
+    // Close files
+    // 開いたファイルを必ず閉じる
+    // メモリリークを防ぎ、他のプログラムがファイルにアクセスできるようにする
+    // fcloseはバッファに残ったデータを書き出すので、ここでの失敗も書き込みエラー
+    fclose(input);   // 入力ファイルを閉じる
+    if (fclose(output) != 0 && status == 0)
+    {
+        fprintf(stderr, "Could not write file.\n");
+        status = 1;
+    }
+    return status;
+}
 
-    // TODO: Copy header from input file to output file
-    // 1. ヘッダーのコピー
-    // WAVファイルの最初の44バイトはヘッダー情報で、音声データではない
-    // このヘッダーには音声の形式情報が含まれているので、そのままコピーする必要がある
-    
-    // uint8_t: 8ビット符号なし整数（0〜255の値を取る）
-    // ヘッダーを格納するためのバイト配列を宣言
-    uint8_t header[HEADER_SIZE];
-    
-    // fread: ファイルからデータを読み込む関数
-    // fread(読み込み先のバッファ, 1要素のサイズ, 要素数, ファイルポインタ)
-    // ここでは: header配列に, HEADER_SIZEバイトを, 1回で, inputファイルから読み込む
-    fread(header, HEADER_SIZE, 1, input);
-    
-    // fwrite: ファイルにデータを書き込む関数
-    // fwrite(書き込み元のバッファ, 1要素のサイズ, 要素数, ファイルポインタ)
-    // 読み込んだヘッダーをそのまま出力ファイルに書き込む
-    fwrite(header, HEADER_SIZE, 1, output);
+// Mix several inputs into one output in a single pass
+// inputsの「入力 倍率」の組をcount / 2個読み、全入力を足し合わせてoutput_pathに書き出す関数
+// 全入力を同じブロック単位で並行して読み、ブロックごとに倍率を掛けて広い型（float/double）に足し込み、
+// 最後に1回だけ飽和させて書き出すので、途中のファイルを書き出したり読み直したりしない
+// 入力の形式（サンプル形式、チャンネル数、サンプリングレート）はすべて同じである必要がある
+// 出力の長さは最も長い入力に合わせ、短い入力は終わった後を無音として扱う
+// dataより後ろのチャンク（LIST等）は、ヘッダーを使う入力（最も長い入力）のものをコピーする
+// 戻り値: 成功なら0、失敗なら1
+int process_mix(const char *output_path, int count, char *inputs[], size_t block_samples)
+{
+    int input_count = count / 2;
+    mix_input *list = calloc(input_count, sizeof(mix_input));
+    if (list == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory.\n");
+        return 1;
+    }
 
-    // TODO: Read samples from input file and write updated data to output file
-    // 2. サンプルの読み込み、音量変更、書き込み
-    // ヘッダー以降は音声データ（サンプル）が続く
-    // WAVファイルでは通常、1つのサンプルは16ビット（2バイト）の符号付き整数
-    
-    // int16_t: 16ビット符号付き整数（-32,768〜32,767の値を取る）
-    // 1つのサンプル（音の瞬間的な振幅値）を格納する変数
-    int16_t sample;
-    
-    // whileループでファイルの終端まで1サンプルずつ処理
-    // fread(&sample, sizeof(int16_t), 1, input) の戻り値:
-    // - 成功時: 読み込んだ要素数（ここでは1）
-    // - ファイル終端や失敗時: 0
-    // 0以外（真）の間ループが継続される
-    while (fread(&sample, sizeof(int16_t), 1, input))
+    // 1. 全入力のヘッダーを読み、形式がそろっているか確かめる
+    // 出力のヘッダーには最も長い入力のもの（dataより前のチャンク）を使う
+    // source: ヘッダーを使う入力, tail: その入力のdataチャンクより後ろのチャンクのバイト数
+    run_stats stats = {0};
+    double mark = now_seconds();
+    uint8_t *header = NULL;
+    size_t header_size = 0;
+    uint64_t longest = 0;
+    int source = 0;
+    uint64_t tail = 0;
+    int status = 0;
+    for (int i = 0; i < input_count && status == 0; i++)
+    {
+        mix_input *in = &list[i];
+        in->gain = atof(inputs[2 * i + 1]);
+        in->file = fopen(inputs[2 * i], "rb");
+        uint8_t *bytes;
+        struct stat st;
+        if (in->file == NULL)
+        {
+            fprintf(stderr, "Could not open file.\n");
+            status = 1;
+        }
+        else if (read_wav_header(in->file, &bytes, &in->info) != 0)
+        {
+            status = 1;
+        }
+        else if (fstat(fileno(in->file), &st) != 0)
+        {
+            fprintf(stderr, "Could not read header.\n");
+            free(bytes);
+            status = 1;
+        }
+        else if (i > 0 && (in->info.format != list[0].info.format || in->info.channels != list[0].info.channels ||
+                           in->info.sample_rate != list[0].info.sample_rate))
+        {
+            fprintf(stderr, "%s: format differs from %s.\n", inputs[2 * i], inputs[0]);
+            free(bytes);
+            status = 1;
+        }
+        else
+        {
+            // dataチャンクに書かれたサイズと、実際にファイルに残っているバイト数の小さいほうを、
+            // サンプルの倍数に切り下げて使う（途中で切れた端数のバイトはミックスしない）
+            uint64_t data_bytes = (uint64_t) st.st_size - in->info.data_offset;
+            if (in->info.data_size != WAV_SIZE_UNKNOWN && in->info.data_size < data_bytes)
+            {
+                data_bytes = in->info.data_size;
+            }
+            in->remaining = data_bytes / in->info.bytes_per_sample * in->info.bytes_per_sample;
+
+            if (header == NULL || in->remaining > longest)
+            {
+                free(header);
+                header = bytes;
+                header_size = in->info.data_offset;
+                longest = in->remaining;
+                source = i;
+
+                // dataチャンクのサイズが正しく、詰め物の後ろにバイトが残っていれば、それが後続のチャンク
+                // サイズが不明・途中で切れている・サンプルの倍数でない場合は、チャンクの境目が分からないのでコピーしない
+                uint64_t data_end = in->info.data_offset + in->remaining + (in->remaining & 1);
+                tail = 0;
+                if (in->info.data_size != WAV_SIZE_UNKNOWN && in->info.data_size == in->remaining &&
+                    data_end < (uint64_t) st.st_size)
+                {
+                    tail = (uint64_t) st.st_size - data_end;
+                }
+            }
+            else
+            {
+                free(bytes);
+            }
+        }
+    }
+
+    // 2. 出力のヘッダーを書く
+    // サイズの欄（RIFFチャンク全体とdataチャンク）を、ミックス後の長さに書き換える
+    // RIFFチャンク全体には、後でコピーするdataより後ろのチャンクの分も含める
+    FILE *output = NULL;
+    if (status == 0)
+    {
+        output = fopen(output_path, "wb");
+        if (output == NULL)
+        {
+            fprintf(stderr, "Could not open file.\n");
+            status = 1;
+        }
+    }
+    if (status == 0)
+    {
+        uint64_t riff_size = header_size - 8 + longest + (longest & 1) + tail;
+        uint32_t data_size = longest < WAV_SIZE_UNKNOWN ? (uint32_t) longest : WAV_SIZE_UNKNOWN;
+        uint32_t riff_field = riff_size < WAV_SIZE_UNKNOWN ? (uint32_t) riff_size : WAV_SIZE_UNKNOWN;
+        for (int b = 0; b < 4; b++)
+        {
+            header[4 + b] = (uint8_t) (riff_field >> (8 * b));
+            header[header_size - 4 + b] = (uint8_t) (data_size >> (8 * b));
+        }
+        if (fwrite(header, 1, header_size, output) != header_size)
+        {
+            fprintf(stderr, "Could not write file.\n");
+            status = 1;
+        }
+    }
+    free(header);
+
+    // 3. バッファを用意する
+    // samples: 読み込み用（書き出し用にも使い回す）, acc: 合計用（1サンプルにつき最大8バイト）
+    const wav_info *info = &list[0].info;
+    size_t block_bytes = 0;
+    size_t block_count = 0;
+    uint8_t *samples = NULL;
+    void *acc = NULL;
+    if (status == 0)
+    {
+        block_bytes = frame_block_bytes(block_samples, info);
+        block_count = block_bytes / info->bytes_per_sample;
+        size_t samples_size = (block_bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+        size_t acc_size = (block_count * sizeof(double) + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+        samples = aligned_alloc(BLOCK_ALIGNMENT, samples_size);
+        acc = aligned_alloc(BLOCK_ALIGNMENT, acc_size);
+        if (samples == NULL || acc == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory.\n");
+            status = 1;
+        }
+    }
+
+    // 4. 全入力から同じ位置のブロックを読み、足し合わせて書き出す
+    // 合計を0にしてから、各入力のブロックに倍率を掛けて足し込む
+    // 入力が終わっていれば足さない（無音と同じ）。全入力が終われば終了
+    // --statsのサンプル数は出力のサンプル数で、飽和は足し合わせた後の合計で数える
+    format_mixer mixer = select_format_mixer(info->format);
+    double now = now_seconds();
+    stats.header += now - mark;
+    mark = now;
+    while (status == 0)
+    {
+        memset(acc, 0, block_count * sizeof(double));
+        size_t filled = 0;  // このブロックで最も多く読めたサンプル数
+        for (int i = 0; i < input_count; i++)
+        {
+            mix_input *in = &list[i];
+            size_t want = in->remaining < block_bytes ? (size_t) in->remaining : block_bytes;
+            if (want == 0)
+            {
+                continue;
+            }
+            if (fread(samples, 1, want, in->file) != want)
+            {
+                fprintf(stderr, "Could not read file.\n");
+                status = 1;
+                break;
+            }
+            now = now_seconds();
+            stats.read += now - mark;
+            mark = now;
+            in->remaining -= want;
+            size_t n = want / info->bytes_per_sample;
+            mixer.accumulate(acc, samples, n, in->gain);
+            filled = n > filled ? n : filled;
+            now = now_seconds();
+            stats.compute += now - mark;
+            mark = now;
+        }
+        if (status != 0 || filled == 0)
+        {
+            break;
+        }
+
+        // 合計を範囲内に収めて書き出す
+        stats.samples += filled;
+        stats.bytes += (uint64_t) filled * info->bytes_per_sample;
+        if (total_stats != NULL)
+        {
+            stats.clipped += mixer.clipped(acc, filled);
+        }
+        mixer.store(samples, acc, filled);
+        size_t size = filled * info->bytes_per_sample;
+        now = now_seconds();
+        stats.compute += now - mark;
+        mark = now;
+        if (fwrite(samples, 1, size, output) != size)
+        {
+            fprintf(stderr, "Could not write file.\n");
+            status = 1;
+        }
+        now = now_seconds();
+        stats.write += now - mark;
+        mark = now;
+    }
+
+    // dataチャンクが奇数バイトなら詰め物を1バイト書く
+    if (status == 0 && (longest & 1) && fputc(0, output) == EOF)
+    {
+        fprintf(stderr, "Could not write file.\n");
+        status = 1;
+    }
+
+    // ヘッダーを使った入力の、dataチャンクより後ろのチャンクをそのままコピーする
+    // その入力はdataチャンクの終わりまで読み終わっているので、詰め物の1バイトを読み飛ばしてから続きを読む
+    // 入力が1つなら、ここまでで --fixed off で同じ倍率を掛けた場合とバイト単位で同じ出力になる
+    if (status == 0 && tail > 0)
+    {
+        FILE *file = list[source].file;
+        if ((longest & 1) && fgetc(file) == EOF)
+        {
+            fprintf(stderr, "Could not read file.\n");
+            status = 1;
+        }
+        while (status == 0 && tail > 0)
+        {
+            size_t want = tail < block_bytes ? (size_t) tail : block_bytes;
+            if (fread(samples, 1, want, file) != want)
+            {
+                fprintf(stderr, "Could not read file.\n");
+                status = 1;
+            }
+            else if (fwrite(samples, 1, want, output) != want)
+            {
+                fprintf(stderr, "Could not write file.\n");
+                status = 1;
+            }
+            tail -= want;
+        }
+    }
+
+    // 5. 後片付け
+    free(samples);
+    free(acc);
+    for (int i = 0; i < input_count; i++)
+    {
+        if (list[i].file != NULL)
+        {
+            fclose(list[i].file);
+        }
+    }
+    free(list);
+    if (output != NULL && fclose(output) != 0 && status == 0)
+    {
+        fprintf(stderr, "Could not write file.\n");
+        status = 1;
+    }
+    stats.write += now_seconds() - mark;
+    merge_stats(&stats);
+    return status;
+}
+
+// Scale samples by factor (reference implementation)
+// count個のサンプルに倍率を掛けてdstに書き込む関数（基準となるスカラー版）
+// dstとsrcは同じ場所でもよい（その場で書き換える場合）
+// SSE2/AVX2版はこの関数とビット単位で同じ結果を出す
+void scale_samples_scalar(int16_t *dst, const int16_t *src, size_t count, float factor)
+{
+    for (size_t i = 0; i < count; i++)
     {
         // サンプルに係数を掛けて音量を変更
         // 音量の変更は単純に振幅値に倍率を掛けるだけ
         // factor = 2.0 なら音量2倍（振幅2倍）
         // factor = 0.5 なら音量半分（振幅半分）
         // factor = 0.0 なら無音
-        // 
-        // 注意: int16_tの範囲を超える場合はオーバーフローが発生する可能性がある
-        // 例：sample=20000, factor=2.0 の場合、40000となり正常
-        //     sample=30000, factor=2.0 の場合、60000となるが、int16_tの最大値32767を超える
-        sample = sample * factor;
+        // (float)でfloat同士の掛け算にする（ベクトル命令の_mm_mul_psと同じ計算）
+        float value = (float) src[i] * factor;
 
-        // 変更したサンプルを出力ファイルに書き込む
-        // sizeof(int16_t): int16_t型のサイズ（通常2バイト）
-        // &sample: sample変数のアドレス（ポインタ）
-        fwrite(&sample, sizeof(int16_t), 1, output);
+        // int16_tの範囲を超えた値は最大値・最小値に揃える（飽和、クリッピング）
+        // 例：sample=30000, factor=2.0 の場合、60000となるので32767にする
+        // 範囲外の値をそのままint16_tに変換すると、符号が反転したような大きな雑音になる
+        // 比較の書き方は_mm_min_ps/_mm_max_psと同じ（NaNは最大値側に寄る）
+        value = value < SAMPLE_MAX ? value : SAMPLE_MAX;
+        value = value > SAMPLE_MIN ? value : SAMPLE_MIN;
+
+        // 小数部分は切り捨てる（0方向への丸め。元のsample = sample * factorと同じ）
+        dst[i] = (int16_t) value;
     }
+}
 
-    // --- ここまでが実装部分 ---
+#ifdef HAVE_X86_SIMD
+// Scale samples with SSE2 (8 samples per iteration)
+// SSE2版: 128ビットのレジスタで8サンプルずつ処理する
+// x86-64のCPUは必ずSSE2を持っているので、CPUの判定なしで使える
+void scale_samples_sse2(int16_t *dst, const int16_t *src, size_t count, float factor)
+{
+    // 倍率・最大値・最小値を4つずつ並べたベクトル
+    __m128 vfactor = _mm_set1_ps(factor);
+    __m128 vmax = _mm_set1_ps(SAMPLE_MAX);
+    __m128 vmin = _mm_set1_ps(SAMPLE_MIN);
 
-    // Close files
-    // 開いたファイルを必ず閉じる
-    // メモリリークを防ぎ、他のプログラムがファイルにアクセスできるようにする
-    fclose(input);   // 入力ファイルを閉じる
-    fclose(output);  // 出力ファイルを閉じる
-    
-    // main関数の正常終了
-    // return 0; を省略した場合、C99以降では自動的に0が返される
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // 8サンプル（16バイト）を読み込む。loaduは整列していないアドレスでもよい
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+
+        // 16ビット→32ビットの符号拡張
+        // 同じ値を2つ並べてから右に16ビット算術シフトすると、上位に符号が入る
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+
+        // float に変換して倍率を掛け、範囲内に収める
+        __m128 flo = _mm_mul_ps(_mm_cvtepi32_ps(lo), vfactor);
+        __m128 fhi = _mm_mul_ps(_mm_cvtepi32_ps(hi), vfactor);
+        flo = _mm_max_ps(_mm_min_ps(flo, vmax), vmin);
+        fhi = _mm_max_ps(_mm_min_ps(fhi, vmax), vmin);
+
+        // cvtt: 0方向に切り捨てて32ビット整数に戻す
+        // packs: 32ビット→16ビットに詰める（範囲外は飽和するが、ここでは既に範囲内）
+        __m128i out = _mm_packs_epi32(_mm_cvttps_epi32(flo), _mm_cvttps_epi32(fhi));
+        _mm_storeu_si128((__m128i *) (dst + i), out);
+    }
+
+    // 8個に満たない残りはスカラー版で処理する
+    scale_samples_scalar(dst + i, src + i, count - i, factor);
 }
 
-/*
-このプログラムの動作の流れ:
-1. コマンドライン引数をチェック（入力ファイル、出力ファイル、倍率）
-2. 入力ファイルと出力ファイルを開く
-3. 倍率を数値に変換
-4. WAVファイルのヘッダー（44バイト）をそのままコピー
-5. 音声データを1サンプル（16ビット）ずつ読み込み
-6. 各サンプルに倍率を掛けて音量を変更
-7. 変更したサンプルを出力ファイルに書き込み
-8. ファイル終端まで5-7を繰り返し
-9. ファイルを閉じて終了
+// Scale samples with AVX2 (16 samples per iteration)
+// AVX2版: 256ビットのレジスタで16サンプルずつ処理する
+// TARGET_AVX2: この関数だけAVX2命令の使用をコンパイラに許可する（呼ぶ前にCPUの確認が必要）
+TARGET_AVX2 void scale_samples_avx2(int16_t *dst, const int16_t *src, size_t count, float factor)
+{
+    __m256 vfactor = _mm256_set1_ps(factor);
+    __m256 vmax = _mm256_set1_ps(SAMPLE_MAX);
+    __m256 vmin = _mm256_set1_ps(SAMPLE_MIN);
 
-使用例:
-./volume input.wav output.wav 2.0   // 音量を2倍にする
-./volume input.wav output.wav 0.5   // 音量を半分にする
-./volume input.wav output.wav 1.0   // 音量を変更しない（コピーのみ）
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        // 16サンプル（32バイト）を読み込み、前半8個と後半8個をそれぞれ32ビットに符号拡張
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+
+        __m256 flo = _mm256_mul_ps(_mm256_cvtepi32_ps(lo), vfactor);
+        __m256 fhi = _mm256_mul_ps(_mm256_cvtepi32_ps(hi), vfactor);
+        flo = _mm256_max_ps(_mm256_min_ps(flo, vmax), vmin);
+        fhi = _mm256_max_ps(_mm256_min_ps(fhi, vmax), vmin);
+
+        // AVX2のpacksは128ビットずつ別々に詰めるので、順番が [lo前半, hi前半, lo後半, hi後半] になる
+        // permute4x64で64ビット単位の並びを 0,2,1,3 に入れ替えて元の順番に戻す
+        __m256i out = _mm256_packs_epi32(_mm256_cvttps_epi32(flo), _mm256_cvttps_epi32(fhi));
+        out = _mm256_permute4x64_epi64(out, 0xD8);
+        _mm256_storeu_si256((__m256i *) (dst + i), out);
+    }
+
+    // 16個に満たない残りはSSE2版（さらに残りはスカラー版）で処理する
+    scale_samples_sse2(dst + i, src + i, count - i, factor);
+}
+#endif
+
+// Scale samples by a fixed-point gain (reference implementation)
+// 固定小数点の倍率 mul / 2^shift を掛ける関数（基準となるスカラー版）
+// floatへの変換をせず、整数の掛け算とシフトだけで計算するので、どのCPUでも結果が同じになる
+void scale_fixed_scalar(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift)
+{
+    // 負の数を0方向に切り捨てるため、シフトの前に足す値（2^shift - 1）
+    int32_t bias = ((int32_t) 1 << shift) - 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        // 16ビット×16ビットの積は最大でも2^30なので、32ビットに必ず収まる
+        int32_t product = (int32_t) src[i] * mul;
+
+        // 右シフトは負の数を-∞方向に切り捨てるので、負の数だけbiasを足して0方向にそろえる
+        // （浮動小数点版の(int16_t)への変換と同じ丸め方）
+        if (product < 0)
+        {
+            product += bias;
+        }
+        product >>= shift;
+
+        // int16_tの範囲に飽和させる
+        if (product > 32767)
+        {
+            product = 32767;
+        }
+        if (product < -32768)
+        {
+            product = -32768;
+        }
+        dst[i] = (int16_t) product;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Scale samples by a fixed-point gain with SSE2
+// 固定小数点のSSE2版: 8サンプルずつ処理する
+void scale_fixed_sse2(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift)
+{
+    __m128i vmul = _mm_set1_epi16(mul);
+    __m128i vbias = _mm_set1_epi32(((int32_t) 1 << shift) - 1);
+    __m128i vshift = _mm_cvtsi32_si128(shift);  // シフト量もベクトルで渡す
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+
+        // mullo: 積の下位16ビット, mulhi: 積の上位16ビット（multiply-high）
+        // 2つを交互に並べると、8つの32ビットの積ができる
+        __m128i plo = _mm_mullo_epi16(s, vmul);
+        __m128i phi = _mm_mulhi_epi16(s, vmul);
+        __m128i lo = _mm_unpacklo_epi16(plo, phi);
+        __m128i hi = _mm_unpackhi_epi16(plo, phi);
+
+        // 負の積だけbiasを足す（srai(x, 31)は負なら全ビット1、正なら0になる）
+        lo = _mm_add_epi32(lo, _mm_and_si128(_mm_srai_epi32(lo, 31), vbias));
+        hi = _mm_add_epi32(hi, _mm_and_si128(_mm_srai_epi32(hi, 31), vbias));
+        lo = _mm_sra_epi32(lo, vshift);
+        hi = _mm_sra_epi32(hi, vshift);
+
+        // packs: 32ビット→16ビットに飽和させながら詰める
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(lo, hi));
+    }
+
+    scale_fixed_scalar(dst + i, src + i, count - i, mul, shift);
+}
+
+// Scale samples by a fixed-point gain with AVX2
+// 固定小数点のAVX2版: 16サンプルずつ処理する
+// unpackとpacksはどちらも128ビットごとに働くので、並び替えなしで元の順番に戻る
+TARGET_AVX2 void scale_fixed_avx2(int16_t *dst, const int16_t *src, size_t count, int16_t mul, int shift)
+{
+    __m256i vmul = _mm256_set1_epi16(mul);
+    __m256i vbias = _mm256_set1_epi32(((int32_t) 1 << shift) - 1);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i plo = _mm256_mullo_epi16(s, vmul);
+        __m256i phi = _mm256_mulhi_epi16(s, vmul);
+        __m256i lo = _mm256_unpacklo_epi16(plo, phi);
+        __m256i hi = _mm256_unpackhi_epi16(plo, phi);
+        lo = _mm256_add_epi32(lo, _mm256_and_si256(_mm256_srai_epi32(lo, 31), vbias));
+        hi = _mm256_add_epi32(hi, _mm256_and_si256(_mm256_srai_epi32(hi, 31), vbias));
+        lo = _mm256_sra_epi32(lo, vshift);
+        hi = _mm256_sra_epi32(hi, vshift);
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_packs_epi32(lo, hi));
+    }
+
+    scale_fixed_sse2(dst + i, src + i, count - i, mul, shift);
+}
+#endif
+
+// Accumulate peak and sum of squares (reference implementation)
+// count個のサンプルの絶対値の最大と2乗の合計を求め、*peakと*sum_squaresに加える関数
+// 整数のまま計算するので、SSE2/AVX2版と結果が必ず同じになる
+void measure_samples_scalar(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares)
+{
+    int32_t max = *peak;
+    uint64_t sum = *sum_squares;
+    for (size_t i = 0; i < count; i++)
+    {
+        // -32768の絶対値は16ビットに収まらないので、32ビットで計算する
+        int32_t value = src[i];
+        int32_t magnitude = value < 0 ? -value : value;
+        max = magnitude > max ? magnitude : max;
+
+        // 2乗は最大でも2^30なので、32ビットに収まる
+        sum += (uint64_t) (value * value);
+    }
+    *peak = max;
+    *sum_squares = sum;
+}
+
+#ifdef HAVE_X86_SIMD
+// Accumulate peak and sum of squares with SSE2
+// 集計のSSE2版: 8サンプルずつ処理する
+// 最大値と最小値を別々に求め、最後に大きいほうの絶対値をピークにする
+void measure_samples_sse2(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares)
+{
+    __m128i vmax = _mm_setzero_si128();
+    __m128i vmin = _mm_setzero_si128();
+    __m128i vsum = _mm_setzero_si128();  // 64ビットの合計が2つ
+    __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        vmax = _mm_max_epi16(vmax, s);
+        vmin = _mm_min_epi16(vmin, s);
+
+        // madd: 隣り合う2つの積を足して32ビットにする（s*sなので2乗の和）
+        // 最大は(-32768)^2 × 2 = 2^31 で符号付きでは溢れるが、符号なしとして読めば正しい
+        // 上位に0を詰めて64ビットに広げてから足す
+        __m128i squares = _mm_madd_epi16(s, s);
+        vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(squares, zero));
+        vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(squares, zero));
+    }
+
+    // ベクトルの各要素をまとめる
+    int16_t maxes[8];
+    int16_t mins[8];
+    uint64_t sums[2];
+    _mm_storeu_si128((__m128i *) maxes, vmax);
+    _mm_storeu_si128((__m128i *) mins, vmin);
+    _mm_storeu_si128((__m128i *) sums, vsum);
+    int32_t max = *peak;
+    for (int k = 0; k < 8; k++)
+    {
+        max = maxes[k] > max ? maxes[k] : max;
+        max = -mins[k] > max ? -mins[k] : max;
+    }
+    *peak = max;
+    *sum_squares += sums[0] + sums[1];
+
+    measure_samples_scalar(src + i, count - i, peak, sum_squares);
+}
+
+// Accumulate peak and sum of squares with AVX2
+// 集計のAVX2版: 16サンプルずつ処理する
+TARGET_AVX2 void measure_samples_avx2(const int16_t *src, size_t count, int32_t *peak, uint64_t *sum_squares)
+{
+    __m256i vmax = _mm256_setzero_si256();
+    __m256i vmin = _mm256_setzero_si256();
+    __m256i vsum = _mm256_setzero_si256();
+    __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        vmax = _mm256_max_epi16(vmax, s);
+        vmin = _mm256_min_epi16(vmin, s);
+        __m256i squares = _mm256_madd_epi16(s, s);
+        vsum = _mm256_add_epi64(vsum, _mm256_unpacklo_epi32(squares, zero));
+        vsum = _mm256_add_epi64(vsum, _mm256_unpackhi_epi32(squares, zero));
+    }
+
+    int16_t maxes[16];
+    int16_t mins[16];
+    uint64_t sums[4];
+    _mm256_storeu_si256((__m256i *) maxes, vmax);
+    _mm256_storeu_si256((__m256i *) mins, vmin);
+    _mm256_storeu_si256((__m256i *) sums, vsum);
+    int32_t max = *peak;
+    for (int k = 0; k < 16; k++)
+    {
+        max = maxes[k] > max ? maxes[k] : max;
+        max = -mins[k] > max ? -mins[k] : max;
+    }
+    *peak = max;
+    *sum_squares += sums[0] + sums[1] + sums[2] + sums[3];
+
+    measure_samples_sse2(src + i, count - i, peak, sum_squares);
+}
+#endif
+
+// Scale samples by a linearly changing gain (reference implementation)
+// フレームごとに直線的に変わる倍率を掛ける関数（基準となるスカラー版）
+// サンプルiはフレーム frame + i / channels に属し、倍率は start + step × そのフレーム番号
+// 同じフレームのチャンネルには同じ倍率を掛ける。dstとsrcはフレームの先頭から始まること
+void scale_ramp_scalar(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        // 掛け算と足し算を別の文に分け、コンパイラが1つの命令（FMA）にまとめないようにする
+        // （まとめると丸め方が変わり、SIMD版とビット単位で一致しなくなる）
+        float gain = step * (float) (frame + (uint32_t) (i / channels));
+        gain = start + gain;
+
+        // 以降はscale_samples_scalarと同じ（範囲内に収めて0方向に切り捨てる）
+        float value = (float) src[i] * gain;
+        value = value < SAMPLE_MAX ? value : SAMPLE_MAX;
+        value = value > SAMPLE_MIN ? value : SAMPLE_MIN;
+        dst[i] = (int16_t) value;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Scale samples by a linearly changing gain with SSE2
+// 変化する倍率のSSE2版: 8サンプルずつ処理する
+// ベクトルの各要素が何番目のフレームに属するかはチャンネル数で決まる
+// 8 × channels サンプル（= 8フレーム）ごとに同じ並びが繰り返すので、
+// その1周期分の「要素ごとのフレーム番号」を表にしておき、周期ごとに8フレームずつ進める
+// チャンネル数が8を超える場合はスカラー版で処理する
+void scale_ramp_sse2(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame)
+{
+    if (channels > 8)
+    {
+        scale_ramp_scalar(dst, src, count, channels, start, step, frame);
+        return;
+    }
+
+    // offsets[v][k]: 周期の中のv番目のベクトルのk番目の要素が属するフレーム（周期の先頭から数えて）
+    // 例: ステレオ（channels = 2）なら offsets[0] = {0,0,1,1,2,2,3,3}, offsets[1] = {4,4,5,5,6,6,7,7}
+    int32_t offsets[8][8];
+    for (int v = 0; v < channels; v++)
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            offsets[v][k] = (v * 8 + k) / channels;
+        }
+    }
+
+    __m128 vstart = _mm_set1_ps(start);
+    __m128 vstep = _mm_set1_ps(step);
+    __m128 vmax = _mm_set1_ps(SAMPLE_MAX);
+    __m128 vmin = _mm_set1_ps(SAMPLE_MIN);
+    size_t cycle = 8 * (size_t) channels;
+
+    size_t i = 0;
+    for (; i + cycle <= count; i += cycle, frame += 8)
+    {
+        __m128i vframe = _mm_set1_epi32((int32_t) frame);
+        for (int v = 0; v < channels; v++)
+        {
+            // 各要素のフレーム番号から倍率を求める（スカラー版と同じく掛け算→足し算の順）
+            __m128i flo = _mm_add_epi32(vframe, _mm_loadu_si128((const __m128i *) offsets[v]));
+            __m128i fhi = _mm_add_epi32(vframe, _mm_loadu_si128((const __m128i *) (offsets[v] + 4)));
+            __m128 glo = _mm_add_ps(vstart, _mm_mul_ps(vstep, _mm_cvtepi32_ps(flo)));
+            __m128 ghi = _mm_add_ps(vstart, _mm_mul_ps(vstep, _mm_cvtepi32_ps(fhi)));
+
+            // 以降はscale_samples_sse2と同じ
+            __m128i s = _mm_loadu_si128((const __m128i *) (src + i + v * 8));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+            __m128 vlo = _mm_mul_ps(_mm_cvtepi32_ps(lo), glo);
+            __m128 vhi = _mm_mul_ps(_mm_cvtepi32_ps(hi), ghi);
+            vlo = _mm_max_ps(_mm_min_ps(vlo, vmax), vmin);
+            vhi = _mm_max_ps(_mm_min_ps(vhi, vmax), vmin);
+            __m128i out = _mm_packs_epi32(_mm_cvttps_epi32(vlo), _mm_cvttps_epi32(vhi));
+            _mm_storeu_si128((__m128i *) (dst + i + v * 8), out);
+        }
+    }
+
+    // 1周期に満たない残り（フレームの先頭から始まる）はスカラー版で処理する
+    scale_ramp_scalar(dst + i, src + i, count - i, channels, start, step, frame);
+}
+
+// Scale samples by a linearly changing gain with AVX2
+// 変化する倍率のAVX2版: 16サンプルずつ処理する（1周期は 16 × channels サンプル = 16フレーム）
+TARGET_AVX2 void scale_ramp_avx2(int16_t *dst, const int16_t *src, size_t count, int channels, float start, float step, uint32_t frame)
+{
+    if (channels > 8)
+    {
+        scale_ramp_scalar(dst, src, count, channels, start, step, frame);
+        return;
+    }
+
+    int32_t offsets[8][16];
+    for (int v = 0; v < channels; v++)
+    {
+        for (int k = 0; k < 16; k++)
+        {
+            offsets[v][k] = (v * 16 + k) / channels;
+        }
+    }
+
+    __m256 vstart = _mm256_set1_ps(start);
+    __m256 vstep = _mm256_set1_ps(step);
+    __m256 vmax = _mm256_set1_ps(SAMPLE_MAX);
+    __m256 vmin = _mm256_set1_ps(SAMPLE_MIN);
+    size_t cycle = 16 * (size_t) channels;
+
+    size_t i = 0;
+    for (; i + cycle <= count; i += cycle, frame += 16)
+    {
+        __m256i vframe = _mm256_set1_epi32((int32_t) frame);
+        for (int v = 0; v < channels; v++)
+        {
+            __m256i flo = _mm256_add_epi32(vframe, _mm256_loadu_si256((const __m256i *) offsets[v]));
+            __m256i fhi = _mm256_add_epi32(vframe, _mm256_loadu_si256((const __m256i *) (offsets[v] + 8)));
+            __m256 glo = _mm256_add_ps(vstart, _mm256_mul_ps(vstep, _mm256_cvtepi32_ps(flo)));
+            __m256 ghi = _mm256_add_ps(vstart, _mm256_mul_ps(vstep, _mm256_cvtepi32_ps(fhi)));
+
+            __m256i s = _mm256_loadu_si256((const __m256i *) (src + i + v * 16));
+            __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+            __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+            __m256 vlo = _mm256_mul_ps(_mm256_cvtepi32_ps(lo), glo);
+            __m256 vhi = _mm256_mul_ps(_mm256_cvtepi32_ps(hi), ghi);
+            vlo = _mm256_max_ps(_mm256_min_ps(vlo, vmax), vmin);
+            vhi = _mm256_max_ps(_mm256_min_ps(vhi, vmax), vmin);
+            __m256i out = _mm256_packs_epi32(_mm256_cvttps_epi32(vlo), _mm256_cvttps_epi32(vhi));
+            out = _mm256_permute4x64_epi64(out, 0xD8);
+            _mm256_storeu_si256((__m256i *) (dst + i + v * 16), out);
+        }
+    }
+
+    scale_ramp_sse2(dst + i, src + i, count - i, channels, start, step, frame);
+}
+#endif
+
+// Add scaled samples into float accumulators (reference implementation)
+// count個のサンプルに倍率を掛けてaccに足す関数（ミックス用、基準となるスカラー版）
+// floatの仮数部は24ビットあるので、16ビットのサンプルをいくつ足しても途中で飽和しない
+void mix_accumulate_scalar(float *acc, const int16_t *src, size_t count, float gain)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        // FMAにまとめられないよう、掛け算と足し算を別の文にする（SIMD版と同じ丸めにするため）
+        float value = (float) src[i] * gain;
+        acc[i] = acc[i] + value;
+    }
+}
+
+// Saturate float accumulators to 16-bit samples (reference implementation)
+// accの合計をint16_tの範囲に収め、0方向に切り捨ててdstに書く関数
+// 入力が1つなら、結果はscale_samples_scalarで倍率を掛けた場合と同じになる
+void mix_store_scalar(int16_t *dst, const float *acc, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float value = acc[i];
+        value = value < SAMPLE_MAX ? value : SAMPLE_MAX;
+        value = value > SAMPLE_MIN ? value : SAMPLE_MIN;
+        dst[i] = (int16_t) value;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Add scaled samples into float accumulators with SSE2
+// 足し込みのSSE2版: 8サンプルずつ32ビットに符号拡張し、倍率を掛けてaccに足す
+void mix_accumulate_sse2(float *acc, const int16_t *src, size_t count, float gain)
+{
+    __m128 vgain = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        __m128 alo = _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_cvtepi32_ps(lo), vgain));
+        __m128 ahi = _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(_mm_cvtepi32_ps(hi), vgain));
+        _mm_storeu_ps(acc + i, alo);
+        _mm_storeu_ps(acc + i + 4, ahi);
+    }
+    mix_accumulate_scalar(acc + i, src + i, count - i, gain);
+}
+
+// Saturate float accumulators to 16-bit samples with SSE2
+// 書き出しのSSE2版: scale_samples_sse2の後半と同じく、範囲内に収めて切り捨て、16ビットに詰める
+void mix_store_sse2(int16_t *dst, const float *acc, size_t count)
+{
+    __m128 vmax = _mm_set1_ps(SAMPLE_MAX);
+    __m128 vmin = _mm_set1_ps(SAMPLE_MIN);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 lo = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(acc + i), vmax), vmin);
+        __m128 hi = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(acc + i + 4), vmax), vmin);
+        __m128i out = _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+        _mm_storeu_si128((__m128i *) (dst + i), out);
+    }
+    mix_store_scalar(dst + i, acc + i, count - i);
+}
+
+// Add scaled samples into float accumulators with AVX2
+// 足し込みのAVX2版: 16サンプルずつ処理する
+TARGET_AVX2 void mix_accumulate_avx2(float *acc, const int16_t *src, size_t count, float gain)
+{
+    __m256 vgain = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+        __m256 alo = _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(_mm256_cvtepi32_ps(lo), vgain));
+        __m256 ahi = _mm256_add_ps(_mm256_loadu_ps(acc + i + 8), _mm256_mul_ps(_mm256_cvtepi32_ps(hi), vgain));
+        _mm256_storeu_ps(acc + i, alo);
+        _mm256_storeu_ps(acc + i + 8, ahi);
+    }
+    mix_accumulate_sse2(acc + i, src + i, count - i, gain);
+}
+
+// Saturate float accumulators to 16-bit samples with AVX2
+// 書き出しのAVX2版: packsの後の並び替えはscale_samples_avx2と同じ
+TARGET_AVX2 void mix_store_avx2(int16_t *dst, const float *acc, size_t count)
+{
+    __m256 vmax = _mm256_set1_ps(SAMPLE_MAX);
+    __m256 vmin = _mm256_set1_ps(SAMPLE_MIN);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 lo = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(acc + i), vmax), vmin);
+        __m256 hi = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(acc + i + 8), vmax), vmin);
+        __m256i out = _mm256_packs_epi32(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi));
+        out = _mm256_permute4x64_epi64(out, 0xD8);
+        _mm256_storeu_si256((__m256i *) (dst + i), out);
+    }
+    mix_store_sse2(dst + i, acc + i, count - i);
+}
+#endif
+
+// Count samples outside a range (reference implementation)
+// low未満またはhighより大きいサンプルの数を返す関数（--statsのクリッピング数に使う）
+size_t count_outside_scalar(const int16_t *src, size_t count, int16_t low, int16_t high)
+{
+    size_t outside = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        outside += src[i] < low || src[i] > high;
+    }
+    return outside;
+}
+
+#ifdef HAVE_X86_SIMD
+// Count samples outside a range with SSE2
+// 数えるSSE2版: 比較結果（範囲外なら全ビット1 = -1）を16ビットの数え上げ用のベクトルから引いていく
+// 16ビットは32767回で溢れるので、その前に32ビットの合計へ移す
+size_t count_outside_sse2(const int16_t *src, size_t count, int16_t low, int16_t high)
+{
+    __m128i vlow = _mm_set1_epi16(low);
+    __m128i vhigh = _mm_set1_epi16(high);
+    __m128i ones = _mm_set1_epi16(1);
+    size_t outside = 0;
+    size_t i = 0;
+    while (i + 8 <= count)
+    {
+        __m128i counter = _mm_setzero_si128();
+        for (int n = 0; n < 32767 && i + 8 <= count; n++, i += 8)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+            __m128i mask = _mm_or_si128(_mm_cmplt_epi16(s, vlow), _mm_cmpgt_epi16(s, vhigh));
+            counter = _mm_sub_epi16(counter, mask);
+        }
+
+        // madd(counter, 1): 隣り合う2つの16ビットを足して32ビットにする
+        int32_t sums[4];
+        _mm_storeu_si128((__m128i *) sums, _mm_madd_epi16(counter, ones));
+        outside += (size_t) sums[0] + sums[1] + sums[2] + sums[3];
+    }
+    return outside + count_outside_scalar(src + i, count - i, low, high);
+}
+
+// Count samples outside a range with AVX2
+// 数えるAVX2版: 16サンプルずつ比較する
+TARGET_AVX2 size_t count_outside_avx2(const int16_t *src, size_t count, int16_t low, int16_t high)
+{
+    __m256i vlow = _mm256_set1_epi16(low);
+    __m256i vhigh = _mm256_set1_epi16(high);
+    __m256i ones = _mm256_set1_epi16(1);
+    size_t outside = 0;
+    size_t i = 0;
+    while (i + 16 <= count)
+    {
+        __m256i counter = _mm256_setzero_si256();
+        for (int n = 0; n < 32767 && i + 16 <= count; n++, i += 16)
+        {
+            __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+            __m256i mask = _mm256_or_si256(_mm256_cmpgt_epi16(vlow, s), _mm256_cmpgt_epi16(s, vhigh));
+            counter = _mm256_sub_epi16(counter, mask);
+        }
+        int32_t sums[8];
+        _mm256_storeu_si256((__m256i *) sums, _mm256_madd_epi16(counter, ones));
+        for (int k = 0; k < 8; k++)
+        {
+            outside += (size_t) sums[k];
+        }
+    }
+    return outside + count_outside_sse2(src + i, count - i, low, high);
+}
+#endif
+
+// Select the sample kernel
+// 名前に合ったカーネルをscale_samples（とscale_fixed, measure_samples, scale_ramp, mix_*, count_outside）に設定する関数
+// "auto"ならCPUが対応している中で最も速いものを選ぶ
+// 戻り値: 成功なら0、未知の名前やCPUが対応していない場合は1
+int select_kernel(const char *name)
+{
+    if (strcmp(name, "scalar") == 0)
+    {
+        scale_samples = scale_samples_scalar;
+        scale_fixed = scale_fixed_scalar;
+        measure_samples = measure_samples_scalar;
+        scale_ramp = scale_ramp_scalar;
+        mix_accumulate = mix_accumulate_scalar;
+        mix_store = mix_store_scalar;
+        count_outside = count_outside_scalar;
+        return 0;
+    }
+#ifdef HAVE_X86_SIMD
+    // __builtin_cpu_supports: 実行中のCPUがその命令セットを持っているか調べる（GCC/Clangの組み込み関数）
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    if (strcmp(name, "avx2") == 0 || (strcmp(name, "auto") == 0 && has_avx2))
+    {
+        if (!has_avx2)
+        {
+            return 1;
+        }
+        scale_samples = scale_samples_avx2;
+        scale_fixed = scale_fixed_avx2;
+        measure_samples = measure_samples_avx2;
+        scale_ramp = scale_ramp_avx2;
+        mix_accumulate = mix_accumulate_avx2;
+        mix_store = mix_store_avx2;
+        count_outside = count_outside_avx2;
+        return 0;
+    }
+    if (strcmp(name, "sse2") == 0 || strcmp(name, "auto") == 0)
+    {
+        scale_samples = scale_samples_sse2;
+        scale_fixed = scale_fixed_sse2;
+        measure_samples = measure_samples_sse2;
+        scale_ramp = scale_ramp_sse2;
+        mix_accumulate = mix_accumulate_sse2;
+        mix_store = mix_store_sse2;
+        count_outside = count_outside_sse2;
+        return 0;
+    }
+#else
+    if (strcmp(name, "auto") == 0)
+    {
+        scale_samples = scale_samples_scalar;
+        scale_fixed = scale_fixed_scalar;
+        measure_samples = measure_samples_scalar;
+        scale_ramp = scale_ramp_scalar;
+        mix_accumulate = mix_accumulate_scalar;
+        mix_store = mix_store_scalar;
+        count_outside = count_outside_scalar;
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+// Decide how to apply the gain
+// 倍率factorを固定小数点で表せるか調べ、gに処理方法を設定する関数
+// fixed_mode: "auto"なら十分正確なときだけ固定小数点、"on"なら表せる限り固定小数点、"off"なら常にfloat
+// 戻り値: 成功なら0、fixed_modeが不正なら1
+int make_gain(gain *g, float factor, const char *fixed_mode)
+{
+    g->factor = factor;
+    g->fixed = 0;
+    g->q_mul = 0;
+    g->q_shift = 0;
+    g->env = NULL;
+
+    int status = fit_fixed_point(g, fixed_mode);
+    find_clip_range(g);
+    return status;
+}
+
+// Try to represent the gain in fixed point
+// g->factorを固定小数点で十分正確に表せるなら、g->fixed, q_mul, q_shiftを設定する関数
+// 戻り値: 成功なら0（固定小数点にしなかった場合も含む）、fixed_modeが不正なら1
+int fit_fixed_point(gain *g, const char *fixed_mode)
+{
+    float factor = g->factor;
+    int force;
+    if (strcmp(fixed_mode, "off") == 0)
+    {
+        return 0;
+    }
+    else if (strcmp(fixed_mode, "auto") == 0)
+    {
+        force = 0;
+    }
+    else if (strcmp(fixed_mode, "on") == 0)
+    {
+        force = 1;
+    }
+    else
+    {
+        return 1;
+    }
+
+    // |factor| × 2^shift が16ビットに収まる範囲で、shiftをできるだけ大きく（精度を高く）する
+    // 例: factor = 0.8 → shift = 15, mul = 26214 (26214 / 32768 = 0.79998...)
+    //     factor = 2.0 → shift = 13, mul = 16384 (16384 / 8192 = 2.0 ちょうど)
+    // !(x <= y) と書くのは、NaNのときも「収まらない」と判定するため
+    double magnitude = factor < 0 ? -(double) factor : (double) factor;
+    if (!(magnitude <= 32767.0))
+    {
+        return 0;  // 16ビットに収まらない倍率はfloatで処理する
+    }
+    int shift = MAX_Q_SHIFT;
+    while (shift > 0 && magnitude * (double) (1 << shift) > 32767.0)
+    {
+        shift--;
+    }
+
+    // 最も近い整数に丸めてmulを求める
+    double scaled = (double) factor * (double) (1 << shift);
+    long mul = (long) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    if (mul > 32767 || mul < -32768)
+    {
+        return 0;
+    }
+
+    // 近似の誤差を、振幅が最大（32768）のサンプルでの出力の差に換算する
+    // 0.5未満なら、float版との差は切り捨ての境目で高々1になる程度で、聞き分けられない
+    // 2.0や0.5のような2の累乗の倍率は誤差0なので、必ず固定小数点になる
+    double error = ((double) mul / (double) (1 << shift) - (double) factor) * 32768.0;
+    if (error < 0)
+    {
+        error = -error;
+    }
+    if (!force && error >= 0.5)
+    {
+        return 0;
+    }
+
+    g->fixed = 1;
+    g->q_mul = (int16_t) mul;
+    g->q_shift = shift;
+    return 0;
+}
+
+// Find the samples that do not clip
+// 16ビットのサンプルのうち、倍率を掛けても範囲内に収まるものの範囲（clip_low〜clip_high）を求める関数
+// カーネルと同じ計算（固定小数点またはfloat）で調べるので、数えたクリッピングはカーネルの飽和と一致する
+// 倍率を掛けた値はサンプルに対して単調なので、両端から内側へ調べれば範囲が決まる
+void find_clip_range(gain *g)
+{
+    int low = -32768;
+    int high = 32767;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int *edge = pass == 0 ? &low : &high;
+        int direction = pass == 0 ? 1 : -1;
+        while (low <= high)
+        {
+            // 0方向に切り捨てた結果が範囲外になるかどうか（= カーネルが飽和させるかどうか）
+            int clipped;
+            if (g->fixed)
+            {
+                int32_t product = *edge * g->q_mul;
+                if (product < 0)
+                {
+                    product += ((int32_t) 1 << g->q_shift) - 1;
+                }
+                product >>= g->q_shift;
+                clipped = product > 32767 || product < -32768;
+            }
+            else
+            {
+                float value = (float) *edge * g->factor;
+                clipped = !(value < 32768.0f && value > -32769.0f);
+            }
+            if (!clipped)
+            {
+                break;
+            }
+            *edge += direction;
+        }
+    }
+    g->clip_low = (int16_t) (low <= high ? low : 32767);
+    g->clip_high = (int16_t) (low <= high ? high : -32768);
+}
+
+// Apply the gain to samples
+// gの設定に従い、固定小数点またはfloatのカーネルでcount個のサンプルに倍率を掛ける関数
+void apply_gain(int16_t *dst, const int16_t *src, size_t count, const gain *g)
+{
+    if (g->fixed)
+    {
+        scale_fixed(dst, src, count, g->q_mul, g->q_shift);
+    }
+    else
+    {
+        scale_samples(dst, src, count, g->factor);
+    }
+}
+
+// Read a little-endian integer
+// リトルエンディアン（下位バイトが先）で格納された16/32ビット整数を読む関数
+// WAVファイルの数値はすべてリトルエンディアン
+uint16_t read_le16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+uint32_t read_le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Walk the RIFF chunks up to the data chunk
+// RIFF/WAVEのチャンクを先頭から順にたどり、fmtチャンクとdataチャンクを探す関数
+// bytes: ファイルの先頭sizeバイト
+// 見つかれば info に形式とdataチャンクの位置を書き、WAV_OKを返す
+// 途中でbytesが足りなくなったら、*neededに必要な合計バイト数を書いてWAV_NEED_MOREを返す
+//
+// WAVファイルの構造:
+//   "RIFF" <全体のサイズ> "WAVE"
+//   <チャンクID 4文字> <中身のサイズ 4バイト> <中身>  ← これが何個か続く
+//   （中身のサイズが奇数なら、1バイトの詰め物が付く）
+// "fmt "に形式、"data"にサンプルが入っており、その間にLIST（曲名等）やfactが入ることがある
+int parse_wav_header(const uint8_t *bytes, size_t size, wav_info *info, size_t *needed)
+{
+    if (size < 12)
+    {
+        *needed = 12;
+        return WAV_NEED_MORE;
+    }
+    if (memcmp(bytes, "RIFF", 4) != 0 || memcmp(bytes + 8, "WAVE", 4) != 0)
+    {
+        return WAV_INVALID;
+    }
+
+    int have_fmt = 0;  // fmtチャンクを見つけたら1
+    size_t pos = 12;   // 次のチャンクの位置
+    while (1)
+    {
+        // チャンクの見出し（ID 4バイト + サイズ 4バイト）
+        if (size < pos + 8)
+        {
+            *needed = pos + 8;
+            return WAV_NEED_MORE;
+        }
+        const uint8_t *id = bytes + pos;
+        uint32_t chunk_size = read_le32(bytes + pos + 4);
+
+        // dataチャンクに着いたら終わり。中身はヘッダーに含めない
+        if (memcmp(id, "data", 4) == 0)
+        {
+            if (!have_fmt)
+            {
+                return WAV_INVALID;  // 形式が分からないままサンプルが始まっている
+            }
+            info->data_offset = pos + 8;
+            info->data_size = chunk_size;
+            return WAV_OK;
+        }
+
+        // それ以外のチャンクは中身（と詰め物）ごとヘッダーに含める
+        size_t chunk_end = pos + 8 + (size_t) chunk_size + (chunk_size & 1);
+        if (chunk_end > MAX_HEADER_SIZE)
+        {
+            return WAV_INVALID;
+        }
+        if (size < chunk_end)
+        {
+            *needed = chunk_end;
+            return WAV_NEED_MORE;
+        }
+
+        if (memcmp(id, "fmt ", 4) == 0)
+        {
+            // fmtチャンクの中身:
+            //   0: 形式タグ（1=整数PCM, 3=浮動小数点, 0xFFFE=拡張形式）
+            //   2: チャンネル数, 4: サンプリングレート, 12: 1フレームのバイト数, 14: 1サンプルのビット数
+            //   拡張形式では24バイト目からのGUIDの先頭2バイトが本当の形式タグ
+            const uint8_t *fmt = bytes + pos + 8;
+            if (chunk_size < 16)
+            {
+                return WAV_INVALID;
+            }
+            int tag = read_le16(fmt);
+            if (tag == 0xFFFE && chunk_size >= 40)
+            {
+                tag = read_le16(fmt + 24);
+            }
+            info->channels = read_le16(fmt + 2);
+            info->sample_rate = read_le32(fmt + 4);
+            info->block_align = read_le16(fmt + 12);
+            int bits = read_le16(fmt + 14);
+
+            // 形式タグとビット数の組み合わせからサンプル形式を決める
+            if (tag == 1 && bits == 8)
+            {
+                info->format = FORMAT_U8;
+            }
+            else if (tag == 1 && bits == 16)
+            {
+                info->format = FORMAT_S16;
+            }
+            else if (tag == 1 && bits == 24)
+            {
+                info->format = FORMAT_S24;
+            }
+            else if (tag == 1 && bits == 32)
+            {
+                info->format = FORMAT_S32;
+            }
+            else if (tag == 3 && bits == 32)
+            {
+                info->format = FORMAT_F32;
+            }
+            else
+            {
+                return WAV_UNSUPPORTED;
+            }
+            info->bytes_per_sample = bits / 8;
+
+            // 1フレームのバイト数が「チャンネル数 × 1サンプルのバイト数」と一致しなければ対応外
+            if (info->channels == 0 || info->block_align != info->channels * info->bytes_per_sample)
+            {
+                return WAV_UNSUPPORTED;
+            }
+            have_fmt = 1;
+        }
+        pos = chunk_end;
+    }
+}
+
+// Read the header from a stream
+// ファイルの先頭からdataチャンクの中身の直前までを読み込み、解析する関数
+// 必要な分だけ読むので、サンプルを読み過ぎることはない（パイプからでも使える）
+// *header: 読み込んだバイト列（呼び出し側でfreeする）。info->data_offsetがそのサイズ
+// 戻り値: 成功なら0、失敗なら1（メッセージは表示済み）
+int read_wav_header(FILE *input, uint8_t **header, wav_info *info)
+{
+    uint8_t *bytes = NULL;
+    size_t size = 0;
+    size_t needed = 0;
+    int status;
+    while ((status = parse_wav_header(bytes, size, info, &needed)) == WAV_NEED_MORE)
+    {
+        // realloc: 確保済みのメモリを、中身を保ったまま大きくする
+        uint8_t *larger = realloc(bytes, needed);
+        if (larger == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory.\n");
+            free(bytes);
+            return 1;
+        }
+        bytes = larger;
+
+        // 足りない分だけ読み込む
+        if (fread(bytes + size, 1, needed - size, input) != needed - size)
+        {
+            status = WAV_INVALID;
+            break;
+        }
+        size = needed;
+    }
+
+    if (status != WAV_OK)
+    {
+        fprintf(stderr, status == WAV_UNSUPPORTED ? "Unsupported WAV format.\n" : "Could not read header.\n");
+        free(bytes);
+        return 1;
+    }
+    *header = bytes;
+    return 0;
+}
+
+// Load and store one sample of each format as double
+// 各形式の1サンプルをdoubleとして読む関数（load_*）と、doubleを範囲内に収めて書く関数（store_*）
+// 整数形式では、float版のs16カーネルと同じく0方向に切り捨て、範囲外は飽和させる
+// static inline: このファイル内だけで使い、呼び出し元に展開してよいという指定
+static inline double load_u8(const uint8_t *p)
+{
+    return (double) p[0] - 128.0;  // 8ビットは符号なしで、128が無音
+}
+
+static inline void store_u8(uint8_t *p, double value)
+{
+    value = value < 127.0 ? value : 127.0;
+    value = value > -128.0 ? value : -128.0;
+    p[0] = (uint8_t) ((int) value + 128);
+}
+
+static inline double load_s24(const uint8_t *p)
+{
+    // 3バイトを組み立て、24ビット目が1なら負の数にする（符号拡張）
+    int32_t v = (int32_t) (p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16));
+    if (v & 0x800000)
+    {
+        v -= 0x1000000;
+    }
+    return (double) v;
+}
+
+static inline void store_s24(uint8_t *p, double value)
+{
+    value = value < 8388607.0 ? value : 8388607.0;
+    value = value > -8388608.0 ? value : -8388608.0;
+    uint32_t v = (uint32_t) (int32_t) value;
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+}
+
+static inline double load_s32(const uint8_t *p)
+{
+    return (double) (int32_t) read_le32(p);
+}
+
+static inline void store_s32(uint8_t *p, double value)
+{
+    value = value < 2147483647.0 ? value : 2147483647.0;
+    value = value > -2147483648.0 ? value : -2147483648.0;
+    uint32_t v = (uint32_t) (int32_t) value;
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static inline double load_f32(const uint8_t *p)
+{
+    // memcpy: 整列していないアドレスからでも安全にfloatを取り出す
+    float v;
+    memcpy(&v, p, sizeof(float));
+    return v;
+}
+
+static inline void store_f32(uint8_t *p, double value)
+{
+    // 浮動小数点形式は1.0を超えても表せるので、クリッピングしない
+    float v = (float) value;
+    memcpy(p, &v, sizeof(float));
+}
+
+// Define a gain kernel specialized for one sample format
+// サンプル形式ごとの倍率を掛ける関数を作るマクロ
+// BYTES, LOAD, STOREが定数・インライン関数として埋め込まれるので、
+// 出来上がった関数のループの中には形式による分岐が一切ない
+#define DEFINE_FORMAT_KERNEL(NAME, BYTES, LOAD, STORE)                            \
+    void NAME(uint8_t *dst, const uint8_t *src, size_t count, const gain *g)      \
+    {                                                                             \
+        double factor = g->factor;                                                \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            STORE(dst + i * (BYTES), LOAD(src + i * (BYTES)) * factor);           \
+        }                                                                         \
+    }
+
+DEFINE_FORMAT_KERNEL(gain_u8, 1, load_u8, store_u8)
+DEFINE_FORMAT_KERNEL(gain_s24, 3, load_s24, store_s24)
+DEFINE_FORMAT_KERNEL(gain_s32, 4, load_s32, store_s32)
+DEFINE_FORMAT_KERNEL(gain_f32, 4, load_f32, store_f32)
+
+// 16ビットは最もよく使われる形式なので、SIMD・固定小数点のカーネル（apply_gain）に任せる
+// dataチャンクの位置は必ず偶数バイト目（チャンクは偶数バイトに揃えられる）なので、int16_tとして読める
+void gain_s16(uint8_t *dst, const uint8_t *src, size_t count, const gain *g)
+{
+    apply_gain((int16_t *) dst, (const int16_t *) src, count, g);
+}
+
+// Select the kernel for a sample format
+// サンプル形式に合った関数を返す関数
+// 形式による分岐はここで1回だけ行い、サンプルのループの中では行わない
+format_kernel select_format_kernel(sample_format format)
+{
+    switch (format)
+    {
+        case FORMAT_U8:
+            return gain_u8;
+        case FORMAT_S16:
+            return gain_s16;
+        case FORMAT_S24:
+            return gain_s24;
+        case FORMAT_S32:
+            return gain_s32;
+        case FORMAT_F32:
+            return gain_f32;
+    }
+    return NULL;
+}
+
+// Define an analysis pass specialized for one sample format
+// サンプル形式ごとの解析関数を作るマクロ（DEFINE_FORMAT_KERNELの読み込みだけの版）
+#define DEFINE_FORMAT_ANALYZER(NAME, BYTES, LOAD)                                 \
+    void NAME(const uint8_t *src, size_t count, level_stats *stats)               \
+    {                                                                             \
+        double peak = stats->peak;                                                \
+        double sum = stats->sum_squares;                                          \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            double value = LOAD(src + i * (BYTES));                               \
+            double magnitude = value < 0 ? -value : value;                        \
+            peak = magnitude > peak ? magnitude : peak;                           \
+            sum += value * value;                                                 \
+        }                                                                         \
+        stats->peak = peak;                                                       \
+        stats->sum_squares = sum;                                                 \
+        stats->count += count;                                                    \
+    }
+
+DEFINE_FORMAT_ANALYZER(analyze_u8, 1, load_u8)
+DEFINE_FORMAT_ANALYZER(analyze_s24, 3, load_s24)
+DEFINE_FORMAT_ANALYZER(analyze_s32, 4, load_s32)
+DEFINE_FORMAT_ANALYZER(analyze_f32, 4, load_f32)
+
+// 16ビットはSIMDの集計カーネル（measure_samples）に任せ、整数の結果をdoubleにまとめる
+void analyze_s16(const uint8_t *src, size_t count, level_stats *stats)
+{
+    int32_t peak = 0;
+    uint64_t sum = 0;
+    measure_samples((const int16_t *) src, count, &peak, &sum);
+    stats->peak = peak > stats->peak ? peak : stats->peak;
+    stats->sum_squares += (double) sum;
+    stats->count += count;
+}
+
+// Select the analysis pass for a sample format
+// サンプル形式に合った解析関数を返す関数
+format_analyzer select_format_analyzer(sample_format format)
+{
+    switch (format)
+    {
+        case FORMAT_U8:
+            return analyze_u8;
+        case FORMAT_S16:
+            return analyze_s16;
+        case FORMAT_S24:
+            return analyze_s24;
+        case FORMAT_S32:
+            return analyze_s32;
+        case FORMAT_F32:
+            return analyze_f32;
+    }
+    return NULL;
+}
+
+// Full-scale magnitude of a sample format
+// 各形式で0dBFS（フルスケール）に当たるサンプルの絶対値を返す関数
+// 整数形式では負側の最大（-128, -32768等）の絶対値、浮動小数点形式では1.0
+double format_full_scale(sample_format format)
+{
+    switch (format)
+    {
+        case FORMAT_U8:
+            return 128.0;
+        case FORMAT_S16:
+            return 32768.0;
+        case FORMAT_S24:
+            return 8388608.0;
+        case FORMAT_S32:
+            return 2147483648.0;
+        case FORMAT_F32:
+            return 1.0;
+    }
+    return 1.0;
+}
+
+// Define a ramp kernel specialized for one sample format
+// サンプル形式ごとの、変化する倍率を掛ける関数を作るマクロ
+// 倍率の求め方はscale_ramp_scalarと同じで、掛け算はDEFINE_FORMAT_KERNELと同じくdoubleで行う
+#define DEFINE_FORMAT_RAMP(NAME, BYTES, LOAD, STORE)                              \
+    void NAME(uint8_t *dst, const uint8_t *src, size_t count, int channels,       \
+              float start, float step, uint32_t frame)                            \
+    {                                                                             \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            float gain = step * (float) (frame + (uint32_t) (i / channels));      \
+            gain = start + gain;                                                  \
+            STORE(dst + i * (BYTES), LOAD(src + i * (BYTES)) * gain);             \
+        }                                                                         \
+    }
+
+DEFINE_FORMAT_RAMP(ramp_u8, 1, load_u8, store_u8)
+DEFINE_FORMAT_RAMP(ramp_s24, 3, load_s24, store_s24)
+DEFINE_FORMAT_RAMP(ramp_s32, 4, load_s32, store_s32)
+DEFINE_FORMAT_RAMP(ramp_f32, 4, load_f32, store_f32)
+
+// 16ビットはSIMDのカーネル（scale_ramp）に任せる
+void ramp_s16(uint8_t *dst, const uint8_t *src, size_t count, int channels, float start, float step, uint32_t frame)
+{
+    scale_ramp((int16_t *) dst, (const int16_t *) src, count, channels, start, step, frame);
+}
+
+// Select the ramp kernel for a sample format
+// サンプル形式に合った、変化する倍率の関数を返す関数
+format_ramp select_format_ramp(sample_format format)
+{
+    switch (format)
+    {
+        case FORMAT_U8:
+            return ramp_u8;
+        case FORMAT_S16:
+            return ramp_s16;
+        case FORMAT_S24:
+            return ramp_s24;
+        case FORMAT_S32:
+            return ramp_s32;
+        case FORMAT_F32:
+            return ramp_f32;
+    }
+    return NULL;
+}
+
+// Define the mixing functions for one sample format
+// サンプル形式ごとのミックス用の関数（NAME_accumulate, NAME_store, NAME_clipped）を作るマクロ
+// 16ビット以外はdoubleで足し合わせる（32ビット整数でも誤差なく足せる）
+// LOW, HIGH: その形式で表せる範囲（浮動小数点形式は飽和させないので±HUGE_VAL）
+#define DEFINE_FORMAT_MIX(NAME, BYTES, LOAD, STORE, LOW, HIGH)                    \
+    void NAME##_accumulate(void *acc, const uint8_t *src, size_t count, float gain) \
+    {                                                                             \
+        double *sum = acc;                                                        \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            sum[i] += LOAD(src + i * (BYTES)) * gain;                             \
+        }                                                                         \
+    }                                                                             \
+    void NAME##_store(uint8_t *dst, const void *acc, size_t count)                \
+    {                                                                             \
+        const double *sum = acc;                                                  \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            STORE(dst + i * (BYTES), sum[i]);                                     \
+        }                                                                         \
+    }                                                                             \
+    uint64_t NAME##_clipped(const void *acc, size_t count)                        \
+    {                                                                             \
+        const double *sum = acc;                                                  \
+        uint64_t clipped = 0;                                                     \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            clipped += !(sum[i] < (HIGH) + 1.0 && sum[i] > (LOW) - 1.0);          \
+        }                                                                         \
+        return clipped;                                                           \
+    }
+
+DEFINE_FORMAT_MIX(mix_u8, 1, load_u8, store_u8, -128.0, 127.0)
+DEFINE_FORMAT_MIX(mix_s24, 3, load_s24, store_s24, -8388608.0, 8388607.0)
+DEFINE_FORMAT_MIX(mix_s32, 4, load_s32, store_s32, -2147483648.0, 2147483647.0)
+DEFINE_FORMAT_MIX(mix_f32, 4, load_f32, store_f32, -HUGE_VAL, HUGE_VAL)
+
+// 16ビットはfloatの合計を使うSIMDのカーネル（mix_accumulate, mix_store）に任せる
+void mix_s16_accumulate(void *acc, const uint8_t *src, size_t count, float gain)
+{
+    mix_accumulate(acc, (const int16_t *) src, count, gain);
+}
+
+void mix_s16_store(uint8_t *dst, const void *acc, size_t count)
+{
+    mix_store((int16_t *) dst, acc, count);
+}
+
+// 0方向に切り捨てた結果が範囲外になる（mix_storeが飽和させる）合計を数える
+uint64_t mix_s16_clipped(const void *acc, size_t count)
+{
+    const float *sum = acc;
+    uint64_t clipped = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        clipped += !(sum[i] < 32768.0f && sum[i] > -32769.0f);
+    }
+    return clipped;
+}
+
+// Select the mixing functions for a sample format
+// サンプル形式に合ったミックス用の関数の組を返す関数
+format_mixer select_format_mixer(sample_format format)
+{
+    format_mixer mixer = {mix_s16_accumulate, mix_s16_store, mix_s16_clipped};
+    switch (format)
+    {
+        case FORMAT_U8:
+            mixer.accumulate = mix_u8_accumulate;
+            mixer.store = mix_u8_store;
+            mixer.clipped = mix_u8_clipped;
+            break;
+        case FORMAT_S16:
+            break;
+        case FORMAT_S24:
+            mixer.accumulate = mix_s24_accumulate;
+            mixer.store = mix_s24_store;
+            mixer.clipped = mix_s24_clipped;
+            break;
+        case FORMAT_S32:
+            mixer.accumulate = mix_s32_accumulate;
+            mixer.store = mix_s32_store;
+            mixer.clipped = mix_s32_clipped;
+            break;
+        case FORMAT_F32:
+            mixer.accumulate = mix_f32_accumulate;
+            mixer.store = mix_f32_store;
+            mixer.clipped = mix_f32_clipped;
+            break;
+    }
+    return mixer;
+}
+
+// Define a clipping counter for one sample format
+// サンプル形式ごとに、倍率を掛けると範囲外になる（storeが飽和させる）サンプルを数える関数を作るマクロ
+#define DEFINE_FORMAT_CLIP_COUNTER(NAME, BYTES, LOAD, LOW, HIGH)                  \
+    uint64_t NAME(const uint8_t *src, size_t count, double factor)                \
+    {                                                                             \
+        uint64_t clipped = 0;                                                     \
+        for (size_t i = 0; i < count; i++)                                        \
+        {                                                                         \
+            double value = LOAD(src + i * (BYTES)) * factor;                      \
+            clipped += !(value < (HIGH) + 1.0 && value > (LOW) - 1.0);            \
+        }                                                                         \
+        return clipped;                                                           \
+    }
+
+DEFINE_FORMAT_CLIP_COUNTER(clipped_u8, 1, load_u8, -128.0, 127.0)
+DEFINE_FORMAT_CLIP_COUNTER(clipped_s24, 3, load_s24, -8388608.0, 8388607.0)
+DEFINE_FORMAT_CLIP_COUNTER(clipped_s32, 4, load_s32, -2147483648.0, 2147483647.0)
+
+// Count the samples the gain will clip
+// count個のサンプルのうち、倍率gを掛けると範囲外になり飽和させられるものの数を返す関数
+// 16ビットはfind_clip_rangeで求めた範囲との比較だけなので、SIMDで速く数えられる
+// 浮動小数点形式は飽和させないので0
+uint64_t count_clipped(const uint8_t *src, size_t count, const gain *g, sample_format format)
+{
+    switch (format)
+    {
+        case FORMAT_U8:
+            return clipped_u8(src, count, g->factor);
+        case FORMAT_S16:
+            return count_outside((const int16_t *) src, count, g->clip_low, g->clip_high);
+        case FORMAT_S24:
+            return clipped_s24(src, count, g->factor);
+        case FORMAT_S32:
+            return clipped_s32(src, count, g->factor);
+        case FORMAT_F32:
+            return 0;
+    }
+    return 0;
+}
+
+// Count one block of samples
+// 倍率を掛ける前のブロックをsに数える関数（サンプル数、バイト数、飽和するサンプル数）
+// 飽和の判定にはサンプルをもう1度読むので、--statsがないとき（total_statsがNULL）は数えない
+// 読み込んだ直後のブロックはキャッシュにあるので、--statsを付けても追加の時間はわずか
+// 包絡線では倍率がサンプルごとに変わるため、飽和は数えずclip_unknownにする
+void tally_block(run_stats *s, const uint8_t *src, size_t count, const gain *g, const wav_info *info)
+{
+    s->samples += count;
+    s->bytes += (uint64_t) count * info->bytes_per_sample;
+    if (total_stats == NULL)
+    {
+        return;
+    }
+    if (g->env != NULL)
+    {
+        s->clip_unknown = 1;
+        return;
+    }
+    s->clipped += count_clipped(src, count, g, info->format);
+}
+
+// Current time in seconds
+// 計測用の現在時刻（秒）を返す関数
+// CLOCK_MONOTONIC: 時計の修正の影響を受けず、常に増えていく時刻
+// 1回の呼び出しは数十ナノ秒なので、ブロックごとに呼んでも処理時間にはほとんど影響しない
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Add one run's measurements to the totals
+// 処理関数1回分の計測結果を、--statsの合計に足す関数（--statsがなければ何もしない）
+// バッチモードや並列モードでは複数のスレッドから呼ばれるので、鍵をかけて足す
+void merge_stats(const run_stats *part)
+{
+    if (total_stats == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&stats_lock);
+    total_stats->header += part->header;
+    total_stats->read += part->read;
+    total_stats->compute += part->compute;
+    total_stats->write += part->write;
+    total_stats->samples += part->samples;
+    total_stats->bytes += part->bytes;
+    total_stats->clipped += part->clipped;
+    total_stats->clip_unknown |= part->clip_unknown;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// Print the measurements
+// 計測結果を標準エラー出力に表示する関数（標準出力は音声データに使うことがあるため）
+// 処理速度は全体の経過時間（elapsed）で割る。段階ごとの時間はスレッドの合計なので、経過時間より長いことがある
+// readとwriteが長ければディスク待ち、computeが長ければ計算待ちと分かる
+void print_stats(const run_stats *s, double elapsed)
+{
+    double rate = elapsed > 0 ? 1.0 / elapsed : 0.0;
+    fprintf(stderr, "header   %10.6f s\n", s->header);
+    fprintf(stderr, "read     %10.6f s\n", s->read);
+    fprintf(stderr, "compute  %10.6f s\n", s->compute);
+    fprintf(stderr, "write    %10.6f s\n", s->write);
+    fprintf(stderr, "elapsed  %10.6f s\n", elapsed);
+    fprintf(stderr, "samples  %llu (%.1f Msamples/s, %.1f MB/s)\n", (unsigned long long) s->samples,
+            (double) s->samples * rate * 1e-6, (double) s->bytes * rate * 1e-6);
+    if (s->clip_unknown)
+    {
+        fprintf(stderr, "clipped  not counted with --envelope\n");
+    }
+    else
+    {
+        fprintf(stderr, "clipped  %llu (%.4f%%)\n", (unsigned long long) s->clipped,
+                s->samples > 0 ? 100.0 * (double) s->clipped / (double) s->samples : 0.0);
+    }
+}
+
+// Parse an envelope given as "time:gain,time:gain,..."
+// 「秒:倍率」をカンマで区切って並べた文字列を読み、envに設定する関数
+// 例: "0:0,2:1,58:1,60:0" → 最初の2秒でフェードイン、58秒から60秒でフェードアウト
+// 時刻は0以上で、前の折れ点より小さくてはいけない（同じ時刻なら倍率がそこで切り替わる）
+// 戻り値: 成功なら0、書式が不正なら1
+int parse_envelope(const char *spec, envelope *env)
+{
+    env->count = 0;
+    const char *p = spec;
+    while (1)
+    {
+        // strtod: 文字列の先頭から数値を読み、読み終えた位置をendに返す
+        char *end;
+        double time = strtod(p, &end);
+        if (end == p || *end != ':' || !(time >= 0.0) || !isfinite(time))
+        {
+            return 1;
+        }
+        p = end + 1;
+        double value = strtod(p, &end);
+        if (end == p || !isfinite(value))
+        {
+            return 1;
+        }
+        if (env->count == MAX_BREAKPOINTS || (env->count > 0 && time < env->times[env->count - 1]))
+        {
+            return 1;
+        }
+        env->times[env->count] = time;
+        env->gains[env->count] = (float) value;
+        env->count++;
+
+        if (*end == '\0')
+        {
+            return 0;
+        }
+        if (*end != ',')
+        {
+            return 1;
+        }
+        p = end + 1;
+    }
+}
+
+// Parse the --block-size argument
+// --block-sizeの値（1ブロックあたりのサンプル数）を読む関数
+// strtoullは"-1"も受け付けて、符号なしの非常に大きな数にしてしまう。そのまま使うと
+// バッファのバイト数を求める掛け算があふれ、小さなバッファに大きなブロックを読み込んでしまう
+// そこで先頭が数字であることを確かめ、数字以外が続く・範囲外（errnoがERANGE）・MAX_BLOCK_SAMPLESより大きい場合は失敗にする
+// 戻り値: 読めればブロックのサンプル数、読めなければ0（使い方の表示に回す）
+size_t parse_block_size(const char *text)
+{
+    if (text[0] < '0' || text[0] > '9')
+    {
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || value > MAX_BLOCK_SAMPLES)
+    {
+        return 0;
+    }
+    return (size_t) value;
+}
+
+// Block size rounded down to whole frames
+// block_samplesサンプル分のバイト数を、1フレームのバイト数の倍数に切り下げる関数（最低1フレーム）
+// ブロックがフレームの途中で切れないので、包絡線のフレーム番号がブロックの大きさに左右されない
+// 掛け算があふれないように、block_samplesはMAX_BLOCK_SAMPLESで頭打ちにする
+size_t frame_block_bytes(size_t block_samples, const wav_info *info)
+{
+    if (block_samples > MAX_BLOCK_SAMPLES)
+    {
+        block_samples = MAX_BLOCK_SAMPLES;
+    }
+    size_t bytes = block_samples * info->bytes_per_sample / info->block_align * info->block_align;
+    return bytes > 0 ? bytes : (size_t) info->block_align;
+}
+
+// Scale one block, following the envelope if there is one
+// count個のサンプルに倍率を掛ける関数。positionはブロックの先頭のサンプル番号（dataの先頭から数えて）
+// 包絡線がなければkernelをそのまま呼ぶ。あれば、倍率が直線で変わる区間ごとにrampカーネルを呼ぶ
+// 区間はフレーム番号で決まる（折れ点と、ENVELOPE_PIECE_FRAMESごとの区切り）ので、
+// ブロックの分け方（--block-size, --threads, mmap）が違っても結果がバイト単位で同じになる
+void scale_block(format_kernel kernel, uint8_t *dst, const uint8_t *src, size_t count, const gain *g, const wav_info *info, uint64_t position)
+{
+    const envelope *env = g->env;
+    if (env == NULL)
+    {
+        kernel(dst, src, count, g);
+        return;
+    }
+
+    format_ramp ramp = select_format_ramp(info->format);
+    int channels = info->channels;
+    double rate = info->sample_rate;
+    uint64_t frame = position / channels;  // ブロックは必ずフレームの先頭から始まる
+    size_t done = 0;
+    while (done < count)
+    {
+        // 現在のフレームが何番目の折れ点の後ろにあるかを調べる
+        // 折れ点kの時刻に当たる最初のフレームは ceil(times[k] × rate)
+        int k = 0;
+        uint64_t next = UINT64_MAX;  // 次の折れ点のフレーム
+        while (k < env->count)
+        {
+            uint64_t at = (uint64_t) ceil(env->times[k] * rate);
+            if (at > frame)
+            {
+                next = at;
+                break;
+            }
+            k++;
+        }
+
+        // 区間の始まり（倍率を計算し直すフレーム）と終わり
+        // 始まりは「前の折れ点」と「ENVELOPE_PIECE_FRAMESの区切り」の遅いほう
+        uint64_t begin = frame / ENVELOPE_PIECE_FRAMES * ENVELOPE_PIECE_FRAMES;
+        uint64_t end = begin + ENVELOPE_PIECE_FRAMES;
+        if (k > 0)
+        {
+            uint64_t previous = (uint64_t) ceil(env->times[k - 1] * rate);
+            begin = previous > begin ? previous : begin;
+        }
+        end = next < end ? next : end;
+
+        // 区間の始まりの倍率と、1フレームあたりの増分
+        // 最初の折れ点より前と最後の折れ点より後ろは一定（増分0）
+        double value;
+        double slope = 0.0;
+        if (k == 0 || k == env->count)
+        {
+            value = env->gains[k == 0 ? 0 : k - 1];
+        }
+        else
+        {
+            double t0 = env->times[k - 1];
+            double t1 = env->times[k];
+            double g0 = env->gains[k - 1];
+            double g1 = env->gains[k];
+            slope = (g1 - g0) / ((t1 - t0) * rate);
+            value = g0 + (g1 - g0) * ((double) begin / rate - t0) / (t1 - t0);
+        }
+
+        // 区間の終わりまでか、ブロックの終わりまでを処理する
+        size_t samples = count - done;
+        uint64_t limit = (end - frame) * channels;
+        if (limit < samples)
+        {
+            samples = (size_t) limit;
+        }
+        size_t offset = done * info->bytes_per_sample;
+        ramp(dst + offset, src + offset, samples, channels,
+             (float) (g->factor * value), (float) (g->factor * slope), (uint32_t) (frame - begin));
+        done += samples;
+        frame = end;
+    }
+}
+
+// Derive the gain that brings the level to the target
+// 解析結果からピークとRMSをdBFSに換算し（*peak_db, *rms_db）、目標に合わせる倍率を返す関数
+// dBFS = 20 × log10(レベル / フルスケール)。倍率はその差 (目標 - 現在) dB を振幅の比に戻したもの
+// 無音のファイル（レベルが0で -∞ dBFS）は、いくら掛けても目標に届かないので倍率1.0にする
+float normalize_factor(const level_stats *stats, double full_scale, const normalize_target *target, double *peak_db, double *rms_db)
+{
+    double rms = stats->count > 0 ? sqrt(stats->sum_squares / (double) stats->count) : 0.0;
+    *peak_db = 20.0 * log10(stats->peak / full_scale);
+    *rms_db = 20.0 * log10(rms / full_scale);
+
+    double level_db = target->by_rms ? *rms_db : *peak_db;
+    if (!isfinite(level_db))
+    {
+        return 1.0f;
+    }
+    return (float) pow(10.0, (target->target_db - level_db) / 20.0);
+}
+
+// Copy header and scale samples block by block
+// ヘッダーをコピーし、サンプルをブロック単位で読み込み・音量変更・書き込みする関数
+// 戻り値: 成功なら0、失敗なら1（mainの終了コードとしてそのまま使う）
+int process_stream(FILE *input, FILE *output, const gain *g, size_t block_samples)
+{
+    // 1. ヘッダーのコピー
+    // dataチャンクの中身より前はヘッダー情報（fmt, LIST等のチャンク）で、音声データではない
+    // このヘッダーには音声の形式情報が含まれているので、解析したうえでそのままコピーする
+    // stats: --stats用の計測結果（各段階の前後で時刻を読み、差を足していく）
+    run_stats stats = {0};
+    double mark = now_seconds();
+    wav_info info;
+    uint8_t *header;
+    if (read_wav_header(input, &header, &info) != 0)
+    {
+        return 1;
+    }
+
+    // fwrite: ファイルにデータを書き込む関数
+    // fwrite(書き込み元のバッファ, 1要素のサイズ, 要素数, ファイルポインタ)
+    // 読み込んだヘッダーをそのまま出力ファイルに書き込む
+    size_t written = fwrite(header, 1, info.data_offset, output);
+    free(header);
+    double now = now_seconds();
+    stats.header += now - mark;
+    mark = now;
+    if (written != info.data_offset)
+    {
+        fprintf(stderr, "Could not write file.\n");
+        return 1;
+    }
+
+    // 2. サンプルの読み込み、音量変更、書き込み
+    // 1サンプルずつfread/fwriteを呼ぶと、2GBのファイルでは約10億回のライブラリ呼び出しになる
+    // そこでblock_samples個のサンプルをまとめて読み込み、まとめて倍率を掛け、1回で書き込む
+    format_kernel kernel = select_format_kernel(info.format);
+    size_t block_bytes = frame_block_bytes(block_samples, &info);
+
+    // バッファのバイト数をBLOCK_ALIGNMENTの倍数に切り上げる
+    // aligned_alloc関数はサイズがアライメントの倍数であることを要求するため
+    size_t buffer_size = (block_bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+
+    // aligned_alloc: 先頭アドレスがBLOCK_ALIGNMENTの倍数になるようにメモリを確保する
+    uint8_t *buffer = aligned_alloc(BLOCK_ALIGNMENT, buffer_size);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory.\n");
+        return 1;
+    }
+
+    // dataチャンクの中身のバイト数だけ処理する（長さが不明ならファイルの終わりまで）
+    // fread(buffer, 1, want, input) の戻り値: 読み込めたバイト数（ファイル終端では少なくなる）
+    int unknown_size = info.data_size == WAV_SIZE_UNKNOWN;
+    uint64_t remaining = info.data_size;
+    uint64_t position = 0;  // 次のブロックの先頭のサンプル番号
+    while (unknown_size || remaining > 0)
+    {
+        size_t want = block_bytes;
+        if (!unknown_size && want > remaining)
+        {
+            want = (size_t) remaining;
+        }
+        size_t got = fread(buffer, 1, want, input);
+        now = now_seconds();
+        stats.read += now - mark;
+        mark = now;
+        if (got == 0)
+        {
+            break;
+        }
+
+        // ブロック内のすべてのサンプルに倍率を掛ける（その場で書き換え）
+        // 1サンプルに満たない端数（途中で切れたファイル）はそのまま書き出す
+        // 飽和の数は倍率を掛ける前のサンプルで数える（掛けた後では分からない）
+        tally_block(&stats, buffer, got / info.bytes_per_sample, g, &info);
+        scale_block(kernel, buffer, buffer, got / info.bytes_per_sample, g, &info, position);
+        position += got / info.bytes_per_sample;
+        now = now_seconds();
+        stats.compute += now - mark;
+        mark = now;
+
+        // 変更したブロックを1回のfwriteで出力ファイルに書き込む
+        // 書き込めた数が読み込んだ数より少なければ書き込みエラー（ディスク容量不足など）
+        if (fwrite(buffer, 1, got, output) != got)
+        {
+            fprintf(stderr, "Could not write file.\n");
+            free(buffer);
+            return 1;
+        }
+        now = now_seconds();
+        stats.write += now - mark;
+        mark = now;
+        remaining -= got;
+        if (got < want)
+        {
+            break;  // ファイルの終わり
+        }
+    }
+
+    // 3. dataチャンクより後ろ（詰め物やLIST等のチャンク）は変更せずにそのままコピーする
+    size_t got;
+    while ((got = fread(buffer, 1, buffer_size, input)) > 0)
+    {
+        if (fwrite(buffer, 1, got, output) != got)
+        {
+            fprintf(stderr, "Could not write file.\n");
+            free(buffer);
+            return 1;
+        }
+    }
+    stats.write += now_seconds() - mark;
+
+    // 確保したバッファを解放する
+    free(buffer);
+    merge_stats(&stats);
+    return 0;
+}
+
+// Scale samples through memory-mapped files
+// 入力ファイル（と出力ファイル）をmmapでメモリに割り当てて音量を変更する関数
+// output_pathがNULLなら入力ファイルをその場で書き換える
+// normalizeがNULLでなければ、まずサンプルを解析し、gの代わりに目標のレベルに合う倍率を使う
+// 戻り値: 成功なら0、失敗なら1
+int process_mapped(const char *input_path, const char *output_path, const gain *g, const normalize_target *normalize)
+{
+    // 1. 入力ファイルを開いてサイズを調べる
+    // open: FILE*ではなくファイル記述子（整数）でファイルを開く。mmapにはこちらが必要
+    // その場で書き換える場合は読み書き両用（O_RDWR）で開く
+    // mmapではサンプルの読み込みはページフォールト（初めて触れたときの読み込み）として
+    // 計算の途中で起こるので、--statsのreadは0で、その時間はcomputeに含まれる
+    run_stats stats = {0};
+    double mark = now_seconds();
+    int in_fd = open(input_path, output_path == NULL ? O_RDWR : O_RDONLY);
+    if (in_fd < 0)
+    {
+        fprintf(stderr, "Could not open file.\n");
+        return 1;
+    }
+
+    // fstat: ファイルの情報（サイズ等）を取得する
+    // 空のファイルはmmapできないので、ここで弾いておく
+    struct stat st;
+    if (fstat(in_fd, &st) != 0 || st.st_size < 12)
+    {
+        fprintf(stderr, "Could not read header.\n");
+        close(in_fd);
+        return 1;
+    }
+    size_t input_size = (size_t) st.st_size;
+
+    // 2. 入力ファイルをメモリに割り当てる
+    // mmap(アドレスの希望, 長さ, 保護属性, 共有方法, ファイル記述子, オフセット)
+    // MAP_SHARED: 書き込みがファイルに反映される（その場で書き換える場合に必要）
+    int in_prot = output_path == NULL ? PROT_READ | PROT_WRITE : PROT_READ;
+    uint8_t *in_map = mmap(NULL, input_size, in_prot, MAP_SHARED, in_fd, 0);
+    if (in_map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map file.\n");
+        close(in_fd);
+        return 1;
+    }
+
+    // 先頭から順番に読むことをカーネルに伝え、先読みを積極的に行わせる
+    // 正規化では同じページを2回読むので、読み終えたページを早めに捨てさせないようWILLNEEDにする
+    posix_madvise(in_map, input_size, normalize != NULL ? POSIX_MADV_WILLNEED : POSIX_MADV_SEQUENTIAL);
+
+    // 3. ヘッダーを解析してdataチャンクの位置を求める
+    // ファイル全体が割り当て済みなので、「続きが必要」はファイルが途中で切れていることを意味する
+    wav_info info;
+    size_t needed;
+    int status = parse_wav_header(in_map, input_size, &info, &needed);
+    if (status != WAV_OK)
+    {
+        fprintf(stderr, status == WAV_UNSUPPORTED ? "Unsupported WAV format.\n" : "Could not read header.\n");
+        munmap(in_map, input_size);
+        close(in_fd);
+        return 1;
+    }
+
+    // dataチャンクに書かれたサイズと、実際にファイルに残っているバイト数の小さいほうを使う
+    size_t data_bytes = input_size - info.data_offset;
+    if (info.data_size != WAV_SIZE_UNKNOWN && info.data_size < data_bytes)
+    {
+        data_bytes = info.data_size;
+    }
+    size_t count = data_bytes / info.bytes_per_sample;
+    format_kernel kernel = select_format_kernel(info.format);
+    double now = now_seconds();
+    stats.header += now - mark;
+    mark = now;
+
+    // 正規化: 1回目の走査でピークとRMSを求め、倍率を決める
+    // 2回目の走査（倍率を掛ける）は同じ割り当て領域を読むので、ディスクからは1回しか読まない
+    gain derived;
+    if (normalize != NULL)
+    {
+        level_stats levels = {0.0, 0.0, 0};
+        select_format_analyzer(info.format)(in_map + info.data_offset, count, &levels);
+        double peak_db;
+        double rms_db;
+        float factor = normalize_factor(&levels, format_full_scale(info.format), normalize, &peak_db, &rms_db);
+        make_gain(&derived, factor, normalize->fixed_mode);
+        derived.env = g->env;  // 包絡線は求めた倍率にさらに掛ける
+        g = &derived;
+        printf("%s: peak %.2f dBFS, RMS %.2f dBFS, gain %.4f\n", input_path, peak_db, rms_db, factor);
+    }
+
+    // 4. その場で書き換える場合: ヘッダーはそのまま、サンプル部分だけを直接書き換える
+    if (output_path == NULL)
+    {
+        uint8_t *samples = in_map + info.data_offset;
+        tally_block(&stats, samples, count, g, &info);
+        scale_block(kernel, samples, samples, count, g, &info, 0);
+        now = now_seconds();
+        stats.compute += now - mark;
+        munmap(in_map, input_size);
+        close(in_fd);
+        stats.write += now_seconds() - now;
+        merge_stats(&stats);
+        return 0;
+    }
+
+    // 5. 出力ファイルを作成し、最初から完成時のサイズ（入力と同じ）にしておく
+    // O_CREAT: なければ作る, O_TRUNC: 既存の内容を消す, 0644: 作成時の権限（rw-r--r--）
+    // mmapは読み書き両方の権限を要求するのでO_RDWRで開く
+    size_t output_size = input_size;
+    int out_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        fprintf(stderr, "Could not open file.\n");
+        munmap(in_map, input_size);
+        close(in_fd);
+        return 1;
+    }
+
+    // ftruncate: ファイルのサイズを変更する（ここでは0バイトから完成時のサイズに伸ばす）
+    if (ftruncate(out_fd, (off_t) output_size) != 0)
+    {
+        fprintf(stderr, "Could not write file.\n");
+        munmap(in_map, input_size);
+        close(in_fd);
+        close(out_fd);
+        return 1;
+    }
+
+    uint8_t *out_map = mmap(NULL, output_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if (out_map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map file.\n");
+        munmap(in_map, input_size);
+        close(in_fd);
+        close(out_fd);
+        return 1;
+    }
+
+    // 6. ヘッダーをコピーし、入力のサンプルに倍率を掛けて出力の割り当て領域に直接書き込む
+    // 読み込み用・書き込み用のバッファを経由しないので、余分なコピーが発生しない
+    // サンプルの後ろ（端数のバイト、詰め物、後続のチャンク）はそのままコピーする
+    size_t samples_end = info.data_offset + count * info.bytes_per_sample;
+    now = now_seconds();
+    stats.write += now - mark;  // 出力ファイルの作成
+    mark = now;
+    memcpy(out_map, in_map, info.data_offset);
+    tally_block(&stats, in_map + info.data_offset, count, g, &info);
+    scale_block(kernel, out_map + info.data_offset, in_map + info.data_offset, count, g, &info, 0);
+    memcpy(out_map + samples_end, in_map + samples_end, input_size - samples_end);
+    now = now_seconds();
+    stats.compute += now - mark;
+    mark = now;
+
+    // 7. 割り当てを解除してファイルを閉じる
+    // munmap: 割り当てを解除する（MAP_SHAREDなので、変更はファイルに書き戻される）
+    munmap(out_map, output_size);
+    munmap(in_map, input_size);
+    close(out_fd);
+    close(in_fd);
+    stats.write += now_seconds() - mark;
+    merge_stats(&stats);
+    return 0;
+}
+
+// Read or write a whole range at a given offset
+// pread/pwrite: ファイルの位置（オフセット）を指定して読み書きする
+// FILE*と違って「現在位置」を共有しないので、複数のスレッドが同じファイルを同時に読み書きできる
+// 1回の呼び出しで全部読み書きできるとは限らないので、終わるまで繰り返す
+// 戻り値: 成功なら0、失敗（ファイルの終わりを含む）なら1
+int pread_full(int fd, uint8_t *buffer, size_t size, size_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t got = pread(fd, buffer, size, (off_t) offset);
+        if (got <= 0)
+        {
+            return 1;
+        }
+        buffer += got;
+        size -= (size_t) got;
+        offset += (size_t) got;
+    }
+    return 0;
+}
+
+int pwrite_full(int fd, const uint8_t *buffer, size_t size, size_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t put = pwrite(fd, buffer, size, (off_t) offset);
+        if (put <= 0)
+        {
+            return 1;
+        }
+        buffer += put;
+        size -= (size_t) put;
+        offset += (size_t) put;
+    }
+    return 0;
+}
+
+// Worker thread: process chunks until none are left
+// 作業スレッドの本体
+// 共有カウンターから次の区間の番号を取り、読み込み・倍率・書き込みを繰り返す
+// 区間は重ならず、倍率の計算は各サンプルで独立しているので、結果は1スレッドの場合と同じになる
+void *gain_worker(void *arg)
+{
+    parallel_job *job = arg;
+
+    // スレッドごとに専用のバッファを持つ（スレッド間で共有しない）
+    size_t buffer_size = (job->chunk_bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    uint8_t *buffer = aligned_alloc(BLOCK_ALIGNMENT, buffer_size);
+    if (buffer == NULL)
+    {
+        atomic_store(&job->failed, 1);
+        return NULL;
+    }
+
+    // スレッドごとに計測し、終わったら全体に足す（スレッドの合計になる）
+    run_stats stats = {0};
+    double mark = now_seconds();
+    while (!atomic_load(&job->failed))
+    {
+        // atomic_fetch_add: 値を1増やし、増やす前の値を返す
+        // 複数のスレッドが同時に呼んでも、同じ番号を2つのスレッドが受け取ることはない
+        size_t index = atomic_fetch_add(&job->next_chunk, 1);
+        if (index >= job->chunk_count)
+        {
+            break;  // 全区間が処理済み（または処理中）
+        }
+
+        size_t offset = index * job->chunk_bytes;
+        size_t size = job->total_bytes - offset;
+        if (size > job->chunk_bytes)
+        {
+            size = job->chunk_bytes;
+        }
+
+        if (pread_full(job->in_fd, buffer, size, job->start + offset) != 0)
+        {
+            atomic_store(&job->failed, 1);
+            break;
+        }
+        double now = now_seconds();
+        stats.read += now - mark;
+        mark = now;
+        tally_block(&stats, buffer, size / job->bytes_per_sample, job->g, job->info);
+        scale_block(job->kernel, buffer, buffer, size / job->bytes_per_sample, job->g, job->info, offset / job->bytes_per_sample);
+        now = now_seconds();
+        stats.compute += now - mark;
+        mark = now;
+        if (pwrite_full(job->out_fd, buffer, size, job->start + offset) != 0)
+        {
+            atomic_store(&job->failed, 1);
+            break;
+        }
+        now = now_seconds();
+        stats.write += now - mark;
+        mark = now;
+    }
+
+    free(buffer);
+    merge_stats(&stats);
+    return NULL;
+}
+
+// Scale samples on several threads with positional I/O
+// 複数のスレッドで並列に音量を変更する関数
+// 1. ヘッダーを解析して出力にコピー
+// 2. サンプル部分をフレーム単位で揃えた区間に分け、threads個のスレッドで分担する
+// 3. サンプルより後ろのバイトをコピー
+// 戻り値: 成功なら0、失敗なら1
+int process_parallel(const char *input_path, const char *output_path, const gain *g, size_t block_samples, int threads)
+{
+    // 1. ヘッダーの読み込みは通常のモードと同じ関数を使う
+    run_stats stats = {0};
+    double mark = now_seconds();
+    FILE *input = fopen(input_path, "rb");
+    if (input == NULL)
+    {
+        fprintf(stderr, "Could not open file.\n");
+        return 1;
+    }
+    wav_info info;
+    uint8_t *header;
+    if (read_wav_header(input, &header, &info) != 0)
+    {
+        fclose(input);
+        return 1;
+    }
+
+    // fileno: FILE*の元になっているファイル記述子を取り出す（preadで使う）
+    int in_fd = fileno(input);
+    struct stat st;
+    if (fstat(in_fd, &st) != 0)
+    {
+        fprintf(stderr, "Could not read header.\n");
+        free(header);
+        fclose(input);
+        return 1;
+    }
+    size_t input_size = (size_t) st.st_size;
+
+    // dataチャンクに書かれたサイズと、実際にファイルに残っているバイト数の小さいほうを使う
+    size_t data_bytes = input_size - info.data_offset;
+    if (info.data_size != WAV_SIZE_UNKNOWN && info.data_size < data_bytes)
+    {
+        data_bytes = info.data_size;
+    }
+
+    // 出力ファイルを開き、最初から入力と同じサイズにしておく（ヘッダーは先頭に書く）
+    int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        fprintf(stderr, "Could not open file.\n");
+        free(header);
+        fclose(input);
+        return 1;
+    }
+    int status = 0;
+    if (ftruncate(out_fd, (off_t) input_size) != 0 || pwrite_full(out_fd, header, info.data_offset, 0) != 0)
+    {
+        status = 1;
+    }
+    free(header);
+    stats.header += now_seconds() - mark;
+
+    // 2. 作業の準備
+    // 区間の大きさはblock_samplesサンプル分を、1フレームのバイト数の倍数に切り下げたもの
+    // フレームの途中で区切らないので、どのスレッドもチャンネルの並びを崩さない
+    parallel_job job;
+    job.in_fd = in_fd;
+    job.out_fd = out_fd;
+    job.kernel = select_format_kernel(info.format);
+    job.g = g;
+    job.info = &info;
+    job.bytes_per_sample = info.bytes_per_sample;
+    job.start = info.data_offset;
+    job.total_bytes = data_bytes / info.bytes_per_sample * info.bytes_per_sample;
+    job.chunk_bytes = frame_block_bytes(block_samples, &info);
+    job.chunk_count = (job.total_bytes + job.chunk_bytes - 1) / job.chunk_bytes;
+    atomic_init(&job.next_chunk, 0);
+    atomic_init(&job.failed, status);
+
+    // スレッドを起動し、全スレッドの終了を待つ
+    // pthread_create(スレッドID, 属性, 実行する関数, 関数に渡す引数)
+    // pthread_join: 指定したスレッドが終わるまで待つ
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&workers[i], NULL, gain_worker, &job) != 0)
+        {
+            break;  // 起動できた分だけで処理を続ける
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        gain_worker(&job);  // スレッドを1つも作れなければ、このスレッドで処理する
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    status = atomic_load(&job.failed);
+
+    // 3. サンプルより後ろ（端数のバイト、詰め物、後続のチャンク）はそのままコピーする
+    mark = now_seconds();
+    size_t tail = job.start + job.total_bytes;
+    uint8_t copy[65536];
+    while (status == 0 && tail < input_size)
+    {
+        size_t size = input_size - tail < sizeof(copy) ? input_size - tail : sizeof(copy);
+        if (pread_full(in_fd, copy, size, tail) != 0 || pwrite_full(out_fd, copy, size, tail) != 0)
+        {
+            status = 1;
+        }
+        tail += size;
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Could not write file.\n");
+    }
+    close(out_fd);
+    fclose(input);
+    stats.write += now_seconds() - mark;
+    merge_stats(&stats);
+    return status;
+}
+
+// Wait until a pipeline buffer reaches a state
+// index番目（RING_SLOTSで割った余りの位置）のバッファが、指定の状態になるまで待つ関数
+// pthread_cond_wait: 鍵を一時的に外して眠り、他のスレッドからの知らせで目を覚ます
+ring_slot *wait_slot(pipe_ring *ring, size_t index, int state)
+{
+    ring_slot *slot = &ring->slots[index % RING_SLOTS];
+    pthread_mutex_lock(&ring->lock);
+    while (slot->state != state)
+    {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return slot;
+}
+
+// Move a pipeline buffer to its next state
+// バッファを次の状態にし、待っているスレッドに知らせる関数
+// 状態は3種類なので、すべてのスレッドを起こし（broadcast）、各自が自分の待つ状態か確かめる
+void post_slot(pipe_ring *ring, ring_slot *slot, int state)
+{
+    pthread_mutex_lock(&ring->lock);
+    slot->state = state;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Reader thread of the pipeline
+// 読み込みスレッド: 空きバッファに順番に読み込み、計算待ちにする
+// dataチャンクの分はsamplesを設定し、その後ろのバイトは倍率を掛けずに流す
+// 入力が終わったら、last = 1 の目印を最後に1つ置いて終了する
+void *pipe_reader(void *arg)
+{
+    pipe_ring *ring = arg;
+    int bytes_per_sample = ring->info.bytes_per_sample;
+    int unknown_size = ring->info.data_size == WAV_SIZE_UNKNOWN;
+    uint64_t remaining = ring->info.data_size;  // まだ読んでいないdataチャンクのバイト数
+    int in_data = 1;                            // 1ならdataチャンクの中を読んでいる
+
+    for (size_t i = 0;; i++)
+    {
+        ring_slot *slot = wait_slot(ring, i, SLOT_EMPTY);
+
+        size_t got = 0;
+        if (!atomic_load(&ring->write_failed))
+        {
+            // dataチャンクを読み終えていたら（中身が0バイトの場合も）、後続のチャンクのコピーに移る
+            // こうしておくとwantは0にならないので、got == 0 は入力の終わりだけを表す
+            if (in_data && !unknown_size && remaining == 0)
+            {
+                in_data = 0;
+            }
+            size_t want = ring->block_bytes;
+            if (in_data && !unknown_size && want > remaining)
+            {
+                want = (size_t) remaining;
+            }
+            double mark = now_seconds();
+            got = fread(slot->data, 1, want, ring->input);
+            ring->stats.read += now_seconds() - mark;
+            slot->samples = in_data ? got / bytes_per_sample : 0;
+            if (in_data)
+            {
+                remaining -= got;
+                if (got < want || (!unknown_size && remaining == 0))
+                {
+                    in_data = 0;  // dataチャンクが終わった（以降は後続のチャンク）
+                }
+            }
+            if (got < want && ferror(ring->input))
+            {
+                atomic_store(&ring->read_failed, 1);
+            }
+        }
+
+        // 何も読めなかったら入力の終わり（wantは1以上なので got < want となり、in_dataも0になっている）
+        // 書き込みに失敗していれば読まずに終える
+        // post_slotの後はほかのスレッドがslotを書き換えるので、lastはローカル変数に控えておく
+        int last = got == 0;
+        slot->size = got;
+        slot->last = last;
+        post_slot(ring, slot, SLOT_FILLED);
+        if (last)
+        {
+            return NULL;
+        }
+    }
+}
+
+// Writer thread of the pipeline
+// 書き込みスレッド: 計算済みのバッファを順番に書き出し、空きに戻す
+// 書き込みに失敗しても、読み込みスレッドが止まらないように最後までバッファを空きに戻し続ける
+void *pipe_writer(void *arg)
+{
+    pipe_ring *ring = arg;
+    for (size_t i = 0;; i++)
+    {
+        ring_slot *slot = wait_slot(ring, i, SLOT_SCALED);
+        if (slot->last)
+        {
+            return NULL;
+        }
+        double mark = now_seconds();
+        if (!atomic_load(&ring->write_failed) && fwrite(slot->data, 1, slot->size, ring->output) != slot->size)
+        {
+            atomic_store(&ring->write_failed, 1);
+        }
+        ring->stats.write += now_seconds() - mark;
+        post_slot(ring, slot, SLOT_EMPTY);
+    }
+}
+
+// Scale a non-seekable stream with overlapped reading and writing
+// 標準入力・標準出力のようなシークできない入出力で音量を変更する関数
+// 読み込みスレッド → 計算（このスレッド） → 書き込みスレッド の3段のパイプラインにし、
+// RING_SLOTS個のバッファを順番に回すので、ディスクやパイプを待つ間も計算が止まらない
+// 戻り値: 成功なら0、失敗なら1
+int process_pipe(FILE *input, FILE *output, const gain *g, size_t block_samples)
+{
+    // 1. ヘッダーは必要なバイト数だけ読むので、シークできない入力でも問題ない
+    // 読み込み・書き込みの時間はバッファを待つ時間を含まない（fread/fwriteの中の時間だけ）
+    pipe_ring ring;
+    ring.stats = (run_stats) {0};
+    double mark = now_seconds();
+    uint8_t *header;
+    if (read_wav_header(input, &header, &ring.info) != 0)
+    {
+        return 1;
+    }
+    size_t written = fwrite(header, 1, ring.info.data_offset, output);
+    free(header);
+    ring.stats.header += now_seconds() - mark;
+    if (written != ring.info.data_offset)
+    {
+        fprintf(stderr, "Could not write file.\n");
+        return 1;
+    }
+
+    // 2. バッファを用意する（大きさはサンプルの倍数）
+    ring.input = input;
+    ring.output = output;
+    ring.block_bytes = frame_block_bytes(block_samples, &ring.info);
+    atomic_init(&ring.read_failed, 0);
+    atomic_init(&ring.write_failed, 0);
+    size_t buffer_size = (ring.block_bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    int allocated = 1;
+    for (int s = 0; s < RING_SLOTS; s++)
+    {
+        ring.slots[s].data = aligned_alloc(BLOCK_ALIGNMENT, buffer_size);
+        ring.slots[s].state = SLOT_EMPTY;
+        allocated = allocated && ring.slots[s].data != NULL;
+    }
+    if (!allocated)
+    {
+        fprintf(stderr, "Could not allocate memory.\n");
+        for (int s = 0; s < RING_SLOTS; s++)
+        {
+            free(ring.slots[s].data);
+        }
+        return 1;
+    }
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.changed, NULL);
+
+    // 3. 読み込みスレッドと書き込みスレッドを起動する
+    pthread_t reader;
+    pthread_t writer;
+    int status = 0;
+    if (pthread_create(&reader, NULL, pipe_reader, &ring) != 0)
+    {
+        status = 1;
+    }
+    else if (pthread_create(&writer, NULL, pipe_writer, &ring) != 0)
+    {
+        // 書き込みスレッドが作れなければ、読み込みを打ち切って後片付けする
+        atomic_store(&ring.write_failed, 1);
+        for (size_t i = 0;; i++)
+        {
+            ring_slot *slot = wait_slot(&ring, i, SLOT_FILLED);
+            int last = slot->last;
+            post_slot(&ring, slot, SLOT_EMPTY);
+            if (last)
+            {
+                break;
+            }
+        }
+        pthread_join(reader, NULL);
+        status = 1;
+    }
+    else
+    {
+        // 4. このスレッドは計算を担当する
+        // 読み込み済みのバッファに倍率を掛け、書き込み待ちにする
+        format_kernel kernel = select_format_kernel(ring.info.format);
+        uint64_t position = 0;
+        for (size_t i = 0;; i++)
+        {
+            ring_slot *slot = wait_slot(&ring, i, SLOT_FILLED);
+            int last = slot->last;  // post_slotの後は書き込みスレッドのものになる
+            if (!last)
+            {
+                mark = now_seconds();
+                tally_block(&ring.stats, slot->data, slot->samples, g, &ring.info);
+                scale_block(kernel, slot->data, slot->data, slot->samples, g, &ring.info, position);
+                position += slot->samples;
+                ring.stats.compute += now_seconds() - mark;
+            }
+            post_slot(&ring, slot, SLOT_SCALED);
+            if (last)
+            {
+                break;
+            }
+        }
+        pthread_join(reader, NULL);
+        pthread_join(writer, NULL);
+        int read_failed = atomic_load(&ring.read_failed);
+        if (read_failed || atomic_load(&ring.write_failed))
+        {
+            fprintf(stderr, read_failed ? "Could not read file.\n" : "Could not write file.\n");
+            status = 1;
+        }
+        merge_stats(&ring.stats);
+    }
+
+    pthread_cond_destroy(&ring.changed);
+    pthread_mutex_destroy(&ring.lock);
+    for (int s = 0; s < RING_SLOTS; s++)
+    {
+        free(ring.slots[s].data);
+    }
+    return status;
+}
+
+// Read a batch manifest
+// マニフェストを読み込み、処理するファイルの一覧を作る関数
+// 1行に「入力ファイル 出力ファイル 倍率」を空白で区切って書く（空行と#で始まる行は無視）
+// 戻り値: 成功なら0（*entriesは呼び出し側でfreeする）、失敗なら1
+int load_manifest(const char *path, batch_entry **entries, size_t *count)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open file.\n");
+        return 1;
+    }
+
+    batch_entry *list = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    char line[MAX_PATH_LENGTH];
+    int line_number = 0;
+    int status = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+
+        // strtok: 区切り文字（空白・タブ・改行）で文字列を分割する
+        char *input = strtok(line, " \t\r\n");
+        if (input == NULL || input[0] == '#')
+        {
+            continue;
+        }
+        char *output = strtok(NULL, " \t\r\n");
+        char *factor = strtok(NULL, " \t\r\n");
+        if (output == NULL || factor == NULL)
+        {
+            fprintf(stderr, "%s:%i: expected \"input output factor\"\n", path, line_number);
+            status = 1;
+            break;
+        }
+
+        // strtod: 数値として読めなかった部分があれば（"abc"や"1.5x"など）エラーにする
+        // atofでは読めない文字列が黙って0（無音）になってしまう
+        char *end;
+        double value = strtod(factor, &end);
+        if (end == factor || *end != '\0' || !isfinite(value))
+        {
+            fprintf(stderr, "%s:%i: invalid factor \"%s\"\n", path, line_number, factor);
+            status = 1;
+            break;
+        }
+
+        if (add_batch_entry(&list, &size, &capacity, input, output, (float) value) != 0)
+        {
+            fprintf(stderr, "Could not allocate memory.\n");
+            status = 1;
+            break;
+        }
+    }
+    fclose(file);
+
+    if (status != 0)
+    {
+        free_batch(list, size);
+        return 1;
+    }
+    *entries = list;
+    *count = size;
+    return 0;
+}
+
+// Build a batch from every .wav file in a directory
+// 入力ディレクトリ内の全.wavファイルについて、出力ディレクトリの同じ名前のファイルへの指定を作る関数
+// 戻り値: 成功なら0、失敗なら1（メモリ不足やパスが長すぎる場合も、一部だけ処理せずに失敗にする）
+int load_directory(const char *input_dir, const char *output_dir, float factor, batch_entry **entries, size_t *count)
+{
+    // opendir: ディレクトリを開く, readdir: 中のファイルを1つずつ取り出す
+    DIR *dir = opendir(input_dir);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not open directory.\n");
+        return 1;
+    }
+
+    batch_entry *list = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    int status = 0;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL)
+    {
+        // 名前が".wav"で終わるものだけを対象にする
+        size_t length = strlen(item->d_name);
+        if (length <= 4 || strcmp(item->d_name + length - 4, ".wav") != 0)
+        {
+            continue;
+        }
+
+        // 「ディレクトリ/ファイル名」のパスを作る
+        // snprintfの戻り値は切り詰めずに書いた場合の文字数なので、配列の大きさ以上なら長すぎて切れている
+        char input[MAX_PATH_LENGTH];
+        char output[MAX_PATH_LENGTH];
+        int input_length = snprintf(input, sizeof(input), "%s/%s", input_dir, item->d_name);
+        int output_length = snprintf(output, sizeof(output), "%s/%s", output_dir, item->d_name);
+        if (input_length < 0 || input_length >= (int) sizeof(input) || output_length < 0 || output_length >= (int) sizeof(output))
+        {
+            fprintf(stderr, "%s: path too long\n", item->d_name);
+            status = 1;
+            break;
+        }
+
+        if (add_batch_entry(&list, &size, &capacity, input, output, factor) != 0)
+        {
+            fprintf(stderr, "Could not allocate memory.\n");
+            status = 1;
+            break;
+        }
+    }
+    closedir(dir);
+
+    if (status != 0)
+    {
+        free_batch(list, size);
+        return 1;
+    }
+    *entries = list;
+    *count = size;
+    return 0;
+}
+
+// Append one job to a batch list
+// 一覧（list、size個、capacity個分確保済み）の末尾に1つの指定を加える関数
+// 配列がいっぱいなら2倍に広げる
+// strdup: 文字列のコピーを新しく確保したメモリに作る（呼び出し側の配列は次の行で上書きされるため）
+// 戻り値: 成功なら0、メモリを確保できなければ1（一覧は加える前のまま）
+int add_batch_entry(batch_entry **list, size_t *size, size_t *capacity, const char *input, const char *output, float factor)
+{
+    if (*size == *capacity)
+    {
+        size_t larger_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        batch_entry *larger = realloc(*list, larger_capacity * sizeof(batch_entry));
+        if (larger == NULL)
+        {
+            return 1;
+        }
+        *list = larger;
+        *capacity = larger_capacity;
+    }
+
+    char *input_copy = strdup(input);
+    char *output_copy = strdup(output);
+    if (input_copy == NULL || output_copy == NULL)
+    {
+        free(input_copy);
+        free(output_copy);
+        return 1;
+    }
+    (*list)[*size].input = input_copy;
+    (*list)[*size].output = output_copy;
+    (*list)[*size].factor = factor;
+    (*size)++;
+    return 0;
+}
+
+// Free a batch list
+// 一覧のsize個の指定と、一覧そのものを解放する関数
+void free_batch(batch_entry *list, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        free(list[i].input);
+        free(list[i].output);
+    }
+    free(list);
+}
+
+// Batch worker: run own jobs, then steal from the others
+// バッチモードの作業スレッドの本体
+// まず自分の列の末尾から仕事を取り、空になったら他のスレッドの列の先頭から盗む
+// 仕事は最初に全部配られていて後から増えないので、全員の列が空になったら終わり
+void *batch_worker(void *arg)
+{
+    batch_worker_arg *self = arg;
+    batch_pool *pool = self->pool;
+
+    while (1)
+    {
+        // 自分の列を先に調べ、次に隣のスレッドから順番に調べる
+        int found = 0;
+        size_t index = 0;
+        for (int k = 0; k < pool->workers && !found; k++)
+        {
+            work_deque *deque = &pool->deques[(self->id + k) % pool->workers];
+            pthread_mutex_lock(&deque->lock);
+            if (deque->head < deque->tail)
+            {
+                // k == 0 は自分の列（末尾から）、それ以外は盗み（先頭から）
+                index = k == 0 ? deque->items[--deque->tail] : deque->items[deque->head++];
+                found = 1;
+            }
+            pthread_mutex_unlock(&deque->lock);
+        }
+        if (!found)
+        {
+            break;
+        }
+
+        // 1ファイルを処理する。メモリはヘッダーと1ブロック分のバッファだけなので、
+        // ファイルの大きさに関係なく上限が決まっている
+        batch_entry *entry = &pool->entries[index];
+        // 正規化する場合は、ファイルを2回走査するためmmapで処理する
+        gain g;
+        make_gain(&g, entry->factor, pool->fixed_mode);
+        g.env = pool->env;
+        int status = pool->normalize != NULL ? process_mapped(entry->input, entry->output, &g, pool->normalize)
+                                             : process_file(entry->input, entry->output, &g, pool->block_samples);
+        if (status != 0)
+        {
+            fprintf(stderr, "%s: failed\n", entry->input);
+            atomic_fetch_add(&pool->failures, 1);
+        }
+    }
+    return NULL;
+}
+
+// Process many files on a fixed-size thread pool
+// 多数のファイルを、threads個のスレッドで分担して処理する関数
+// normalizeがNULLでなければ、各ファイルの倍率の代わりにファイルごとに求めた倍率を使う
+// envがNULLでなければ、全ファイルに同じ包絡線を掛ける
+// 戻り値: すべて成功なら0、1つでも失敗したら1
+int process_batch(batch_entry *entries, size_t count, int threads, const char *fixed_mode, size_t block_samples, const normalize_target *normalize, const envelope *env)
+{
+    if (count == 0)
+    {
+        fprintf(stderr, "No files to process.\n");
+        return 1;
+    }
+    if ((size_t) threads > count)
+    {
+        threads = (int) count;  // ファイルより多くのスレッドは不要
+    }
+
+    // スレッドごとの仕事の列を作り、ファイルを順番に配る（0番→スレッド0, 1番→スレッド1, ...）
+    batch_pool pool;
+    pool.entries = entries;
+    pool.workers = threads;
+    pool.fixed_mode = fixed_mode;
+    pool.block_samples = block_samples;
+    pool.normalize = normalize;
+    pool.env = env;
+    atomic_init(&pool.failures, 0);
+    // 各スレッドの列はper_worker個分の場所を持つ（count個をthreads個に順番に配ると、多くてもper_worker個）
+    // countがthreadsで割り切れないと最後の列は満たないが、場所はthreads × per_worker個確保しておく
+    size_t per_worker = (count + threads - 1) / threads;
+    pool.deques = malloc(threads * sizeof(work_deque));
+    size_t *items = malloc((size_t) threads * per_worker * sizeof(size_t));
+    if (pool.deques == NULL || items == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory.\n");
+        free(pool.deques);
+        free(items);
+        return 1;
+    }
+    for (int w = 0; w < threads; w++)
+    {
+        work_deque *deque = &pool.deques[w];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->items = items + w * per_worker;
+        deque->head = 0;
+        deque->tail = 0;
+        for (size_t i = w; i < count; i += threads)
+        {
+            deque->items[deque->tail++] = i;
+        }
+    }
+
+    // スレッドを起動して終了を待つ
+    pthread_t workers[MAX_THREADS];
+    batch_worker_arg args[MAX_THREADS];
+    int started = 0;
+    for (int w = 0; w < threads; w++)
+    {
+        args[w].pool = &pool;
+        args[w].id = w;
+        if (pthread_create(&workers[w], NULL, batch_worker, &args[w]) != 0)
+        {
+            break;  // 起動できたスレッドが残りの仕事を盗んで処理する
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        batch_worker(&args[0]);  // スレッドを1つも作れなければ、このスレッドで全部処理する
+    }
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(workers[w], NULL);
+    }
+
+    for (int w = 0; w < threads; w++)
+    {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    }
+    free(pool.deques);
+    free(items);
+
+    int failures = atomic_load(&pool.failures);
+    printf("Processed %zu files, %i failed.\n", count, failures);
+    return failures > 0 ? 1 : 0;
+}
+
+/*
+このプログラムの動作の流れ:
+1. コマンドライン引数をチェック（オプション、入力ファイル、出力ファイル、倍率）
+2. 入力ファイルと出力ファイルを開く
+3. 倍率を数値に変換
+4. RIFFチャンクをたどってfmtとdataを探し、dataの中身より前をそのままコピー
+5. 音声データをブロック（既定65536サンプル）単位で読み込み
+6. ブロック内の各サンプルに倍率を掛けて音量を変更（範囲外は最大値・最小値に飽和）
+7. 変更したブロックを1回で出力ファイルに書き込み
+8. dataチャンクの終わりまで5-7を繰り返し
+9. dataチャンクより後ろのチャンクをそのままコピーし、ファイルを閉じて終了
+
+対応しているサンプル形式（fmtチャンクで判定）:
+- 8ビット整数（符号なし）, 16ビット整数, 24ビット整数, 32ビット整数, 32ビット浮動小数点
+- 拡張形式（WAVE_FORMAT_EXTENSIBLE）の整数PCM・浮動小数点にも対応
+- 形式ごとにDEFINE_FORMAT_KERNELで専用の関数を作り、ループの外で1回だけ選ぶ
+
+mmapモード（--mmap / --in-place）の流れ:
+1. 入力ファイルをmmapでメモリに割り当てる
+2. 出力ファイルを完成時のサイズで作成し、同じく割り当てる（--in-placeでは省略）
+3. ヘッダーを解析してコピーし、割り当てた領域のサンプルに直接倍率を掛ける
+4. 割り当てを解除する（変更はカーネルがファイルに書き戻す）
+
+並列モード（--threads N）の流れ:
+1. ヘッダーを解析して出力ファイルの先頭に書く（出力は最初から入力と同じサイズにする）
+2. サンプル部分を、フレームの境目で区切ったblock_samples程度の区間に分ける
+3. 各スレッドが共有カウンターから区間の番号を取り、pread→倍率→pwriteを繰り返す
+4. 区間は重ならないので、出力は1スレッドで処理した場合とバイト単位で同じになる
+5. サンプルより後ろのチャンクをコピーして終了
+
+バッチモード（--batch / --batch-dir）の流れ:
+1. マニフェストまたはディレクトリから「入力 出力 倍率」の一覧を作る
+2. --threads個のスレッドにファイルを順番に配る（スレッドごとの仕事の列）
+3. 各スレッドは自分の列の末尾から取り、空になったら他のスレッドの列の先頭から盗む（ワークスティーリング）
+   大きなファイルが偏っても、手の空いたスレッドが残りを引き受ける
+4. 各ファイルは通常モードと同じブロック処理なので、1ファイルあたりのメモリはブロック1つ分
+
+標準入出力モード（ファイル名に "-"）の流れ:
+1. ヘッダーを必要なバイト数だけ読み、そのまま書き出す（シークしない）
+2. 3つのバッファを 読み込みスレッド → 計算（メインスレッド） → 書き込みスレッド の順に回す
+3. 読み込み・計算・書き込みが別々のバッファで同時に進むので、境目で止まらない
+4. 長さが不明（dataサイズ0xFFFFFFFF）のストリームは入力の終わりまで処理する
+5. エラーメッセージは標準エラー出力に出すので、音声データに混ざらない
+
+正規化モード（--normalize-to dBFS）の流れ:
+1. 入力ファイルをmmapで割り当て、1回目の走査でピーク（絶対値の最大）と2乗の合計を求める
+   16ビットはSIMDのカーネル（measure_samples）で、整数のまま誤差なく集計する
+2. ピークとRMSをdBFSに換算し、目標（--rmsならRMS、既定はピーク）との差から倍率を求める
+3. 2回目の走査で、同じ割り当て領域のサンプルに倍率を掛ける（ディスクから読むのは1回だけ）
+4. ファイルごとに「ピーク, RMS, 倍率」を標準出力に表示する（バッチモードではファイルごとに求める）
+
+包絡線（--envelope 秒:倍率,...）:
+1. 折れ点の間は倍率を直線で補間し、factor（または正規化で求めた倍率）にさらに掛ける
+2. 倍率が直線で変わる区間ごとに「開始時の倍率」と「1フレームあたりの増分」を求め、rampカーネルに渡す
+3. rampカーネルはベクトルの各要素のフレーム番号から倍率を計算する（チャンネル数ごとの並びを表にする）
+   チャンネル数8以下はSSE2/AVX2、それより多い場合はスカラー版で処理する
+4. ブロックはフレーム単位で区切るので、どのモード・ブロックの大きさでも結果がバイト単位で同じになる
+
+ミックスモード（--mix 出力 入力1 倍率1 入力2 倍率2 ...）の流れ:
+1. 全入力のヘッダーを読み、形式（サンプル形式, チャンネル数, サンプリングレート）がそろっているか確かめる
+2. 最も長い入力のヘッダーを、サイズの欄だけ書き換えて出力する
+3. 全入力から同じ位置のブロックを読み、倍率を掛けて合計用のバッファに足し込む
+   16ビットはfloat（SIMDのmix_accumulate）、それ以外はdoubleで足すので、途中で飽和しない
+4. 合計を1回だけ範囲内に収めて（飽和させて）書き出す（16ビットはSIMDのmix_store）
+5. 短い入力は終わった後を無音として扱い、最も長い入力が終わるまで3-4を繰り返す
+6. 最も長い入力のdataチャンクより後ろのチャンク（LIST等）をそのままコピーする
+   （dataチャンクのサイズが不明・途中で切れている場合は、チャンクの境目が分からないのでコピーしない）
+入力が1つなら、結果は --fixed off で同じ倍率を掛けた場合とバイト単位で同じになる
+--envelope, --normalize-to, --in-place, --batch, --batch-dir とは組み合わせられない（使い方のエラーになる）
+
+計測（--stats）:
+1. 各段階（ヘッダー, 読み込み, 計算, 書き込み）の前後で時刻を読み、差を足していく
+2. 倍率を掛ける前のブロックで、飽和するサンプルを数える
+   16ビットは「飽和しない入力の範囲」をmake_gainで1度だけ求め、count_outsideで範囲外を数える（SIMD）
+   ミックスモードは足し合わせた後の合計で数える
+3. 全モードの処理が終わったら、合計を標準エラー出力に表示する
+- 時刻はブロックごとに数回読むだけなので、付けたままでも処理速度はほとんど変わらない
+- 複数のスレッドで処理した場合、各段階の時間は全スレッドの合計（elapsedより長くなることがある）
+- mmapモードは読み込みが計算中のページフォールトとして起こるので、readは0でcomputeに含まれる
+- 包絡線を使うと倍率がサンプルごとに変わるので、飽和の数は数えない
+
+使用例:
+./volume input.wav output.wav 2.0   // 音量を2倍にする
+./volume input.wav output.wav 0.5   // 音量を半分にする
+./volume input.wav output.wav 1.0   // 音量を変更しない（コピーのみ）
+./volume --block-size 1048576 input.wav output.wav 0.8   // 1ブロック100万サンプルで処理
+./volume --mmap input.wav output.wav 0.8                 // mmapで処理
+./volume --in-place input.wav 0.8                        // 入力ファイルを直接書き換える
+./volume --kernel scalar input.wav output.wav 0.8        // 基準のスカラー版で処理（SIMD版と結果は同じ）
+./volume --fixed off input.wav output.wav 0.8            // 固定小数点を使わず、常にfloatで処理
+./volume --threads 0 input.wav output.wav 0.8            // CPUの数だけスレッドを使って処理
+./volume --threads 8 --batch manifest.txt                // マニフェストの全ファイルを8スレッドで処理
+./volume --threads 8 --batch-dir in/ out/ 0.8            // in/の全.wavをout/に書き出す
+decoder | ./volume - - 0.8 | encoder                     // パイプの途中で音量を変更する
+./volume --normalize-to -1 input.wav output.wav          // ピークを-1dBFSに揃える
+./volume --normalize-to -20 --rms --in-place input.wav   // RMSを-20dBFSに揃えて書き換える
+./volume --threads 8 --normalize-to -1 --batch-dir in/ out/  // 全ファイルをそれぞれ正規化する
+./volume --envelope 0:0,2:1,28:1,30:0 ad.wav out.wav 1.0 // 最初の2秒でフェードイン、最後の2秒でフェードアウト
+./volume --mix mix.wav vocal.wav 1.0 bgm.wav 0.5         // 2つの音声を倍率を付けて足し合わせる
+./volume --stats input.wav output.wav 1.5                // 段階ごとの時間、処理速度、飽和したサンプル数を表示する
+
+マニフェストの例（#で始まる行は無視される。パスに空白は使えない）:
+# input output factor
+ep001.wav out/ep001.wav 0.8
+ep002.wav out/ep002.wav 1.2
+
+コンパイル:
+clang -O2 -pthread -o volume volume_commented.c -lm
+
+カーネルの選び方（--kernel auto）:
+- AVX2を持つCPU: AVX2版（16サンプルずつ）
+- それ以外のx86: SSE2版（8サンプルずつ）
+- x86以外: スカラー版
+どのカーネルもscale_samples_scalarとビット単位で同じ結果になる
+
+固定小数点（--fixed auto）:
+- 倍率を q_mul / 2^q_shift（q_mulは16ビット整数）で近似し、整数の掛け算とシフトだけで計算する
+- 近似の誤差が最大振幅のサンプルで0.5未満になる倍率（0.5, 0.8, 1.2, 2.0など）で自動的に使われる
+- 整数演算なので、コンパイラやCPUが違っても結果が必ず同じになる
+- 各カーネル（スカラー, SSE2, AVX2）はscale_fixed_scalarとビット単位で同じ結果になる
 
 潜在的な問題:
-- オーバーフロー: 大きな倍率を指定すると音が歪む可能性
-- ファイル形式: WAV以外の形式では正しく動作しない
-- エラーハンドリング: ファイル読み書きエラーの詳細なチェックが不足
+- クリッピング: 大きな倍率を指定すると、範囲外のサンプルが最大値・最小値に張り付いて音が歪む
+- ファイル形式: WAV以外の形式、4GBを超えるRF64形式には対応していない
+- バイト順: 16ビットのカーネルはリトルエンディアンのCPU（x86, ARM等）を前提にしている
+- --in-place: 処理中に失敗すると元のファイルが途中まで書き換わった状態で残る
+- --mix: dataチャンクより後ろのチャンク（LIST等）は最も長い入力のものだけを残し、他の入力のものは捨てる
+- --normalize-to: 無音のファイル（-∞ dBFS）は倍率1.0のまま。RMSを目標にするとピークがクリッピングすることがある
 */
@@ -1,14 +1,41 @@
 // Modifies the volume of an audio file
 // 音声ファイルの音量を変更するプログラム
 
+#include <errno.h>   // errno（strtoullが範囲外を知らせる）を使用するため
 #include <stdint.h>  // 固定幅整数型（uint8_t, int16_t等）を使用するため
 #include <stdio.h>   // ファイル操作（fopen, fread, fwrite等）を使用するため
 #include <stdlib.h>  // atof関数（文字列を浮動小数点数に変換）を使用するため
+#include <string.h>  // strcmp関数（オプション文字列の比較）を使用するため
 
-// Number of bytes in .wav header
-// WAVファイルのヘッダーサイズは44バイト固定
-// ヘッダーには音声データの情報（サンプリングレート、チャンネル数、ビット深度等）が含まれる
-const int HEADER_SIZE = 44;
+// Number of bytes in the RIFF/WAVE preamble
+// WAVファイルの先頭 "RIFF" <全体のサイズ> "WAVE" の12バイト
+// その後ろにfmt（形式）, LIST（曲名等）, data（サンプル）などのチャンクが並ぶので、
+// ヘッダーのサイズは44バイトとは限らない
+const int RIFF_SIZE = 12;
+
+// Number of samples processed per block (default)
+// 1回のfread/fwriteでまとめて処理するサンプル数の既定値
+// 65536サンプル = 128KiB。1サンプルずつ処理する場合と比べてライブラリ呼び出しが1/65536になる
+const size_t DEFAULT_BLOCK_SAMPLES = 65536;
+
+// Largest block size accepted by --block-size
+// --block-sizeで指定できるサンプル数の最大（2^24サンプル = 16ビットで32MiB）
+// これ以下なら、サンプル数 × 1サンプルのバイト数（最大8）がsize_tであふれない
+const size_t MAX_BLOCK_SAMPLES = 16777216;
+
+// Alignment of the sample buffer in bytes
+// サンプルバッファの先頭アドレスとサイズをこのバイト数の倍数に揃える
+// 64バイト = 一般的なキャッシュラインのサイズ（ベクトル命令のロードにも都合がよい）
+const size_t BLOCK_ALIGNMENT = 64;
+
+// Number of bytes copied at a time for chunks other than data
+// dataチャンク以外のチャンクの中身を、何バイトずつコピーするか
+// チャンクのサイズはファイルに書かれた値なので、その大きさのメモリをまとめて確保しない
+#define CHUNK_BLOCK 4096
+
+// ===== 関数プロトタイプ宣言 =====
+int copy_wav_header(FILE *input, FILE *output, uint32_t *data_size);  // dataチャンクまでをコピーする
+size_t parse_block_size(const char *text);                            // --block-sizeの値を読む
 
 int main(int argc, char *argv[])
 {
@@ -16,9 +43,26 @@ int main(int argc, char *argv[])
     // コマンドライン引数をチェック
     // argc: 引数の個数（プログラム名も含む）
     // argv: 引数の配列（argv[0]=プログラム名, argv[1]=入力ファイル名, argv[2]=出力ファイル名, argv[3]=倍率）
-    if (argc != 4)
+    // 先頭に "--block-size N" を付けると1ブロックあたりのサンプル数を変更できる
+    size_t block_samples = DEFAULT_BLOCK_SAMPLES;
+    int arg = 1;  // 次に調べる引数の位置
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+    {
+        if (strcmp(argv[arg], "--block-size") == 0 && arg + 1 < argc)
+        {
+            // 不正な値・大きすぎる値なら0になる（parse_block_sizeを参照）
+            block_samples = parse_block_size(argv[arg + 1]);
+            arg += 2;
+        }
+        else
+        {
+            block_samples = 0;  // 未知のオプションは使い方の表示に回す
+            break;
+        }
+    }
+    if (argc - arg != 3 || block_samples == 0)
     {
-        printf("Usage: ./volume input.wav output.wav factor\n");
+        printf("Usage: ./volume [--block-size samples] input.wav output.wav factor\n");
         return 1;  // エラー終了
     }
 
@@ -28,7 +72,7 @@ int main(int argc, char *argv[])
     // 入力ファイルを読み取り専用で開く
     // "r"モード: 読み取り専用でテキストファイルを開く
     // WAVファイルはバイナリファイルなので本来は"rb"が適切だが、この例では"r"を使用
-    FILE *input = fopen(argv[1], "r");
+    FILE *input = fopen(argv[arg], "r");
     if (input == NULL)
     {
         printf("Could not open file.\n");
@@ -38,10 +82,11 @@ int main(int argc, char *argv[])
     // 出力ファイルを書き込み専用で開く
     // "w"モード: 書き込み専用でファイルを開く（既存ファイルがあれば上書き）
     // 同様にバイナリファイルなので本来は"wb"が適切
-    FILE *output = fopen(argv[2], "w");
+    FILE *output = fopen(argv[arg + 1], "w");
     if (output == NULL)
     {
         printf("Could not open file.\n");
+        fclose(input);
         return 1;  // ファイルが開けない場合はエラー終了
     }
 
@@ -49,70 +94,226 @@ int main(int argc, char *argv[])
     // atof: ASCII to Float（文字列を浮動小数点数に変換する関数）
     // 例：argv[3]が"2.0"なら factor = 2.0（音量2倍）
     //     argv[3]が"0.5"なら factor = 0.5（音量半分）
-    float factor = atof(argv[3]);
+    float factor = atof(argv[arg + 2]);
 
     // --- ここからが実装部分 ---
 
     // TODO: Copy header from input file to output file
     // 1. ヘッダーのコピー
-    // WAVファイルの最初の44バイトはヘッダー情報で、音声データではない
+    // dataチャンクの中身より前はヘッダー情報で、音声データではない
     // このヘッダーには音声の形式情報が含まれているので、そのままコピーする必要がある
-    
-    // uint8_t: 8ビット符号なし整数（0〜255の値を取る）
-    // ヘッダーを格納するためのバイト配列を宣言
-    uint8_t header[HEADER_SIZE];
-    
-    // fread: ファイルからデータを読み込む関数
-    // fread(読み込み先のバッファ, 1要素のサイズ, 要素数, ファイルポインタ)
-    // ここでは: header配列に, HEADER_SIZEバイトを, 1回で, inputファイルから読み込む
-    fread(header, HEADER_SIZE, 1, input);
-    
-    // fwrite: ファイルにデータを書き込む関数
-    // fwrite(書き込み元のバッファ, 1要素のサイズ, 要素数, ファイルポインタ)
-    // 読み込んだヘッダーをそのまま出力ファイルに書き込む
-    fwrite(header, HEADER_SIZE, 1, output);
+    // data_size: dataチャンクの中身（サンプル部分）のバイト数
+    uint32_t data_size;
+    if (copy_wav_header(input, output, &data_size) != 0)
+    {
+        fclose(input);
+        fclose(output);
+        return 1;
+    }
 
     // TODO: Read samples from input file and write updated data to output file
     // 2. サンプルの読み込み、音量変更、書き込み
     // ヘッダー以降は音声データ（サンプル）が続く
     // WAVファイルでは通常、1つのサンプルは16ビット（2バイト）の符号付き整数
-    
+    //
+    // 1サンプルずつfread/fwriteを呼ぶと、2GBのファイルでは約10億回のライブラリ呼び出しになる
+    // そこでblock_samples個のサンプルをまとめて読み込み、まとめて倍率を掛け、1回で書き込む
+
+    // バッファのバイト数をBLOCK_ALIGNMENTの倍数に切り上げる
+    // aligned_alloc関数はサイズがアライメントの倍数であることを要求するため
+    // block_samplesがMAX_BLOCK_SAMPLESより大きいと掛け算があふれるので、確保に失敗したものとして扱う
+    size_t buffer_size = 0;
+    if (block_samples <= MAX_BLOCK_SAMPLES)
+    {
+        buffer_size = block_samples * sizeof(int16_t);
+        buffer_size = (buffer_size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    }
+
     // int16_t: 16ビット符号付き整数（-32,768〜32,767の値を取る）
-    // 1つのサンプル（音の瞬間的な振幅値）を格納する変数
-    int16_t sample;
-    
-    // whileループでファイルの終端まで1サンプルずつ処理
-    // fread(&sample, sizeof(int16_t), 1, input) の戻り値:
-    // - 成功時: 読み込んだ要素数（ここでは1）
+    // aligned_alloc: 先頭アドレスがBLOCK_ALIGNMENTの倍数になるようにメモリを確保する
+    int16_t *samples = buffer_size > 0 ? aligned_alloc(BLOCK_ALIGNMENT, buffer_size) : NULL;
+    if (samples == NULL)
+    {
+        printf("Could not allocate memory.\n");
+        fclose(input);
+        fclose(output);
+        return 1;
+    }
+
+    // whileループでdataチャンクの終わりまでブロック単位で処理
+    // fread(samples, sizeof(int16_t), want, input) の戻り値:
+    // - 読み込めたサンプル数（最後のブロックではwantより少なくなる）
     // - ファイル終端や失敗時: 0
-    // 0以外（真）の間ループが継続される
-    while (fread(&sample, sizeof(int16_t), 1, input))
+    size_t remaining = data_size / sizeof(int16_t);  // まだ処理していないサンプル数
+    size_t count;
+    while (remaining > 0)
     {
-        // サンプルに係数を掛けて音量を変更
+        size_t want = remaining < block_samples ? remaining : block_samples;
+        count = fread(samples, sizeof(int16_t), want, input);
+        if (count == 0)
+        {
+            break;  // ファイルが途中で終わっている
+        }
+        remaining -= count;
+
+        // ブロック内のすべてのサンプルに係数を掛けて音量を変更
         // 音量の変更は単純に振幅値に倍率を掛けるだけ
         // factor = 2.0 なら音量2倍（振幅2倍）
         // factor = 0.5 なら音量半分（振幅半分）
         // factor = 0.0 なら無音
-        // 
+        //
         // 注意: int16_tの範囲を超える場合はオーバーフローが発生する可能性がある
         // 例：sample=20000, factor=2.0 の場合、40000となり正常
         //     sample=30000, factor=2.0 の場合、60000となるが、int16_tの最大値32767を超える
-        sample = sample * factor;
+        for (size_t i = 0; i < count; i++)
+        {
+            samples[i] = samples[i] * factor;
+        }
 
-        // 変更したサンプルを出力ファイルに書き込む
-        // sizeof(int16_t): int16_t型のサイズ（通常2バイト）
-        // &sample: sample変数のアドレス（ポインタ）
-        fwrite(&sample, sizeof(int16_t), 1, output);
+        // 変更したブロックを1回のfwriteで出力ファイルに書き込む
+        // 書き込めた数が読み込んだ数より少なければ書き込みエラー（ディスク容量不足など）
+        if (fwrite(samples, sizeof(int16_t), count, output) != count)
+        {
+            printf("Could not write file.\n");
+            free(samples);
+            fclose(input);
+            fclose(output);
+            return 1;
+        }
+    }
+
+    // dataチャンクより後ろ（詰め物やLIST等のチャンク）は変更せずにそのままコピーする
+    // バッファをバイト単位で使い回す
+    while ((count = fread(samples, 1, buffer_size, input)) > 0)
+    {
+        if (fwrite(samples, 1, count, output) != count)
+        {
+            printf("Could not write file.\n");
+            free(samples);
+            fclose(input);
+            fclose(output);
+            return 1;
+        }
     }
 
+    // 確保したバッファを解放する
+    free(samples);
+
     // --- ここまでが実装部分 ---
 
     // Close files
     // 開いたファイルを必ず閉じる
     // メモリリークを防ぎ、他のプログラムがファイルにアクセスできるようにする
+    // fwriteはバッファに溜めるだけのことがあり、最後の書き込みはfcloseの中で行われる
+    // そこで失敗する（ディスク容量不足など）とfcloseがEOFを返すので、書き込みエラーとして扱う
     fclose(input);   // 入力ファイルを閉じる
-    fclose(output);  // 出力ファイルを閉じる
+    if (fclose(output) != 0)  // 出力ファイルを閉じる
+    {
+        printf("Could not write file.\n");
+        return 1;
+    }
     
     // main関数の正常終了
     // return 0; を省略した場合、C99以降では自動的に0が返される
 }
+
+// Copy the RIFF header and every chunk before the data chunk
+// "RIFF"〜"WAVE"と、dataチャンクの見出しまでのすべてのチャンクをそのままコピーする関数
+// fmtチャンクで16ビット整数PCMであることを確かめる
+// 戻り値: 成功なら0（*data_sizeにdataチャンクのバイト数）、失敗なら1
+int copy_wav_header(FILE *input, FILE *output, uint32_t *data_size)
+{
+    // "RIFF" <全体のサイズ> "WAVE" の12バイト
+    uint8_t riff[RIFF_SIZE];
+    if (fread(riff, RIFF_SIZE, 1, input) != 1 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0)
+    {
+        printf("Could not read header.\n");
+        return 1;
+    }
+    if (fwrite(riff, RIFF_SIZE, 1, output) != 1)
+    {
+        printf("Could not write file.\n");
+        return 1;
+    }
+
+    // チャンクの見出し: ID（4文字）+ 中身のサイズ（4バイト、リトルエンディアン）
+    uint8_t chunk[8];
+    int is_pcm16 = 0;  // fmtチャンクで16ビット整数PCMと確認できたら1
+    while (fread(chunk, sizeof(chunk), 1, input) == 1)
+    {
+        if (fwrite(chunk, sizeof(chunk), 1, output) != 1)
+        {
+            printf("Could not write file.\n");
+            return 1;
+        }
+        uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t) chunk[7] << 24);
+
+        // dataチャンクの見出しまでコピーしたら終わり（中身はサンプルとして処理する）
+        if (memcmp(chunk, "data", 4) == 0)
+        {
+            if (!is_pcm16)
+            {
+                printf("Unsupported WAV format.\n");
+                return 1;
+            }
+            *data_size = size;
+            return 0;
+        }
+
+        // それ以外のチャンクは中身をそのままコピーする（サイズが奇数なら1バイトの詰め物が付く）
+        // サイズはファイルに書かれた値で信用できない（0xFFFFFFFFなら+1で0に戻ってしまう）ので、
+        // 64ビットで数え、中身をまとめて確保せずにCHUNK_BLOCKバイトずつコピーする
+        uint64_t left = (uint64_t) size + (size & 1);
+        int is_fmt = memcmp(chunk, "fmt ", 4) == 0;
+        uint8_t block[CHUNK_BLOCK];
+        size_t offset = 0;  // 今のブロックの、チャンクの中身の中での位置
+        while (left > 0)
+        {
+            size_t want = left < CHUNK_BLOCK ? (size_t) left : CHUNK_BLOCK;
+            if (fread(block, 1, want, input) != want)
+            {
+                printf("Could not read header.\n");
+                return 1;
+            }
+            if (fwrite(block, 1, want, output) != want)
+            {
+                printf("Could not write file.\n");
+                return 1;
+            }
+
+            // fmtチャンク: 0バイト目が形式（1=整数PCM）、14バイト目が1サンプルのビット数
+            // CHUNK_BLOCKは16以上なので、最初のブロックに16バイト分が入っている
+            if (is_fmt && offset == 0 && size >= 16)
+            {
+                is_pcm16 = block[0] == 1 && block[1] == 0 && block[14] == 16 && block[15] == 0;
+            }
+            offset += want;
+            left -= want;
+        }
+    }
+
+    printf("Could not read header.\n");
+    return 1;
+}
+
+// Parse the --block-size argument
+// --block-sizeの値（1ブロックあたりのサンプル数）を読む関数
+// strtoullは"-1"も受け付けて、符号なしの非常に大きな数にしてしまう。そのまま使うと
+// バッファのバイト数を求める掛け算があふれ、小さなバッファに大きなブロックを読み込んでしまう
+// そこで先頭が数字であることを確かめ、数字以外が続く・範囲外（errnoがERANGE）・MAX_BLOCK_SAMPLESより大きい場合は失敗にする
+// 戻り値: 読めればブロックのサンプル数、読めなければ0（使い方の表示に回す）
+size_t parse_block_size(const char *text)
+{
+    if (text[0] < '0' || text[0] > '9')
+    {
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || value > MAX_BLOCK_SAMPLES)
+    {
+        return 0;
+    }
+    return (size_t) value;
+}